@@ -0,0 +1,117 @@
+// bench_contention.c
+// Mide cómo escala el acceso concurrente a la tabla de usuarios con el número de threads:
+// cada thread trabaja sobre sus propios usuarios alternando CONNECT/DISCONNECT (escritura)
+// y consultas de estado (lectura), como hacen los servicios del servidor.
+// Uso: ./bench_contention [-t threads máximos] [-u usuarios por thread] [-o operaciones por thread] [-g]
+//      -g usa un único mutex global para toda la tabla (esquema anterior) como referencia
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "registry.h"
+
+static int usersPerThread = 1000;
+static long opsPerThread = 200000;
+static int globalLock = 0;
+static pthread_mutex_t globalMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Función para obtener el tiempo actual en milisegundos */
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static void lock_user(const char* userName, int write) {
+    if (globalLock) pthread_mutex_lock(&globalMutex);
+    else if (write) registry_wrlock(userName);
+    else registry_rdlock(userName);
+}
+
+static void unlock_user(const char* userName) {
+    if (globalLock) pthread_mutex_unlock(&globalMutex);
+    else registry_unlock(userName);
+}
+
+/** Función ejecutada por cada thread del benchmark */
+static void* worker(void* arg) {
+    int id = *(int*) arg;
+    char userName[64];
+    unsigned int seed = id * 7919 + 1;
+    long connected = 0;
+    for (long i = 0; i < opsPerThread; i++) {
+        snprintf(userName, sizeof(userName), "t%03d_user%06d", id, rand_r(&seed) % usersPerThread);
+        int write = (i & 1) == 0;
+        lock_user(userName, write);
+        User* user = registry_find(userName);
+        if (write) {
+            if (user->status == USER_CONNECTED) registry_set_disconnected(user);
+            else registry_set_connected(user, "127.0.0.1", "5000");
+        } else if (user->status == USER_CONNECTED) {
+            connected++;
+        }
+        unlock_user(userName);
+    }
+    return (void*) connected;
+}
+
+int main(int argc, char *argv[]) {
+    int maxThreads = 8;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:u:o:g")) != -1) {
+        switch (opt) {
+            case 't': maxThreads = atoi(optarg); break;
+            case 'u': usersPerThread = atoi(optarg); break;
+            case 'o': opsPerThread = atol(optarg); break;
+            case 'g': globalLock = 1; break;
+            default:
+                fprintf(stderr, "Usage: %s [-t threads] [-u users] [-o ops] [-g]\n", argv[0]);
+                return -1;
+        }
+    }
+    if (maxThreads < 1 || usersPerThread < 1) {
+        fprintf(stderr, "Error: threads y usuarios deben ser mayores que 0\n");
+        return -1;
+    }
+
+    // Registrar los usuarios de todos los threads
+    if (registry_init() != 0) {
+        return -1;
+    }
+    char userName[64];
+    for (int t = 0; t < maxThreads; t++) {
+        for (int u = 0; u < usersPerThread; u++) {
+            snprintf(userName, sizeof(userName), "t%03d_user%06d", t, u);
+            registry_insert(userName);
+        }
+    }
+
+    printf("cerrojo: %s  usuarios/thread: %d  operaciones/thread: %ld  CPUs: %ld\n",
+           globalLock ? "mutex global" : "particiones rwlock", usersPerThread, opsPerThread,
+           sysconf(_SC_NPROCESSORS_ONLN));
+    printf("threads     ops/s        aceleración\n");
+    pthread_t* threads = malloc(sizeof(pthread_t) * maxThreads);
+    int* ids = malloc(sizeof(int) * maxThreads);
+    double base = 0;
+    for (int n = 1; n <= maxThreads; n *= 2) {
+        double t0 = now_ms();
+        for (int t = 0; t < n; t++) {
+            ids[t] = t;
+            pthread_create(&threads[t], NULL, worker, &ids[t]);
+        }
+        for (int t = 0; t < n; t++) {
+            pthread_join(threads[t], NULL);
+        }
+        double elapsed = now_ms() - t0;
+        double throughput = n * opsPerThread / (elapsed / 1000.0);
+        if (n == 1) base = throughput;
+        printf("%7d  %12.0f  %10.2fx\n", n, throughput, throughput / base);
+        if (n < maxThreads && n * 2 > maxThreads) n = maxThreads / 2;   // medir también maxThreads
+    }
+    free(threads);
+    free(ids);
+    registry_destroy();
+    return 0;
+}
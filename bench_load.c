@@ -0,0 +1,481 @@
+// bench_load.c
+// Generador de carga para el servidor: lanza N clientes simultáneos que hablan el protocolo de
+// texto de servicio (una conexión por petición, o una sesión con -k) contra localhost y
+// ejecutan una mezcla configurable de operaciones. Al terminar muestra el ritmo y las
+// latencias p50/p99/p999 de cada operación.
+// Cada cliente se registra y se conecta con su propio usuario. CONNECT y DISCONNECT alternan
+// su estado (la que toque según esté conectado), y antes de PUBLISH o LIST_* vuelve a
+// conectarse si no lo está. REGISTER registra cada vez un usuario nuevo.
+// Uso: ./bench_load [-p puerto] [-c clientes] [-d segundos] [-m mezcla] [-k] [-S servidor] [-A "opciones"]
+//      -m OP=peso,... entre REGISTER, CONNECT, PUBLISH, LIST_USERS, LIST_CONTENT y DISCONNECT
+//      -S arranca el servidor indicado en un directorio temporal y lo para al terminar
+//      -A añade opciones a la línea de mandatos del servidor arrancado con -S (p. ej. "-l DEBUG -s")
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "lines.h"
+
+#define DATE_TIME   "01/01/2025 00:00:00"   // dateTime de todas las peticiones
+
+// Operaciones de la mezcla
+enum {
+    LOAD_REGISTER,
+    LOAD_CONNECT,
+    LOAD_PUBLISH,
+    LOAD_LIST_USERS,
+    LOAD_LIST_CONTENT,
+    LOAD_DISCONNECT,
+    LOAD_OPS
+};
+
+static const char* opNames[LOAD_OPS] = {
+    "REGISTER", "CONNECT", "PUBLISH", "LIST_USERS", "LIST_CONTENT", "DISCONNECT"
+};
+
+// Latencias (en ms) y resultados de una operación en un cliente
+typedef struct {
+    double* samples;
+    long count;
+    long capacity;
+    long failed;        // respuestas con resultado distinto de 0
+} OpStats;
+
+// Estado de un cliente simulado
+typedef struct {
+    int id;
+    pthread_t thread;
+    int sock;           // sesión abierta con -k, -1 si no
+    int connected;
+    long published;
+    long registered;
+    long errors;        // peticiones sin respuesta (error de red)
+    OpStats ops[LOAD_OPS];
+    char userName[64];
+} LoadClient;
+
+static int port = 4950;
+static int session = 0;
+static int weights[LOAD_OPS] = { 1, 1, 4, 2, 2, 1 };
+static int totalWeight;
+static atomic_int stop;
+
+/** Función para obtener el tiempo actual en milisegundos */
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/** Función para borrar el directorio temporal del benchmark */
+static void remove_dir(const char* dir) {
+    DIR* d = opendir(dir);
+    if (d != NULL) {
+        struct dirent* entry;
+        while ((entry = readdir(d)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+            char path[1024];
+            snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+            unlink(path);
+        }
+        closedir(d);
+    }
+    rmdir(dir);
+}
+
+/** Función para interpretar la mezcla de operaciones (OP=peso separados por comas) */
+static int parse_mix(const char* mix) {
+    memset(weights, 0, sizeof(weights));
+    char copy[256];
+    snprintf(copy, sizeof(copy), "%s", mix);
+    char* saveptr;
+    for (char* item = strtok_r(copy, ",", &saveptr); item != NULL; item = strtok_r(NULL, ",", &saveptr)) {
+        char* eq = strchr(item, '=');
+        int op = 0;
+        if (eq != NULL) *eq = '\0';
+        while (op < LOAD_OPS && strcasecmp(item, opNames[op]) != 0) op++;
+        if (op == LOAD_OPS || eq == NULL || atoi(eq + 1) < 0) {
+            fprintf(stderr, "Error: operación de la mezcla no válida: %s\n", item);
+            return -1;
+        }
+        weights[op] = atoi(eq + 1);
+    }
+    return 0;
+}
+
+/** Función para abrir una conexión con el servidor en localhost */
+static int connect_server(void) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == -1) {
+        return -1;
+    }
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(sock, (struct sockaddr*) &addr, sizeof(addr)) == -1) {
+        close(sock);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return sock;
+}
+
+/** Función para leer exactamente n bytes; -1 si la conexión se cierra antes */
+static int read_full(int sock, char* buffer, size_t n) {
+    size_t done = 0;
+    while (done < n) {
+        ssize_t r = read(sock, buffer + done, n - done);
+        if (r == -1 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        done += r;
+    }
+    return 0;
+}
+
+/** Función para leer la respuesta: hasta el cierre, o una trama en modo sesión */
+// Deja en response los campos de la respuesta; devuelve su longitud o -1.
+static long read_response(int sock, MsgBuffer* response) {
+    response->len = 0;
+    if (session) {
+        uint32_t len;
+        if (read_full(sock, (char*) &len, sizeof(len)) == -1) return -1;
+        len = ntohl(len);
+        char* data = realloc(response->data, len + 1);
+        if (!data) return -1;
+        response->data = data;
+        response->capacity = len + 1;
+        if (read_full(sock, response->data, len) == -1) return -1;
+        response->len = len;
+    } else {
+        for (;;) {
+            if (response->capacity - response->len < 4096) {
+                size_t capacity = response->capacity ? response->capacity * 2 : 8192;
+                char* data = realloc(response->data, capacity);
+                if (!data) return -1;
+                response->data = data;
+                response->capacity = capacity;
+            }
+            ssize_t r = read(sock, response->data + response->len, response->capacity - response->len - 1);
+            if (r == -1 && errno == EINTR) continue;
+            if (r == -1) return -1;
+            if (r == 0) break;
+            response->len += r;
+        }
+    }
+    response->data[response->len] = '\0';
+    return response->len;
+}
+
+/** Función para enviar una petición, esperar su respuesta y anotar su latencia */
+// Devuelve el resultado de la operación, o -1 si no se obtuvo respuesta.
+static int request(LoadClient* client, int op, const char* const* fields, int nfields,
+                   MsgBuffer* message, MsgBuffer* response) {
+    message->len = 0;
+    for (int i = 0; i < nfields; i++) {
+        if (appendString(message, fields[i]) == -1) return -1;
+    }
+
+    double t0 = now_ms();
+    int sock = session ? client->sock : connect_server();
+    int r = sock == -1 ? -1 : 0;
+    if (r == 0 && session) {
+        struct iovec iov = { .iov_base = message->data, .iov_len = message->len };
+        r = sendFrameV(sock, &iov, 1);
+    } else if (r == 0) {
+        r = sendMessage(sock, message->data, message->len);
+    }
+    if (r == 0 && read_response(sock, response) <= 0) {
+        r = -1;
+    }
+    double elapsed = now_ms() - t0;
+    if (!session && sock != -1) {
+        close(sock);
+    }
+    if (r == -1) {
+        client->errors++;
+        return -1;
+    }
+
+    OpStats* stats = &client->ops[op];
+    if (stats->count == stats->capacity) {
+        long capacity = stats->capacity ? stats->capacity * 2 : 1024;
+        double* samples = realloc(stats->samples, sizeof(double) * capacity);
+        if (!samples) return -1;
+        stats->samples = samples;
+        stats->capacity = capacity;
+    }
+    stats->samples[stats->count++] = elapsed;
+    int code = atoi(response->data);
+    if (code != 0) {
+        stats->failed++;
+    }
+    return code;
+}
+
+/** Función ejecutada por cada cliente simulado */
+static void* client_thread(void* arg) {
+    LoadClient* client = arg;
+    MsgBuffer message, response;
+    initMsgBuffer(&message);
+    initMsgBuffer(&response);
+    char port[16], name[96];
+    unsigned int seed = client->id * 7919 + 1;
+    snprintf(client->userName, sizeof(client->userName), "load%d_%d", (int) getpid(), client->id);
+    snprintf(port, sizeof(port), "%d", 20000 + client->id);
+
+    client->sock = -1;
+    if (session) {
+        // Abrir la sesión: SESSION y su respuesta, sin trama
+        client->sock = connect_server();
+        char reply[2];
+        if (client->sock == -1 || sendMessage(client->sock, "SESSION", 8) == -1 ||
+            read_full(client->sock, reply, sizeof(reply)) == -1) {
+            fprintf(stderr, "Error al abrir la sesión del cliente %d\n", client->id);
+            client->errors++;
+            return NULL;
+        }
+    }
+
+    const char* reg[] = { "REGISTER", DATE_TIME, client->userName };
+    request(client, LOAD_REGISTER, reg, 3, &message, &response);
+    while (!atomic_load(&stop)) {
+        int pick = rand_r(&seed) % totalWeight;
+        int op = 0;
+        while (pick >= weights[op]) pick -= weights[op++];
+
+        if (op == LOAD_CONNECT || op == LOAD_DISCONNECT) {
+            op = client->connected ? LOAD_DISCONNECT : LOAD_CONNECT;
+        } else if (op != LOAD_REGISTER && !client->connected) {
+            op = LOAD_CONNECT;
+        }
+        int code;
+        switch (op) {
+            case LOAD_REGISTER: {
+                snprintf(name, sizeof(name), "%s_r%ld", client->userName, client->registered++);
+                const char* fields[] = { "REGISTER", DATE_TIME, name };
+                request(client, op, fields, 3, &message, &response);
+                break;
+            }
+            case LOAD_CONNECT: {
+                const char* fields[] = { "CONNECT", DATE_TIME, client->userName, "127.0.0.1", port };
+                code = request(client, op, fields, 5, &message, &response);
+                client->connected = code == 0 || code == 2;     // 2: ya estaba conectado
+                break;
+            }
+            case LOAD_DISCONNECT: {
+                const char* fields[] = { "DISCONNECT", DATE_TIME, client->userName };
+                request(client, op, fields, 3, &message, &response);
+                client->connected = 0;
+                break;
+            }
+            case LOAD_PUBLISH: {
+                snprintf(name, sizeof(name), "carga/%s_%ld.dat", client->userName, client->published++);
+                const char* fields[] = { "PUBLISH", DATE_TIME, client->userName, name, "fichero de carga" };
+                request(client, op, fields, 5, &message, &response);
+                break;
+            }
+            case LOAD_LIST_USERS: {
+                const char* fields[] = { "LIST_USERS", DATE_TIME, client->userName };
+                request(client, op, fields, 3, &message, &response);
+                break;
+            }
+            case LOAD_LIST_CONTENT: {
+                const char* fields[] = { "LIST_CONTENT", DATE_TIME, client->userName, client->userName };
+                request(client, op, fields, 4, &message, &response);
+                break;
+            }
+        }
+    }
+    if (client->sock != -1) {
+        close(client->sock);
+    }
+    freeMsgBuffer(&message);
+    freeMsgBuffer(&response);
+    return NULL;
+}
+
+/** Función para ordenar latencias */
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+/** Función para obtener el percentil p (0-1) de latencias ordenadas */
+static double percentile(const double* sorted, long n, double p) {
+    return n == 0 ? 0 : sorted[(long) (p * (n - 1))];
+}
+
+/** Función para arrancar el servidor en un directorio temporal y esperar a que acepte conexiones */
+// La traza del servidor va a server.log dentro del directorio.
+static pid_t start_server(const char* server, const char* serverArgs, const char* dir) {
+    char path[1024];
+    if (realpath(server, path) == NULL) {
+        perror("Error al buscar el servidor");
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("Error en fork");
+        return -1;
+    }
+    if (pid == 0) {
+        // Guardar la traza en un fichero, que cuesta escribir como en un despliegue real
+        if (chdir(dir) == -1) _exit(1);
+        int logFd = open("server.log", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (logFd == -1) _exit(1);
+        dup2(logFd, STDOUT_FILENO);
+        dup2(logFd, STDERR_FILENO);
+        char portStr[16];
+        snprintf(portStr, sizeof(portStr), "%d", port);
+        // Separar por espacios las opciones extra del servidor
+        char* args[64] = { path, "-p", portStr };
+        int nargs = 3;
+        char* extra = serverArgs != NULL ? strdup(serverArgs) : NULL;
+        for (char* arg = extra ? strtok(extra, " ") : NULL; arg != NULL && nargs < 63; arg = strtok(NULL, " ")) {
+            args[nargs++] = arg;
+        }
+        args[nargs] = NULL;
+        execv(path, args);
+        _exit(1);
+    }
+    for (int i = 0; i < 100; i++) {
+        int sock = connect_server();
+        if (sock != -1) {
+            close(sock);    // el servidor lo ve como una petición incompleta y la cierra
+            return pid;
+        }
+        usleep(50000);
+    }
+    fprintf(stderr, "Error: el servidor no acepta conexiones en el puerto %d\n", port);
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+int main(int argc, char *argv[]) {
+    int clients = 16;
+    int seconds = 10;
+    const char* server = NULL;
+    const char* serverArgs = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:c:d:m:kS:A:")) != -1) {
+        switch (opt) {
+            case 'p': port = atoi(optarg); break;
+            case 'c': clients = atoi(optarg); break;
+            case 'd': seconds = atoi(optarg); break;
+            case 'm': if (parse_mix(optarg) != 0) return -1; break;
+            case 'k': session = 1; break;
+            case 'S': server = optarg; break;
+            case 'A': serverArgs = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [-p port] [-c clients] [-d seconds] [-m OP=weight,...] [-k] [-S server] [-A \"server options\"]\n", argv[0]);
+                return -1;
+        }
+    }
+    totalWeight = 0;
+    for (int op = 0; op < LOAD_OPS; op++) totalWeight += weights[op];
+    if (clients < 1 || seconds < 1 || totalWeight == 0) {
+        fprintf(stderr, "Error: clientes, segundos y la suma de pesos deben ser mayores que 0\n");
+        return -1;
+    }
+    // Un cliente que cierra la conexión no debe terminar el proceso
+    signal(SIGPIPE, SIG_IGN);
+
+    pid_t serverPid = -1;
+    char dir[] = "/tmp/bench_load.XXXXXX";
+    if (server != NULL) {
+        if (mkdtemp(dir) == NULL) {
+            perror("Error al crear el directorio temporal");
+            return -1;
+        }
+        serverPid = start_server(server, serverArgs, dir);
+        if (serverPid == -1) {
+            rmdir(dir);
+            return -1;
+        }
+    }
+
+    printf("clientes: %d  duración: %d s  protocolo: %s  puerto: %d\n",
+           clients, seconds, session ? "sesión" : "una conexión por petición", port);
+    printf("mezcla:");
+    for (int op = 0; op < LOAD_OPS; op++) printf(" %s=%d", opNames[op], weights[op]);
+    printf("\n");
+
+    LoadClient* loadClients = calloc(clients, sizeof(LoadClient));
+    if (!loadClients) {
+        perror("Error al asignar memoria");
+        return -1;
+    }
+    double t0 = now_ms();
+    for (int i = 0; i < clients; i++) {
+        loadClients[i].id = i;
+        pthread_create(&loadClients[i].thread, NULL, client_thread, &loadClients[i]);
+    }
+    sleep(seconds);
+    atomic_store(&stop, 1);
+    for (int i = 0; i < clients; i++) {
+        pthread_join(loadClients[i].thread, NULL);
+    }
+    double elapsed = (now_ms() - t0) / 1000.0;
+
+    // Juntar las latencias de todos los clientes por operación
+    printf("operación        peticiones  resultado!=0       ops/s   p50 (ms)   p99 (ms)  p999 (ms)\n");
+    long total = 0, errors = 0;
+    for (int op = 0; op < LOAD_OPS; op++) {
+        long n = 0, failed = 0;
+        for (int i = 0; i < clients; i++) {
+            n += loadClients[i].ops[op].count;
+            failed += loadClients[i].ops[op].failed;
+        }
+        double* samples = malloc(sizeof(double) * (n ? n : 1));
+        if (!samples) {
+            perror("Error al asignar memoria");
+            return -1;
+        }
+        long pos = 0;
+        for (int i = 0; i < clients; i++) {
+            OpStats* stats = &loadClients[i].ops[op];
+            memcpy(samples + pos, stats->samples, sizeof(double) * stats->count);
+            pos += stats->count;
+            free(stats->samples);
+        }
+        qsort(samples, n, sizeof(double), compare_double);
+        printf("%-14s %12ld %13ld %11.0f %10.3f %10.3f %10.3f\n", opNames[op], n, failed, n / elapsed,
+               percentile(samples, n, 0.50), percentile(samples, n, 0.99), percentile(samples, n, 0.999));
+        free(samples);
+        total += n;
+    }
+    for (int i = 0; i < clients; i++) errors += loadClients[i].errors;
+    printf("total: %ld peticiones en %.1f s (%.0f ops/s), %ld sin respuesta\n", total, elapsed, total / elapsed, errors);
+    free(loadClients);
+
+    if (serverPid != -1) {
+        kill(serverPid, SIGINT);
+        waitpid(serverPid, NULL, 0);
+        char logPath[sizeof(dir) + 16];
+        snprintf(logPath, sizeof(logPath), "%s/server.log", dir);
+        struct stat st;
+        if (stat(logPath, &st) == 0) {
+            printf("traza del servidor: %lld bytes\n", (long long) st.st_size);
+        }
+        unlink(logPath);
+        char storage[sizeof(dir) + 16];
+        snprintf(storage, sizeof(storage), "%s/storage", dir);
+        remove_dir(storage);
+        rmdir(dir);
+    }
+    return errors > 0 ? 1 : 0;
+}
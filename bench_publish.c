@@ -0,0 +1,122 @@
+// bench_publish.c
+// Mide el coste de publicar un catálogo grande para un solo usuario: cada PUBLISH comprueba
+// primero si el fichero ya está publicado, como publish_content. Después busca todos los
+// ficheros (repetidos) y los elimina en orden aleatorio.
+// Uso: ./bench_publish [-n ficheros] [-l]
+//      -l comprueba los duplicados recorriendo la lista (esquema anterior) como referencia
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "registry.h"
+#include "strpool.h"
+
+static int linear = 0;
+
+/** Función para obtener el tiempo actual en milisegundos */
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/** Función para buscar un fichero del usuario recorriendo toda la lista */
+static int find_linear(const User* user, const char* fileName) {
+    for (int i = 0; i < user->contentsUsed; i++) {
+        if (user->contents[i].fileName != NULL && strcmp(user->contents[i].fileName, fileName) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int find_content(const User* user, const char* fileName) {
+    return linear ? find_linear(user, fileName) : registry_find_content(user, fileName);
+}
+
+static void print_phase(const char* name, int n, double elapsed) {
+    printf("%-10s %10d  %10.1f ms  %12.0f ops/s\n", name, n, elapsed, n / (elapsed / 1000.0));
+}
+
+int main(int argc, char *argv[]) {
+    int files = 100000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:l")) != -1) {
+        switch (opt) {
+            case 'n': files = atoi(optarg); break;
+            case 'l': linear = 1; break;
+            default:
+                fprintf(stderr, "Usage: %s [-n files] [-l]\n", argv[0]);
+                return -1;
+        }
+    }
+    if (files < 1) {
+        fprintf(stderr, "Error: el número de ficheros debe ser mayor que 0\n");
+        return -1;
+    }
+
+    if (registry_init() != 0) {
+        return -1;
+    }
+    User* user = registry_insert("bench_user");
+    if (user == NULL) {
+        return -1;
+    }
+    printf("ficheros: %d  duplicados: %s\n", files, linear ? "recorrido de la lista" : "índice hash");
+    printf("fase         operaciones      tiempo           ritmo\n");
+
+    // Publicar el catálogo, comprobando antes cada fichero como publish_content
+    char fileName[64], description[64];
+    double t0 = now_ms();
+    for (int i = 0; i < files; i++) {
+        snprintf(fileName, sizeof(fileName), "catalogo/fichero_%07d.dat", i);
+        snprintf(description, sizeof(description), "descripción %d", i % 100);
+        if (find_content(user, fileName) != -1 || registry_add_content(user, fileName, description, NULL) != 0) {
+            fprintf(stderr, "Error al publicar %s\n", fileName);
+            return -1;
+        }
+    }
+    print_phase("PUBLISH", files, now_ms() - t0);
+
+    // Volver a publicar todos: todos son duplicados
+    t0 = now_ms();
+    int duplicates = 0;
+    for (int i = 0; i < files; i++) {
+        snprintf(fileName, sizeof(fileName), "catalogo/fichero_%07d.dat", i);
+        duplicates += find_content(user, fileName) != -1;
+    }
+    print_phase("DUPLICADO", files, now_ms() - t0);
+
+    // Eliminar en orden aleatorio
+    int* order = malloc(sizeof(int) * files);
+    if (!order) {
+        perror("Error al asignar memoria");
+        return -1;
+    }
+    for (int i = 0; i < files; i++) order[i] = i;
+    unsigned int seed = 1;
+    for (int i = files - 1; i > 0; i--) {
+        int j = rand_r(&seed) % (i + 1);
+        int tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+    t0 = now_ms();
+    for (int i = 0; i < files; i++) {
+        snprintf(fileName, sizeof(fileName), "catalogo/fichero_%07d.dat", order[i]);
+        int index = find_content(user, fileName);
+        if (index == -1) {
+            fprintf(stderr, "Error: %s no está publicado\n", fileName);
+            return -1;
+        }
+        registry_remove_content(user, index);
+    }
+    print_phase("DELETE", files, now_ms() - t0);
+    printf("duplicados detectados: %d  contenidos restantes: %d\n", duplicates, user->contentsCount);
+
+    free(order);
+    registry_destroy();
+    strpool_destroy();
+    return 0;
+}
@@ -0,0 +1,132 @@
+// bench_recovery.c
+// Mide el tiempo de recuperación del storage: carga del snapshot más la cola del log.
+// Uso: ./bench_recovery [-u usuarios] [-c contenidos por usuario] [-t registros de la cola]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "registry.h"
+#include "strpool.h"
+#include "storage.h"
+#include "wal.h"
+
+/** Función para obtener el tiempo actual en milisegundos */
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/** Función para borrar el directorio temporal del benchmark */
+static void remove_dir(const char* dir) {
+    DIR* d = opendir(dir);
+    if (d != NULL) {
+        struct dirent* entry;
+        while ((entry = readdir(d)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+            char path[1024];
+            snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+            unlink(path);
+        }
+        closedir(d);
+    }
+    rmdir(dir);
+}
+
+int main(int argc, char *argv[]) {
+    int users = 100000;
+    int contents = 2;
+    int tail = 10000;
+    int opt;
+    while ((opt = getopt(argc, argv, "u:c:t:")) != -1) {
+        switch (opt) {
+            case 'u': users = atoi(optarg); break;
+            case 'c': contents = atoi(optarg); break;
+            case 't': tail = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-u users] [-c contents] [-t tail]\n", argv[0]);
+                return -1;
+        }
+    }
+
+    char dir[] = "/tmp/bench_recovery.XXXXXX";
+    if (mkdtemp(dir) == NULL || storage_init(dir) != 0 || registry_init() != 0 || storage_recover() < 0) {
+        perror("Error preparando el benchmark");
+        return -1;
+    }
+
+    // Poblar la tabla: la mitad de los usuarios conectados
+    char userName[64], fileName[64], port[16];
+    double t0 = now_ms();
+    for (int u = 0; u < users; u++) {
+        snprintf(userName, sizeof(userName), "user%07d", u);
+        User* user = registry_insert(userName);
+        if (u % 2 == 0) {
+            snprintf(port, sizeof(port), "%d", 1024 + u % 60000);
+            registry_set_connected(user, "10.0.0.1", port);
+        }
+        for (int c = 0; c < contents; c++) {
+            snprintf(fileName, sizeof(fileName), "file%07d_%d.dat", u, c);
+            registry_add_content(user, fileName, "descripcion del fichero", NULL);
+        }
+    }
+
+    // Snapshot de toda la tabla
+    double t1 = now_ms();
+    SnapshotImage image;
+    snapshot_init(&image);
+    storage_rotate();
+    for (UserNode* node = registry_first(); node != NULL; node = node->next) {
+        snapshot_add_user(&image, &node->user);
+    }
+    size_t imageSize = image.len;
+    if (storage_checkpoint(&image) != 0) {
+        fprintf(stderr, "Error escribiendo el snapshot\n");
+        return -1;
+    }
+    snapshot_free(&image);
+    double t2 = now_ms();
+
+    // Cola del log: publicaciones posteriores al snapshot
+    long long lsn = 0;
+    for (int i = 0; i < tail; i++) {
+        snprintf(userName, sizeof(userName), "user%07d", (int) (i % (users ? users : 1)));
+        snprintf(fileName, sizeof(fileName), "tail%07d.dat", i);
+        const char* fields[] = {userName, fileName, "publicado tras el snapshot"};
+        lsn = wal_append(WAL_PUBLISH, 3, fields);
+    }
+    if (tail > 0 && wal_wait(lsn) != 0) {
+        fprintf(stderr, "Error escribiendo la cola del log\n");
+        return -1;
+    }
+    storage_close();
+    registry_destroy();
+
+    // Recuperación: snapshot + cola del log
+    registry_init();
+    double t3 = now_ms();
+    long replayed = storage_recover();
+    double t4 = now_ms();
+    storage_close();
+
+    printf("usuarios: %d  contenidos/usuario: %d  cola del log: %d registros\n", users, contents, tail);
+    printf("poblar tabla:          %9.1f ms\n", t1 - t0);
+    printf("snapshot (%zu bytes): %9.1f ms\n", imageSize, t2 - t1);
+    printf("recuperación:          %9.1f ms  (%d usuarios, %ld registros del log)\n",
+           t4 - t3, registry_count(), replayed);
+    size_t strings, stringBytes;
+    strpool_stats(&strings, &stringBytes);
+    printf("cadenas compartidas:   %9zu  (%.1f MB)\n", strings, stringBytes / (1024.0 * 1024.0));
+
+    int ok = registry_count() == users && replayed == tail;
+    registry_destroy();
+    remove_dir(dir);
+    if (!ok) {
+        fprintf(stderr, "Estado recuperado incorrecto\n");
+        return -1;
+    }
+    return 0;
+}
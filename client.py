@@ -1,10 +1,125 @@
 from enum import Enum
 from zeep import Client as ZeepClient
+from zeep.transports import Transport
 import argparse
+import collections
+import concurrent.futures
+import datetime
+import hashlib
+import select
 import socket
+import struct
 import threading
+import time
 import os
 
+class SessionSocket:
+    """Conexión persistente con el servidor (modo sesión). Ofrece sendall/recv/close como un
+    socket: cada operación se envía como una trama (longitud de 4 bytes y campos) al empezar a
+    leer su respuesta, que llega también precedida de su longitud"""
+
+    def __init__(self, sock):
+        self._sock = sock
+        self._request = b''
+        self._response = b''
+
+    def _recvExact(self, n):
+        data = b''
+        while len(data) < n:
+            chunk = self._sock.recv(n - len(data))
+            if not chunk:
+                raise ConnectionError("Sesión cerrada por el servidor")
+            data += chunk
+        return data
+
+    def sendall(self, data):
+        self._request += data
+
+    def _exchange(self, request):
+        self._sock.sendall(struct.pack('!I', len(request)) + request)
+        length = struct.unpack('!I', self._recvExact(4))[0]
+        return self._recvExact(length)
+
+    def recv(self, n):
+        if self._request:
+            # Enviar la petición acumulada y recibir su respuesta completa
+            try:
+                request, self._request = self._request, b''
+                self._response = self._exchange(request)
+            except (socket.error, ConnectionError):
+                self.shutdown()
+                raise
+        data = self._response[:n]
+        self._response = self._response[n:]
+        return data
+
+    def close(self):
+        # La conexión sigue abierta para la siguiente operación
+        self._request = b''
+        self._response = b''
+
+    def shutdown(self):
+        self._sock.close()
+        if client._session is self:
+            client._session = None
+
+
+class BinarySocket(SessionSocket):
+    """Conexión persistente con el servidor en el protocolo binario (v2). Traduce los campos de
+    cada operación a una trama (cabecera y campos TLV) y su respuesta a los campos de texto que
+    leen los métodos del cliente"""
+
+    MAGIC = b'\0P2P'
+    VERSION = 2
+    HEADER = struct.Struct('!IIHH')     # longitud, id de petición, código de operación, status
+    TLV = struct.Struct('!BB')          # tipo y longitud
+    # Tipos TLV (protocol.h) y los que llevan un entero de 4 bytes
+    (DATETIME, USER, IP, PORT, FILE, DESCRIPTION, REMOTE_USER, QUERY, MODE, PATTERN, OFFSET, LIMIT, COUNT, TOTAL,
+     RESULT, FORMAT, LINE, SIZE, DIGEST, CHUNK_SIZE, CHUNK) = range(1, 22)
+    INTEGERS = (PORT, OFFSET, LIMIT, COUNT, TOTAL, RESULT, CHUNK_SIZE)
+    # Código de operación y tipos de los campos que siguen a dateTime y userName
+    OPERATIONS = {
+        "REGISTER": (1, ()), "UNREGISTER": (2, ()), "CONNECT": (3, (IP, PORT)), "DISCONNECT": (4, ()),
+        "PUBLISH": (5, (FILE, DESCRIPTION)), "DELETE": (6, (FILE,)), "LIST_USERS": (7, ()),
+        "LIST_CONTENT": (8, (REMOTE_USER,)), "SEARCH": (9, (QUERY,)),
+        "SEARCH_NAME": (10, (MODE, PATTERN, OFFSET, LIMIT)),
+        "PUBLISH_BATCH": (11, (COUNT,)), "DELETE_BATCH": (12, (COUNT,)), "STATS": (13, (FORMAT,)),
+        "PUBLISH_HASHED": (14, (FILE, DESCRIPTION, SIZE, DIGEST, CHUNK_SIZE, COUNT)), "SEARCH_DIGEST": (15, (DIGEST,)),
+    }
+    # Tipos de los campos que se repiten por cada contenido de un lote (o trozo del fichero)
+    BATCH_ITEMS = {"PUBLISH_BATCH": (FILE, DESCRIPTION), "DELETE_BATCH": (FILE,), "PUBLISH_HASHED": (CHUNK,)}
+
+    def __init__(self, sock):
+        super().__init__(sock)
+        self._requestId = 0
+
+    def _exchange(self, request):
+        fields = request.split(b'\0')[:-1]
+        opcode, types = self.OPERATIONS[fields[0].decode()]
+        types += self.BATCH_ITEMS.get(fields[0].decode(), ()) * len(fields)
+        payload = b''
+        for tlvType, value in zip((self.DATETIME, self.USER) + types, fields[1:]):
+            if tlvType in self.INTEGERS:
+                value = struct.pack('!i', int(value))
+            payload += self.TLV.pack(tlvType, len(value)) + value
+        self._requestId += 1
+        self._sock.sendall(self.HEADER.pack(len(payload), self._requestId, opcode, 0) + payload)
+
+        length, requestId, opcode, status = self.HEADER.unpack(self._recvExact(self.HEADER.size))
+        payload = self._recvExact(length)
+        # Resultado y campos de la respuesta como en el protocolo de texto
+        response = str(status).encode() + b'\0'
+        pos = 0
+        while pos < len(payload):
+            tlvType, tlvLen = self.TLV.unpack_from(payload, pos)
+            value = payload[pos + self.TLV.size:pos + self.TLV.size + tlvLen]
+            if tlvType in self.INTEGERS:
+                value = str(struct.unpack('!i', value)[0]).encode()
+            response += value + b'\0'
+            pos += self.TLV.size + tlvLen
+        return response
+
+
 class client:
 
     # ******************** TYPES *********************
@@ -23,11 +138,39 @@ class client:
     _users = {}         # Diccionario para almacenar los usuarios
     _lastRegisteredUser = None      # Nombre del último usuario registrado
     _lastConnectedUser = None       # Nombre del último usuario conectado
+    _useSession = False     # Reutilizar una conexión con el servidor para todas las operaciones
+    _useBinary = False      # Usar el protocolo binario (v2); implica conexión persistente
+    _session = None         # Conexión persistente (SessionSocket) si _useSession
+    _peerPort = None        # Puerto del servidor de ficheros nativo (peer) en lugar del hilo de escucha
+    _fileHashes = {}        # Resúmenes de los ficheros servidos: (dev, ino) -> (tamaño, mtime, sha256, trozos)
+    _fileHashesPending = {}     # Resúmenes en cálculo: (dev, ino, tamaño, mtime) -> Future
+    _fileHashesLock = threading.Lock()
+    GET_FILE_BLOCK = 1 << 20        # bloque de recepción y de cálculo de resúmenes
+    GET_FILE_RETRIES = 3            # reanudaciones de una descarga cortada antes de fallar
+    GET_FILE_LEGACY_WAIT = 0.5      # segundos que se espera la respuesta a GET_FILE antes de enviar el dateTime
+    GET_FILE_TIMEOUT = 10           # segundos de espera al conectar y entre bloques de datos
+    KEEPALIVE_IDLE = 10             # segundos sin tráfico antes de comprobar que el otro usuario sigue ahí
+    KEEPALIVE_INTERVAL = 5          # segundos entre comprobaciones sin respuesta
+    KEEPALIVE_COUNT = 3             # comprobaciones sin respuesta antes de dar la conexión por perdida
+    CHUNK_SIZE = 4 << 20            # trozos con resumen propio (como PEER_CHUNK_SIZE en peer.c)
+    SWARM_STREAMS = 2               # descargas simultáneas de cada par en GET_FILE_SWARM
+    SWARM_FAILURES = 3              # fallos de un par antes de dejar de pedirle trozos
+    HASH_THREADS = (os.cpu_count() or 1) + 1    # hilos que resumen un fichero (uno para el fichero completo)
+    MAX_CHUNKS = 4096               # trozos de un fichero publicado con resumen (CONTENT_MAX_CHUNKS)
+    DATETIME_URL = 'http://localhost:8000/?wsdl'    # servicio web que devuelve la fecha y hora
+    DATETIME_FORMAT = '%d/%m/%Y %H:%M:%S'           # formato de get_current_datetime (web_services.py)
+    DATETIME_TIMEOUT = 5            # segundos de espera de cada llamada al servicio web
+    _dateTimeClient = None          # Cliente SOAP reutilizado (WSDL ya leído, conexión HTTP abierta)
+    _dateTimeLock = threading.Lock()
+    _dateTimeMaxAge = 0             # Segundos que el reloj local sustituye al servicio web (0: preguntar siempre)
+    _dateTimeBase = None            # Última fecha del servicio web y su instante en el reloj monotónico
 
     # ******************** METHODS *******************
     @staticmethod
     def connectServer(host, port):
         """Método para conectar con el servidor"""
+        if client._useSession:
+            return client.connectSession(host, port)
         try:
             # Crear el socket del servidor
             sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
@@ -40,20 +183,53 @@ class client:
             print(f"Error al conectar o crear el socket del servidor: {e}")
             return None
 
+    @staticmethod
+    def connectSession(host, port):
+        """Método para obtener la conexión persistente con el servidor, abriéndola si hace falta"""
+        if client._session is not None:
+            return client._session
+        try:
+            sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+            server_address = (host, int(port))
+            print('Connecting to {} port {} (session)'.format(*server_address))
+            sock.connect(server_address)
+            sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            if client._useBinary:
+                # Negociar el protocolo binario: el servidor responde con la versión aceptada
+                sock.sendall(BinarySocket.MAGIC + struct.pack('!I', BinarySocket.VERSION))
+                session = BinarySocket(sock)
+                hello = session._recvExact(8)
+                if hello[:4] != BinarySocket.MAGIC or struct.unpack('!I', hello[4:])[0] != BinarySocket.VERSION:
+                    sock.close()
+                    return None
+            else:
+                # Pasar la conexión a modo sesión
+                sock.sendall("SESSION".encode() + b'\0')
+                if client.recvRes(sock) != "0":
+                    sock.close()
+                    return None
+                session = SessionSocket(sock)
+            client._session = session
+            return client._session
+        except (socket.error, ValueError) as e:
+            print(f"Error al abrir la sesión con el servidor: {e}")
+            return None
+
     @staticmethod
     def recvRes(sock):
         """Método para recibir la respuesta del cliente servidor"""
         try:
-            a = ''
+            a = b''
             while True:
                 msg = sock.recv(1)
                 if not msg:
                     raise ValueError("Conexión cerrada por el cliente servidor")
                 if msg == b'\0':
                     break
-                a += msg.decode()
+                a += msg
 
-            return a
+            # Decodificar el campo completo: un carácter puede ocupar varios bytes
+            return a.decode()
         except socket.error as e:
             print(f"Error de socket recibiendo la respuesta: {e}")
             raise  # Propagar el error
@@ -139,6 +315,64 @@ class client:
             # Cerrar la conexión
             sock.close()
 
+    # Auxiliar para calcular el SHA-256 de un fichero y de cada trozo de CHUNK_SIZE bytes,
+    # guardados mientras el fichero no cambie. hashlib suelta el GIL mientras resume, así que
+    # los trozos se resumen a la vez en varios hilos; el resumen del fichero completo no se
+    # puede repartir y lo calcula otro hilo en paralelo con ellos. Las peticiones que llegan
+    # mientras se calcula (otros pares, reintentos) esperan ese mismo cálculo
+    @staticmethod
+    def file_hashes(filename):
+        st = os.stat(filename)
+        key = (st.st_dev, st.st_ino)
+        version = key + (st.st_size, st.st_mtime_ns)
+        with client._fileHashesLock:
+            cached = client._fileHashes.get(key)
+            if cached is not None and cached[:2] == (st.st_size, st.st_mtime_ns):
+                return cached[2], cached[3]
+            pending = client._fileHashesPending.get(version)
+            owner = pending is None
+            if owner:
+                pending = concurrent.futures.Future()
+                client._fileHashesPending[version] = pending
+        if not owner:
+            return pending.result()
+        try:
+            result = client.computeHashes(filename, st)
+        except BaseException as e:
+            with client._fileHashesLock:
+                del client._fileHashesPending[version]
+            pending.set_exception(e)
+            raise
+        with client._fileHashesLock:
+            client._fileHashes[key] = (st.st_size, st.st_mtime_ns) + result
+            del client._fileHashesPending[version]
+        pending.set_result(result)
+        return result
+
+    # Auxiliar de file_hashes que resume el fichero
+    @staticmethod
+    def computeHashes(filename, st):
+        fd = os.open(filename, os.O_RDONLY)
+        try:
+            def wholeDigest():
+                digest = hashlib.sha256()
+                offset = 0
+                while True:
+                    block = os.pread(fd, client.GET_FILE_BLOCK, offset)
+                    if not block:
+                        return digest.hexdigest()
+                    digest.update(block)
+                    offset += len(block)
+            def chunkDigest(offset):
+                return hashlib.sha256(os.pread(fd, client.CHUNK_SIZE, offset)).hexdigest()
+            with concurrent.futures.ThreadPoolExecutor(max_workers=client.HASH_THREADS) as pool:
+                whole = pool.submit(wholeDigest)
+                chunks = list(pool.map(chunkDigest, range(0, st.st_size, client.CHUNK_SIZE)))
+                digest = whole.result()
+        finally:
+            os.close(fd)
+        return digest, chunks
+
     # Auxiliar para encontrar un puerto libre
     @staticmethod
     def find_free_port():
@@ -164,7 +398,8 @@ class client:
                 try:
                     client_socket, addr = self.server_socket.accept()
                     print(f"Accepted connection from {addr}")
-                    self.handle_client(client_socket)
+                    # Atender cada descarga en su propio hilo: varios pares pueden pedir trozos a la vez
+                    threading.Thread(target=self.handle_client, args=(client_socket,), daemon=True).start()
                 except socket.timeout:
                     continue  # Handle timeout by simply looping back
                 except OSError as e:
@@ -178,12 +413,30 @@ class client:
             self.server_socket.close()
             self.join()  # Wait for thread to finish
 
+        def recvField(self, client_socket, pending):
+            """Leer un campo terminado en '\\0'; pending guarda lo recibido de más"""
+            while b'\0' not in pending:
+                data = client_socket.recv(1024)
+                if not data:
+                    raise ValueError("Conexión cerrada antes de completar la petición")
+                pending += data
+            field, _, rest = pending.partition(b'\0')
+            pending[:] = rest
+            return field.decode()
+
         def handle_client(self, client_socket):
             try:
-                command = client_socket.recv(1024).decode().strip()
-                if command.startswith("GET_FILE"):
-                    _, filename = command.split(maxsplit=1)
-                    filename = filename.strip('\x00').strip()
+                # Campos: operación, fichero, dateTime y, en GET_FILE_RANGE, offset y longitud
+                pending = bytearray()
+                command = self.recvField(client_socket, pending).strip()
+                if command not in ("GET_FILE", "GET_FILE_RANGE", "GET_FILE_HASHES"):
+                    #GET_FILE FAIL (2)
+                    print("Command not found")
+                    client_socket.sendall("2".encode() + b'\0')
+                    return
+                filename = self.recvField(client_socket, pending)
+                self.recvField(client_socket, pending)      # dateTime
+                if command == "GET_FILE":
                     if self.check_file_exists(filename):
                         #GET_FILE OK (0)
                         client_socket.sendall("0".encode() + b'\0')
@@ -191,10 +444,32 @@ class client:
                     else:
                         #GET_FILE FAIL / FILE NOT EXIST (1)
                         client_socket.sendall("1".encode() + b'\0')
-                else:
-                    #GET_FILE FAIL (2)
-                    print("Command not found")
-                    client_socket.sendall("2".encode() + b'\0')
+                    return
+                if command == "GET_FILE_HASHES":
+                    if not self.check_file_exists(filename):
+                        #GET_FILE FAIL / FILE NOT EXIST (1)
+                        client_socket.sendall("1".encode() + b'\0')
+                        return
+                    #GET_FILE OK (0), tamaño, resumen, tamaño de trozo y resumen de cada trozo
+                    digest, chunks = client.file_hashes(filename)
+                    fields = ["0", str(os.path.getsize(filename)), digest, str(client.CHUNK_SIZE), str(len(chunks))] + chunks
+                    client_socket.sendall(b''.join(f.encode() + b'\0' for f in fields))
+                    return
+                offset = int(self.recvField(client_socket, pending))
+                length = int(self.recvField(client_socket, pending))
+                if not self.check_file_exists(filename):
+                    #GET_FILE FAIL / FILE NOT EXIST (1)
+                    client_socket.sendall("1".encode() + b'\0')
+                    return
+                size = os.path.getsize(filename)
+                if offset < 0 or length < 0 or offset > size:
+                    #GET_FILE FAIL / RANGO NO VÁLIDO (3)
+                    client_socket.sendall("3".encode() + b'\0')
+                    return
+                end = size if length == 0 else min(size, offset + length)
+                #GET_FILE OK (0), tamaño y resumen del fichero completo
+                client_socket.sendall(b'0\0' + str(size).encode() + b'\0' + client.file_hashes(filename)[0].encode() + b'\0')
+                self.send_file(client_socket, filename, offset, end)
             except Exception as e:
                 #GET_FILE FAIL (2)
                 print("Excepcion")
@@ -205,31 +480,41 @@ class client:
 
         def check_file_exists(self, filename):
             """Comprobar si el archivo existe en el directorio raíz"""
-            return os.path.exists(filename)
+            return os.path.isfile(filename)
+
+        def send_file(self, client_socket, filename, offset=0, end=None):
+            """Enviar el fichero (o los bytes [offset, end)) con sendfile"""
+            with open(filename, 'rb') as f:
+                if end is None:
+                    end = os.fstat(f.fileno()).st_size
+                while offset < end:
+                    sent = client_socket.sendfile(f, offset, end - offset)
+                    if sent == 0:
+                        break   # el fichero se ha acortado mientras se enviaba
+                    offset += sent
+
+    # Servidor de ficheros externo (./peer): ocupa el lugar del hilo de escucha, pero lo
+    # arranca y lo para el usuario
+    class ExternalPeer:
+        def __init__(self, host, port):
+            self.host = host
+            self.port = port
 
-        def send_file(self, client_socket, filename):
-            try:
-                with open(filename, 'rb') as f:
-                    while True:
-                        data = f.read(1024)
-                        if not data:
-                            break  # Si no hay más datos, termina el bucle
-                        client_socket.sendall(data)
-            except FileNotFoundError:
-                #GET_FILE FAIL / FILE NOT EXIST (1)
-                client_socket.sendall("1".encode() + b'\0')
-            except Exception as e:
-                #GET_FILE FAIL (2)
-                client_socket.sendall("2".encode() + b'\0')
+        def stop(self):
+            pass
 
     @staticmethod
     def connect(user):
         """Método para conectarse al sistema"""
-        # Encontrar un puerto libre
-        port = client.find_free_port()
-        client._thread = client.ClientServer('0.0.0.0', port)
-        # Iniciar el hilo del servidor de escucha
-        client._thread.start()
+        if client._peerPort is not None:
+            # Anunciar el puerto del servidor de ficheros nativo
+            client._thread = client.ExternalPeer('0.0.0.0', client._peerPort)
+        else:
+            # Encontrar un puerto libre
+            port = client.find_free_port()
+            client._thread = client.ClientServer('0.0.0.0', port)
+            # Iniciar el hilo del servidor de escucha
+            client._thread.start()
         # TRATAR ERRORES
 
         # Conectarse al servidor
@@ -348,8 +633,10 @@ class client:
         return client.RC.ERROR
 
     @staticmethod
-    def publish(fileName, description):
-        """Método para publicar contenidos"""
+    def publish(fileName, description, hashed=False):
+        """Método para publicar contenidos. Con hashed, el fichero local se publica con su resumen
+        (PUBLISH_HASHED) para que se pueda buscar por contenido y comprobar al descargarlo"""
+        op = "PUBLISH_HASHED" if hashed else "PUBLISH"
         # Validar que el nombre del archivo no contenga espacios en blanco
         if " " in fileName:
             print("PUBLISH FAIL: El nombre del archivo no puede contener espacios en blanco.")
@@ -364,15 +651,29 @@ class client:
             print("PUBLISH FAIL: La descripción excede los 256 bytes de longitud máxima.")
             return client.RC.USER_ERROR
 
+        manifest = None
+        if hashed:
+            # El resumen se calcula antes de conectarse: el fichero tiene que estar en disco
+            try:
+                size = os.path.getsize(fileName)
+                if size > client.CHUNK_SIZE * client.MAX_CHUNKS:
+                    print(f"PUBLISH_HASHED FAIL: El fichero excede los {client.CHUNK_SIZE * client.MAX_CHUNKS} bytes de tamaño máximo.")
+                    return client.RC.USER_ERROR
+                digest, chunks = client.file_hashes(fileName)
+                manifest = (size, digest, chunks)
+            except OSError as e:
+                print(f"PUBLISH_HASHED FAIL: {e}")
+                return client.RC.USER_ERROR
+
         # Conectarse al servidor
         sock = client.connectServer(client._server, client._port)
         if sock is None:
-            print("PUBLISH FAIL")
+            print(f"{op} FAIL")
             return client.RC.USER_ERROR
 
         try:
             # Enviar cadena con la operación
-            sock.sendall("PUBLISH".encode() + b'\0')
+            sock.sendall(op.encode() + b'\0')
             # Enviar el dateTime
             sock.sendall(str(client.dateTimeService()).encode() + b'\0')
             # Enviar el nombre de usuario que publica el fichero
@@ -391,29 +692,37 @@ class client:
             sock.sendall(str(fileName).encode() + b'\0')
             # Enviar una cadena de caracteres con la descripcion del contenido
             sock.sendall(str(description).encode() + b'\0')
+            if manifest is not None:
+                # Tamaño, resumen del fichero, tamaño y número de trozos y resumen de cada trozo
+                size, digest, chunks = manifest
+                sock.sendall(b'\0'.join(str(field).encode() for field in
+                                        (size, digest, client.CHUNK_SIZE, len(chunks), *chunks)) + b'\0')
             # Recibir el resultado de la operación
             res = client.recvRes(sock)
 
             # Tratar el resultado de la operación
             if res == "0":
-                print("PUBLISH OK")
+                print(f"{op} OK")
                 return client.RC.OK
             elif res == "1":
-                print("PUBLISH FAIL, USER DOES NOT EXIST")
+                print(f"{op} FAIL, USER DOES NOT EXIST")
                 return client.RC.ERROR
             elif res == "2":
-                print("PUBLISH FAIL, USER NOT CONNECTED")
+                print(f"{op} FAIL, USER NOT CONNECTED")
                 return client.RC.USER_ERROR
             elif res == "3":
-                print("PUBLISH FAIL, CONTENT ALREADY PUBLISHED")
+                print(f"{op} FAIL, CONTENT ALREADY PUBLISHED")
                 return client.RC.USER_ERROR
             elif res == "4":
-                print("PUBLISH FAIL")
+                print(f"{op} FAIL")
+                return client.RC.USER_ERROR
+            elif res == "5":
+                print(f"{op} FAIL, INVALID DIGEST")
                 return client.RC.USER_ERROR
 
         except Exception as e:
-            print(f"Error durante la operación PUBLISH: {e}")
-            print("PUBLISH FAIL")
+            print(f"Error durante la operación {op}: {e}")
+            print(f"{op} FAIL")
             return client.RC.USER_ERROR
         finally:
             # Cerrar la conexión
@@ -482,6 +791,149 @@ class client:
             sock.close()
         return client.RC.ERROR
 
+    @staticmethod
+    def batch(op, items):
+        """Método para publicar (PUBLISH_BATCH) o eliminar (DELETE_BATCH) varios contenidos en una sola operación.
+        items es la lista de contenidos: (fileName, description) o fileName"""
+        # Conectarse al servidor
+        sock = client.connectServer(client._server, client._port)
+        if sock is None:
+            print(f"{op} FAIL")
+            return client.RC.USER_ERROR
+
+        try:
+            # Enviar cadena con la operación
+            sock.sendall(op.encode() + b'\0')
+            # Enviar el dateTime
+            sock.sendall(str(client.dateTimeService()).encode() + b'\0')
+            # Enviar el nombre de usuario que realiza la operación
+            if client._userName is None:
+                # Arreglo para recibir el error USER NOT CONNECTED
+                if client._lastConnectedUser is None:
+                    # Si todavía nadie se ha conectado, enviar el último registrado
+                    sock.sendall(str(client._lastRegisteredUser).encode() + b'\0')
+                else:
+                    # Si no hay cliente conectado, enviar el último conectado
+                    sock.sendall(str(client._lastConnectedUser).encode() + b'\0')
+            else:
+                # Si hay un cliente conectado, enviar su userName
+                sock.sendall(str(client._userName).encode() + b'\0')
+            # Enviar el número de contenidos y los campos de cada uno
+            sock.sendall(str(len(items)).encode() + b'\0')
+            for item in items:
+                for field in (item if isinstance(item, tuple) else (item,)):
+                    sock.sendall(str(field).encode() + b'\0')
+            # Recibir el resultado de la operación
+            res = client.recvRes(sock)
+
+            # Tratar el resultado de la operación
+            if res == "0":
+                print(f"{op} OK")
+                # Recibir el resultado de cada contenido, en el orden en que se enviaron
+                failed = "CONTENT ALREADY PUBLISHED" if op == "PUBLISH_BATCH" else "CONTENT NOT PUBLISHED"
+                count = int(client.recvRes(sock))
+                for item in items[:count]:
+                    fileName = item[0] if isinstance(item, tuple) else item
+                    itemRes = client.recvRes(sock)
+                    if itemRes == "0":
+                        print(f"{fileName} OK")
+                    elif itemRes == "3":
+                        print(f"{fileName} FAIL, {failed}")
+                    else:
+                        print(f"{fileName} FAIL")
+                return client.RC.OK
+            elif res == "1":
+                print(f"{op} FAIL, USER DOES NOT EXIST")
+                return client.RC.ERROR
+            elif res == "2":
+                print(f"{op} FAIL, USER NOT CONNECTED")
+                return client.RC.USER_ERROR
+            elif res == "3":
+                print(f"{op} FAIL, INVALID BATCH")
+                return client.RC.USER_ERROR
+            elif res == "4":
+                print(f"{op} FAIL")
+                return client.RC.USER_ERROR
+
+        except Exception as e:
+            print(f"Error durante la operación {op}: {e}")
+            print(f"{op} FAIL")
+            return client.RC.USER_ERROR
+        finally:
+            # Cerrar la conexión
+            sock.close()
+        return client.RC.ERROR
+
+    @staticmethod
+    def publishbatch(listFile):
+        """Método para publicar de una vez los contenidos de un fichero de lista: una línea por
+        contenido con el nombre del fichero y su descripción"""
+        items = []
+        try:
+            with open(listFile) as f:
+                for line in f:
+                    words = line.strip().split(" ", 1)
+                    if words[0]:
+                        items.append((words[0], words[1] if len(words) > 1 else ""))
+        except OSError as e:
+            print(f"PUBLISH_BATCH FAIL: {e}")
+            return client.RC.USER_ERROR
+        # Validar la longitud de los campos
+        for fileName, description in items:
+            if len(fileName.encode()) > 256 or len(description.encode()) > 256:
+                print(f"PUBLISH_BATCH FAIL: {fileName} excede los 256 bytes de longitud máxima.")
+                return client.RC.USER_ERROR
+        if not items:
+            print("PUBLISH_BATCH FAIL: La lista está vacía.")
+            return client.RC.USER_ERROR
+        return client.batch("PUBLISH_BATCH", items)
+
+    @staticmethod
+    def deletebatch(fileNames):
+        """Método para eliminar de una vez varios contenidos"""
+        for fileName in fileNames:
+            if len(fileName.encode()) > 256:
+                print(f"DELETE_BATCH FAIL: {fileName} excede los 256 bytes de longitud máxima.")
+                return client.RC.USER_ERROR
+        return client.batch("DELETE_BATCH", fileNames)
+
+    @staticmethod
+    def stats(format="TEXT"):
+        """Método para obtener las métricas del servidor, en texto o en formato de Prometheus"""
+        # Conectarse al servidor
+        sock = client.connectServer(client._server, client._port)
+        if sock is None:
+            print("STATS FAIL")
+            return client.RC.USER_ERROR
+
+        try:
+            # Enviar la operación, el dateTime, el usuario (no se comprueba) y el formato
+            sock.sendall("STATS".encode() + b'\0')
+            sock.sendall(str(client.dateTimeService()).encode() + b'\0')
+            sock.sendall(str(client._userName or "").encode() + b'\0')
+            sock.sendall(str(format).upper().encode() + b'\0')
+            # Recibir el resultado de la operación
+            res = client.recvRes(sock)
+
+            if res == "0":
+                print("STATS OK")
+                # Recibir el número de líneas del informe y mostrarlas
+                lines = int(client.recvRes(sock))
+                for _ in range(lines):
+                    print(client.recvRes(sock))
+                return client.RC.OK
+            else:
+                print("STATS FAIL")
+                return client.RC.USER_ERROR
+
+        except Exception as e:
+            print(f"Error durante la operación STATS: {e}")
+            print("STATS FAIL")
+            return client.RC.USER_ERROR
+        finally:
+            # Cerrar la conexión
+            sock.close()
+
     @staticmethod
     def listusers():
         """Método para conocer todos los usuarios conectados en el sistema"""
@@ -609,74 +1061,622 @@ class client:
             sock.close()
         return client.RC.ERROR
 
+    @staticmethod
+    def searchPublishers(query):
+        """Método para enviar SEARCH; devuelve el resultado y la lista de (usuario, ip, puerto, fichero)"""
+        # Conectarse al servidor
+        sock = client.connectServer(client._server, client._port)
+        if sock is None:
+            return None, []
+
+        try:
+            # Enviar cadena con la operación
+            sock.sendall("SEARCH".encode() + b'\0')
+            # Enviar el dateTime
+            sock.sendall(str(client.dateTimeService()).encode() + b'\0')
+            # Enviar el nombre de usuario que realiza la operación
+            if client._userName is None:
+                # Arreglo para recibir el error USER NOT CONNECTED
+                if client._lastConnectedUser is None:
+                    # Si todavía nadie se ha conectado, enviar el último registrado
+                    sock.sendall(str(client._lastRegisteredUser).encode() + b'\0')
+                else:
+                    # Si no hay cliente conectado, enviar el último conectado
+                    sock.sendall(str(client._lastConnectedUser).encode() + b'\0')
+            else:
+                # Si hay un cliente conectado, enviar su userName
+                sock.sendall(str(client._userName).encode() + b'\0')
+            # Enviar el nombre del fichero o las palabras a buscar
+            sock.sendall(str(query).encode() + b'\0')
+            # Recibir el resultado de la operación
+            res = client.recvRes(sock)
+            found = []
+            if res == "0":
+                # Recibir el número de ficheros encontrados y el usuario que publica cada uno
+                num_files = int(client.recvRes(sock))
+                for _ in range(num_files):
+                    username = client.recvRes(sock)
+                    ip = client.recvRes(sock)
+                    port = client.recvRes(sock)
+                    file_name = client.recvRes(sock)
+                    found.append((username, ip, int(port), file_name))
+                    client._users[username] = (ip, int(port))
+            return res, found
+        finally:
+            # Cerrar la conexión
+            sock.close()
+
+    @staticmethod
+    def search(query):
+        """Método para buscar qué usuarios conectados publican un fichero (por nombre o palabras). """
+        try:
+            res, found = client.searchPublishers(query)
+        except Exception as e:
+            print(f"Error durante la operación SEARCH: {e}")
+            print("SEARCH FAIL")
+            return client.RC.USER_ERROR
+
+        # Tratar el resultado de la operación
+        if res is None:
+            print("SEARCH FAIL")
+            return client.RC.USER_ERROR
+        elif res == "0":
+            print("SEARCH OK")
+            print(f"Número de ficheros encontrados: {len(found)}")
+            # Mostrar el usuario que publica cada fichero
+            for username, ip, port, file_name in found:
+                print(f"{username} {ip} {port} {file_name}")
+            return client.RC.OK
+        elif res == "1":
+            print("SEARCH FAIL, USER DOES NOT EXIST")
+            return client.RC.ERROR
+        elif res == "2":
+            print("SEARCH FAIL, USER NOT CONNECTED")
+            return client.RC.USER_ERROR
+        elif res == "3":
+            print("SEARCH FAIL")
+            return client.RC.USER_ERROR
+        return client.RC.ERROR
+
+    @staticmethod
+    def searchDigest(digest):
+        """Método para enviar SEARCH_DIGEST; devuelve el resultado, el resumen del fichero
+        (tamaño, tamaño de trozo y resumen de cada trozo) y la lista de (usuario, ip, puerto, fichero)"""
+        # Conectarse al servidor
+        sock = client.connectServer(client._server, client._port)
+        if sock is None:
+            return None, None, []
+
+        try:
+            # Enviar cadena con la operación
+            sock.sendall("SEARCH_DIGEST".encode() + b'\0')
+            # Enviar el dateTime
+            sock.sendall(str(client.dateTimeService()).encode() + b'\0')
+            # Enviar el nombre de usuario que realiza la operación
+            if client._userName is None:
+                # Arreglo para recibir el error USER NOT CONNECTED
+                if client._lastConnectedUser is None:
+                    # Si todavía nadie se ha conectado, enviar el último registrado
+                    sock.sendall(str(client._lastRegisteredUser).encode() + b'\0')
+                else:
+                    # Si no hay cliente conectado, enviar el último conectado
+                    sock.sendall(str(client._lastConnectedUser).encode() + b'\0')
+            else:
+                # Si hay un cliente conectado, enviar su userName
+                sock.sendall(str(client._userName).encode() + b'\0')
+            # Enviar el SHA-256 del fichero
+            sock.sendall(str(digest).encode() + b'\0')
+            # Recibir el resultado de la operación
+            res = client.recvRes(sock)
+            manifest = None
+            found = []
+            if res == "0":
+                # Recibir el tamaño del fichero, el tamaño de trozo y el resumen de cada trozo
+                size = int(client.recvRes(sock))
+                chunkSize = int(client.recvRes(sock))
+                chunks = tuple(client.recvRes(sock) for _ in range(int(client.recvRes(sock))))
+                manifest = (size, chunkSize, chunks)
+                # Recibir el número de usuarios que lo publican y sus datos
+                for _ in range(int(client.recvRes(sock))):
+                    username = client.recvRes(sock)
+                    ip = client.recvRes(sock)
+                    port = int(client.recvRes(sock))
+                    file_name = client.recvRes(sock)
+                    found.append((username, ip, port, file_name))
+                    client._users[username] = (ip, port)
+            return res, manifest, found
+        finally:
+            # Cerrar la conexión
+            sock.close()
+
+    @staticmethod
+    def searchdigest(digest):
+        """Método para buscar qué usuarios conectados publican un fichero por su SHA-256, con cualquier nombre"""
+        try:
+            res, manifest, found = client.searchDigest(digest)
+        except Exception as e:
+            print(f"Error durante la operación SEARCH_DIGEST: {e}")
+            print("SEARCH_DIGEST FAIL")
+            return client.RC.USER_ERROR
+
+        # Tratar el resultado de la operación
+        if res is None:
+            print("SEARCH_DIGEST FAIL")
+            return client.RC.USER_ERROR
+        elif res == "0":
+            size, chunkSize, chunks = manifest
+            print("SEARCH_DIGEST OK")
+            print(f"Tamaño: {size} bytes en {len(chunks)} trozos de {chunkSize} bytes")
+            print(f"Número de ficheros encontrados: {len(found)}")
+            # Mostrar el usuario que publica cada fichero
+            for username, ip, port, file_name in found:
+                print(f"{username} {ip} {port} {file_name}")
+            return client.RC.OK
+        elif res == "1":
+            print("SEARCH_DIGEST FAIL, USER DOES NOT EXIST")
+            return client.RC.ERROR
+        elif res == "2":
+            print("SEARCH_DIGEST FAIL, USER NOT CONNECTED")
+            return client.RC.USER_ERROR
+        elif res == "3":
+            print("SEARCH_DIGEST FAIL, CONTENT NOT FOUND")
+            return client.RC.USER_ERROR
+        print("SEARCH_DIGEST FAIL")
+        return client.RC.ERROR
+
+    @staticmethod
+    def searchname(mode, pattern, offset=0, limit=0):
+        """Método para buscar ficheros cuyo nombre empieza por (PREFIX) o contiene (SUBSTRING) un patrón. """
+        # Conectarse al servidor
+        sock = client.connectServer(client._server, client._port)
+        if sock is None:
+            print("SEARCH_NAME FAIL")
+            return client.RC.USER_ERROR
+
+        try:
+            # Enviar cadena con la operación
+            sock.sendall("SEARCH_NAME".encode() + b'\0')
+            # Enviar el dateTime
+            sock.sendall(str(client.dateTimeService()).encode() + b'\0')
+            # Enviar el nombre de usuario que realiza la operación
+            if client._userName is None:
+                # Arreglo para recibir el error USER NOT CONNECTED
+                if client._lastConnectedUser is None:
+                    # Si todavía nadie se ha conectado, enviar el último registrado
+                    sock.sendall(str(client._lastRegisteredUser).encode() + b'\0')
+                else:
+                    # Si no hay cliente conectado, enviar el último conectado
+                    sock.sendall(str(client._lastConnectedUser).encode() + b'\0')
+            else:
+                # Si hay un cliente conectado, enviar su userName
+                sock.sendall(str(client._userName).encode() + b'\0')
+            # Enviar el modo, el patrón y la página de resultados (offset y límite)
+            sock.sendall(str(mode).upper().encode() + b'\0')
+            sock.sendall(str(pattern).encode() + b'\0')
+            sock.sendall(str(offset).encode() + b'\0')
+            sock.sendall(str(limit).encode() + b'\0')
+            # Recibir el resultado de la operación
+            res = client.recvRes(sock)
+
+            # Tratar el resultado de la operación
+            if res == "0":
+                print("SEARCH_NAME OK")
+                # Recibir el total de ficheros encontrados y cuántos van en esta página
+                total = int(client.recvRes(sock))
+                num_files = int(client.recvRes(sock))
+                print(f"Número de ficheros encontrados: {total} (mostrando {num_files} desde {offset})")
+                # Recibir y mostrar el usuario que publica cada fichero
+                for _ in range(num_files):
+                    username = client.recvRes(sock)
+                    ip = client.recvRes(sock)
+                    port = client.recvRes(sock)
+                    file_name = client.recvRes(sock)
+                    print(f"{username} {ip} {port} {file_name}")
+                    client._users[username] = (ip, int(port))
+                return client.RC.OK
+            elif res == "1":
+                print("SEARCH_NAME FAIL, USER DOES NOT EXIST")
+                return client.RC.ERROR
+            elif res == "2":
+                print("SEARCH_NAME FAIL, USER NOT CONNECTED")
+                return client.RC.USER_ERROR
+            elif res == "3":
+                print("SEARCH_NAME FAIL, INVALID MODE")
+                return client.RC.USER_ERROR
+            elif res == "4":
+                print("SEARCH_NAME FAIL")
+                return client.RC.USER_ERROR
+
+        except Exception as e:
+            print(f"Error durante la operación SEARCH_NAME: {e}")
+            print("SEARCH_NAME FAIL")
+            return client.RC.USER_ERROR
+        finally:
+            # Cerrar la conexión
+            sock.close()
+        return client.RC.ERROR
+
+    # Auxiliar para leer el tamaño y el resumen del fichero remoto de una descarga a medias
+    @staticmethod
+    def readPartMeta(meta):
+        try:
+            with open(meta) as f:
+                size, digest = f.read().split()
+                return int(size), digest
+        except (OSError, ValueError):
+            return None
+
+    # Auxiliar para esperar la cabecera de GET_FILE_RANGE o GET_FILE_HASHES. El otro usuario
+    # resume el fichero antes de responder y, si no lo tiene en caché, tarda en proporción a su
+    # tamaño (más de un minuto para 4 GB): se espera sin plazo y es keepalive de TCP quien
+    # detecta que el otro extremo ha desaparecido. Tras la cabecera se vuelve a GET_FILE_TIMEOUT
+    @staticmethod
+    def waitDigest(sock):
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_KEEPALIVE, 1)
+        for name, value in (('TCP_KEEPIDLE', client.KEEPALIVE_IDLE),
+                            ('TCP_KEEPINTVL', client.KEEPALIVE_INTERVAL),
+                            ('TCP_KEEPCNT', client.KEEPALIVE_COUNT)):
+            if hasattr(socket, name):
+                sock.setsockopt(socket.IPPROTO_TCP, getattr(socket, name), value)
+        sock.settimeout(None)
+
+    # Auxiliar para descartar una descarga a medias
+    @staticmethod
+    def discardPart(part, meta):
+        for name in (part, meta):
+            if os.path.exists(name):
+                os.remove(name)
+
+    @staticmethod
+    def getfileLegacy(remote_ip, remote_port, remote_FileName, local_FileName):
+        """Método para descargar un fichero con GET_FILE, para los clientes que no tienen
+        GET_FILE_RANGE: el fichero llega hasta que el otro usuario cierra la conexión, sin tamaño
+        ni resumen con que comprobarlo, y no se puede reanudar."""
+        part = local_FileName + '.part'
+        try:
+            with socket.create_connection((remote_ip, remote_port), timeout=client.GET_FILE_TIMEOUT) as sock:
+                # Operación y fichero. El hilo de escucha de esos clientes lee la petición con un
+                # solo recv y responde sin esperar al dateTime, que no sabe separar del fichero;
+                # los demás (./peer, este cliente) esperan al dateTime para responder
+                sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+                sock.sendall(b'GET_FILE \0' + str(remote_FileName).encode() + b'\0')
+                ready, _, _ = select.select([sock], [], [], client.GET_FILE_LEGACY_WAIT)
+                if not ready:
+                    sock.sendall(str(client.dateTimeService()).encode() + b'\0')
+                res = client.recvRes(sock)
+                if res == "1":
+                    print("GET_FILE FAIL / FILE NOT EXIST")
+                    return client.RC.ERROR
+                elif res != "0":
+                    print("GET_FILE FAIL")
+                    return client.RC.USER_ERROR
+                # Lo descargado antes con GET_FILE_RANGE no sirve: no se puede comprobar
+                client.discardPart(part, part + '.meta')
+                with open(part, 'wb') as f:
+                    buf = bytearray(client.GET_FILE_BLOCK)
+                    view = memoryview(buf)
+                    while True:
+                        n = sock.recv_into(buf)
+                        if n == 0:
+                            break
+                        f.write(view[:n])
+            os.replace(part, local_FileName)
+        except (OSError, ValueError) as e:
+            client.discardPart(part, part + '.meta')
+            print(f"Error durante la operación GET_FILE: {e}")
+            print("GET_FILE FAIL")
+            return client.RC.USER_ERROR
+        print("GET_FILE OK")
+        return client.RC.OK
+
     @staticmethod
     def getfile(user,  remote_FileName,  local_FileName):
-        """Método para enviar mensajes a otros usuarios registrados para descargar el contenido de un fichero. """
+        """Método para descargar un fichero de otro usuario registrado. Los datos van directamente a
+        <local>.part; si la conexión se corta, se reanuda desde lo ya recibido y al terminar se
+        comprueba el fichero con el SHA-256 que envía el otro usuario. Si el otro usuario no
+        conoce GET_FILE_RANGE, se descarga con GET_FILE (getfileLegacy)."""
 
         if user not in client._users:
             print("GET_FILE FAIL / USER NOT FOUND")
             return client.RC.USER_ERROR
 
         # Obtener la dirección IP y el puerto del usuario remoto
-        # print(client._users)
         remote_ip, remote_port = client._users[user]
-        # Utilizar un bloque with para asegurar que el socket se cierra correctamente
-        with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as sock:
+        part = local_FileName + '.part'
+        meta = part + '.meta'       # tamaño y resumen del fichero al que corresponde .part
+        retries = 0
+        while True:
+            # Reanudar desde lo ya descargado si corresponde al mismo fichero
+            known = client.readPartMeta(meta)
+            offset = os.path.getsize(part) if known is not None and os.path.exists(part) else 0
+            digest = hashlib.sha256()
             try:
-                sock.connect((remote_ip, remote_port))
-            except Exception as e:
-                print(f"GET_FILE FAIL: No se pudo conectar con {user}: {e}")
+                with socket.create_connection((remote_ip, remote_port), timeout=client.GET_FILE_TIMEOUT) as sock:
+                    # Operación, fichero, dateTime, offset y longitud (0: hasta el final)
+                    sock.sendall(b'GET_FILE_RANGE\0' + str(remote_FileName).encode() + b'\0' +
+                                 str(client.dateTimeService()).encode() + b'\0' + str(offset).encode() + b'\0' + b'0\0')
+                    client.waitDigest(sock)
+                    res = client.recvRes(sock)
+                    if res == "3" and offset > 0:
+                        # Lo descargado es más largo que el fichero: empezar de nuevo
+                        client.discardPart(part, meta)
+                        continue
+                    elif res in ("1", "2"):
+                        # Un cliente anterior a GET_FILE_RANGE no conoce la operación: su hilo de
+                        # escucha responde 2, o 1 si al separar la petición no encuentra el fichero.
+                        # Si el fichero no existe, GET_FILE también lo dirá
+                        return client.getfileLegacy(remote_ip, remote_port, remote_FileName, local_FileName)
+                    elif res != "0":
+                        print("GET_FILE FAIL")
+                        return client.RC.USER_ERROR
+                    size = int(client.recvRes(sock))
+                    expected = client.recvRes(sock)
+                    sock.settimeout(client.GET_FILE_TIMEOUT)
+                    if offset > 0 and known != (size, expected):
+                        # El fichero remoto ha cambiado: lo descargado no sirve
+                        client.discardPart(part, meta)
+                        continue
+                    with open(meta, 'w') as f:
+                        f.write(f"{size} {expected}\n")
+
+                    with open(part, 'ab' if offset > 0 else 'wb') as f:
+                        # Resumir lo que ya había y seguir con lo que llega
+                        if offset > 0:
+                            with open(part, 'rb') as old:
+                                for block in iter(lambda: old.read(client.GET_FILE_BLOCK), b''):
+                                    digest.update(block)
+                        buf = bytearray(client.GET_FILE_BLOCK)
+                        view = memoryview(buf)
+                        while offset < size:
+                            n = sock.recv_into(buf)
+                            if n == 0:
+                                break
+                            f.write(view[:n])
+                            digest.update(view[:n])
+                            offset += n
+                if offset < size:
+                    raise ConnectionError(f"conexión cerrada tras {offset} de {size} bytes")
+            except (OSError, ValueError) as e:
+                retries += 1
+                if retries > client.GET_FILE_RETRIES:
+                    print(f"Error durante la operación GET_FILE: {e}")
+                    print("GET_FILE FAIL")
+                    return client.RC.USER_ERROR
+                print(f"GET_FILE: descarga interrumpida ({e}), reanudando")
+                continue
+
+            # Comprobar el fichero completo antes de darle su nombre
+            if digest.hexdigest() != expected:
+                client.discardPart(part, meta)
+                print("GET_FILE FAIL / CHECKSUM MISMATCH")
                 return client.RC.USER_ERROR
+            os.replace(part, local_FileName)
+            os.remove(meta)
+            print("GET_FILE OK")
+            return client.RC.OK
+
+    # Par del que se descargan trozos en GET_FILE_SWARM
+    class SwarmSource:
+        def __init__(self, user, ip, port, fileName):
+            self.user = user
+            self.ip = ip
+            self.port = port
+            self.fileName = fileName    # nombre con el que lo publica (puede no ser el buscado)
+            self.rate = None        # bytes/s observados (media móvil), None hasta el primer trozo
+            self.failures = 0
+            self.received = 0       # bytes de trozos válidos
 
+    # Auxiliar para pedir a un par el tamaño y los resúmenes de un fichero (GET_FILE_HASHES)
+    @staticmethod
+    def fetchHashes(source, fileName, dateTime):
+        # Si el par no tiene los resúmenes en caché, los calcula antes de responder (waitDigest)
+        with socket.create_connection((source.ip, source.port), timeout=client.GET_FILE_TIMEOUT) as sock:
+            sock.sendall(b'GET_FILE_HASHES\0' + fileName.encode() + b'\0' + dateTime.encode() + b'\0')
+            client.waitDigest(sock)
+            # El par cierra la conexión tras la respuesta
+            data = bytearray()
+            while True:
+                block = sock.recv(65536)
+                if not block:
+                    break
+                data += block
+                sock.settimeout(client.GET_FILE_TIMEOUT)
+        fields = data.decode().split('\0')
+        if fields[0] != "0":
+            return None
+        count = int(fields[4])
+        return int(fields[1]), fields[2], int(fields[3]), tuple(fields[5:5 + count])
+
+    # Auxiliar para descargar un trozo de un par; devuelve sus datos o None si otro par lo ha
+    # descargado antes
+    @staticmethod
+    def fetchChunk(source, dateTime, offset, length, size, digest, isDone):
+        with socket.create_connection((source.ip, source.port), timeout=client.GET_FILE_TIMEOUT) as sock:
+            sock.sendall(b'GET_FILE_RANGE\0' + source.fileName.encode() + b'\0' + dateTime.encode() + b'\0' +
+                         str(offset).encode() + b'\0' + str(length).encode() + b'\0')
+            client.waitDigest(sock)
+            if client.recvRes(sock) != "0":
+                raise ValueError("el par no sirve el fichero")
+            if int(client.recvRes(sock)) != size or client.recvRes(sock) != digest:
+                raise ValueError("el par tiene otra versión del fichero")
+            sock.settimeout(client.GET_FILE_TIMEOUT)
+            buf = bytearray(length)
+            view = memoryview(buf)
+            pos = 0
+            while pos < length:
+                n = sock.recv_into(view[pos:])
+                if n == 0:
+                    raise ConnectionError(f"conexión cerrada tras {pos} de {length} bytes")
+                pos += n
+                if isDone():
+                    return None
+            return buf
+
+    @staticmethod
+    def swarmget(remote_FileName, local_FileName):
+        """Método para descargar un fichero a la vez de todos los usuarios conectados que lo publican.
+        El fichero se pide por trozos de CHUNK_SIZE bytes; cada par atiende los trozos que va
+        pidiendo, así que los más rápidos se llevan más, y al final los trozos que aún tiene un
+        par lento se piden también a uno que los traerá antes. Cada trozo se comprueba con su
+        SHA-256 al llegar y el fichero completo al terminar."""
+        try:
+            res, found = client.searchPublishers(remote_FileName)
+        except Exception as e:
+            print(f"Error durante la operación GET_FILE_SWARM: {e}")
+            res, found = None, []
+        sources = [client.SwarmSource(user, ip, port, name) for user, ip, port, name in found
+                   if name == remote_FileName and user != client._userName]
+        candidates = {source.user for source in sources}
+        if res != "0" or not sources:
+            print("GET_FILE_SWARM FAIL / NO SOURCES")
+            return client.RC.ERROR
+        dateTime = str(client.dateTimeService())
+
+        # Pedir los resúmenes a todos los pares y quedarse con la versión que más publican
+        versions = {}
+        lock = threading.Lock()
+        def probe(source):
             try:
-                print(os.path.exists(remote_FileName))
-                # Enviar cadena con la operación
-                sock.sendall("GET_FILE ".encode() + b'\0')
-                # Enviar el nombre del fichero que se desea descargar
-                sock.sendall(str(remote_FileName).encode() + b'\0')
-                # Enviar el dateTime
-                sock.sendall(str(client.dateTimeService()).encode() + b'\0')
-                # Agregar timeout para evitar bloqueos indefinidos
-                sock.settimeout(10)
-                # Recibir el resultado de la operación de otro cliente
-                res = client.recvRes(sock)
+                manifest = client.fetchHashes(source, source.fileName, dateTime)
+            except (OSError, ValueError, IndexError):
+                return
+            if manifest is not None:
+                with lock:
+                    versions.setdefault(manifest, []).append(source)
+        probes = [threading.Thread(target=probe, args=(source,)) for source in sources]
+        for t in probes:
+            t.start()
+        for t in probes:
+            t.join()
+        if not versions:
+            print("GET_FILE_SWARM FAIL / FILE NOT EXIST")
+            return client.RC.ERROR
+        (size, digest, chunkSize, chunkHashes), sources = max(versions.items(), key=lambda v: len(v[1]))
 
-                # Tratar el resultado de la operación
-                if res == "0":
-                    # Recibir datos del archivo
-                    file_data = []
-                    while True:
-                        try:
-                            data = sock.recv(1024)
-                            if not data:
-                                break  # Terminar la recepción si no hay más datos
-                            file_data.append(data.decode())
-                        except socket.timeout:
-                            print("Timeout durante la recepción de datos.")
-                            return client.RC.USER_ERROR
-
-                    # Guardar el archivo como 'local_file'
-                    with open(local_FileName, 'w') as file:
-                        file.writelines(file_data)
-                    print("GET_FILE OK")
-                    return client.RC.OK
-                elif res == "1":
-                    print("GET_FILE FAIL / FILE NOT EXIST")
-                    return client.RC.ERROR
-                elif res == "2":
-                    print("GET_FILE FAIL")
-                    return client.RC.USER_ERROR
-            except socket.error as e:
-                print(f"Socket error: {e}")
-                return client.RC.USER_ERROR
-            except Exception as e:
-                print(f"Error durante la operación GET_FILE: {e}")
-                print("GET_FILE FAIL")
+        # Añadir a quienes publican el mismo fichero con otro nombre, si el servidor conoce su
+        # resumen con los mismos trozos
+        try:
+            res, manifest, publishers = client.searchDigest(digest)
+        except Exception:
+            res = None
+        if res == "0" and manifest == (size, chunkSize, chunkHashes):
+            sources += [client.SwarmSource(user, ip, port, name) for user, ip, port, name in publishers
+                        if user not in candidates and user != client._userName]
+
+        # Reutilizar los trozos válidos de una descarga anterior del mismo fichero
+        part = local_FileName + '.part'
+        meta = part + '.meta'
+        if client.readPartMeta(meta) != (size, digest):
+            client.discardPart(part, meta)
+        with open(meta, 'w') as f:
+            f.write(f"{size} {digest}\n")
+        fd = os.open(part, os.O_RDWR | os.O_CREAT, 0o644)
+        try:
+            os.ftruncate(fd, size)
+            chunks = range(len(chunkHashes))
+            def chunkLength(i):
+                return min(chunkSize, size - i * chunkSize)
+            def alreadyValid(i):
+                return hashlib.sha256(os.pread(fd, chunkLength(i), i * chunkSize)).hexdigest() == chunkHashes[i]
+            with concurrent.futures.ThreadPoolExecutor() as pool:
+                valid = list(pool.map(alreadyValid, chunks))
+            todo = collections.deque(i for i in chunks if not valid[i])
+            done = set(i for i in chunks if valid[i])
+            inflight = {}           # trozo -> [(par, instante de inicio)]
+            cond = threading.Condition()
+            start = time.monotonic()
+
+            def pickChunk(source):
+                """Elegir el siguiente trozo para un par (con cond adquirido); None si no queda nada"""
+                while True:
+                    if todo:
+                        return todo.popleft()
+                    # Fase final: repetir el trozo en curso que este par traería antes que su dueño
+                    now = time.monotonic()
+                    best, bestGain = None, 0
+                    for i, owners in inflight.items():
+                        if len(owners) > 1 or source.rate is None:
+                            continue
+                        owner, started = owners[0]
+                        if owner.rate is None:
+                            continue
+                        left = chunkLength(i) / owner.rate - (now - started)
+                        gain = left - chunkLength(i) / source.rate
+                        if gain > bestGain:
+                            best, bestGain = i, gain
+                    if best is not None:
+                        return best
+                    if not inflight:
+                        return None
+                    cond.wait(0.2)
+
+            def worker(source):
+                while source.failures < client.SWARM_FAILURES:
+                    with cond:
+                        if len(done) == len(chunkHashes):
+                            return
+                        i = pickChunk(source)
+                        if i is None:
+                            return
+                        inflight.setdefault(i, []).append((source, time.monotonic()))
+                    began = time.monotonic()
+                    try:
+                        data = client.fetchChunk(source, dateTime, i * chunkSize, chunkLength(i),
+                                                 size, digest, lambda: i in done)
+                        if data is not None and hashlib.sha256(data).hexdigest() != chunkHashes[i]:
+                            raise ValueError(f"el trozo {i} no coincide con su resumen")
+                        if data is not None:
+                            os.pwrite(fd, data, i * chunkSize)
+                    except (OSError, ValueError) as e:
+                        print(f"GET_FILE_SWARM: fallo de {source.user} ({e})")
+                        data = None
+                        failed = True
+                    else:
+                        failed = False
+                    with cond:
+                        if failed:
+                            source.failures += 1
+                        owners = inflight.get(i, [])
+                        owners[:] = [o for o in owners if o[0] is not source]
+                        if not owners:
+                            inflight.pop(i, None)
+                        if data is not None and i not in done:
+                            done.add(i)
+                            source.received += len(data)
+                            rate = len(data) / max(time.monotonic() - began, 1e-6)
+                            source.rate = rate if source.rate is None else 0.7 * source.rate + 0.3 * rate
+                        elif i not in done and i not in inflight:
+                            todo.appendleft(i)      # devolverlo para otro par
+                        cond.notify_all()
+
+            workers = [threading.Thread(target=worker, args=(source,))
+                       for source in sources for _ in range(client.SWARM_STREAMS)]
+            for t in workers:
+                t.start()
+            for t in workers:
+                t.join()
+            elapsed = time.monotonic() - start
+            if len(done) < len(chunkHashes):
+                print(f"GET_FILE_SWARM FAIL / {len(chunkHashes) - len(done)} CHUNKS MISSING")
                 return client.RC.USER_ERROR
-            finally:
-                # Cerrar la conexión
-                sock.close()
-            return client.RC.ERROR
+
+            # Comprobar el fichero completo antes de darle su nombre
+            whole = hashlib.sha256()
+            for offset in range(0, size, client.GET_FILE_BLOCK):
+                whole.update(os.pread(fd, client.GET_FILE_BLOCK, offset))
+        finally:
+            os.close(fd)
+        if whole.hexdigest() != digest:
+            client.discardPart(part, meta)
+            print("GET_FILE_SWARM FAIL / CHECKSUM MISMATCH")
+            return client.RC.USER_ERROR
+        os.replace(part, local_FileName)
+        os.remove(meta)
+        for source in sources:
+            print(f"{source.user}: {source.received} bytes")
+        print(f"GET_FILE_SWARM OK ({len(sources)} sources, {size / max(elapsed, 1e-6) / 1e6:.1f} MB/s)")
+        return client.RC.OK
+
     # *
     # **
     # * @brief Command interpreter for the client. It calls the protocol functions.
@@ -717,12 +1717,31 @@ class client:
                         else:
                             print("Syntax error. Usage: PUBLISH <fileName> <description>")
 
+                    elif(line[0]=="PUBLISH_HASHED"):
+                        if (len(line) >= 3):
+                            description = ' '.join(line[2:])
+                            client.publish(line[1], description, hashed=True)
+                        else:
+                            print("Syntax error. Usage: PUBLISH_HASHED <fileName> <description>")
+
                     elif(line[0]=="DELETE"):
                         if (len(line) == 2):
                             client.delete(line[1])
                         else:
                             print("Syntax error. Usage: DELETE <fileName>")
 
+                    elif(line[0]=="PUBLISH_BATCH"):
+                        if (len(line) == 2):
+                            client.publishbatch(line[1])
+                        else:
+                            print("Syntax error. Usage: PUBLISH_BATCH <listFile>")
+
+                    elif(line[0]=="DELETE_BATCH"):
+                        if (len(line) >= 2):
+                            client.deletebatch(line[1:])
+                        else:
+                            print("Syntax error. Usage: DELETE_BATCH <fileName> [<fileName> ...]")
+
                     elif(line[0]=="LIST_USERS"):
                         if (len(line) == 1):
                             client.listusers()
@@ -735,6 +1754,30 @@ class client:
                         else:
                             print("Syntax error. Usage: LIST_CONTENT <userName>")
 
+                    elif(line[0]=="SEARCH"):
+                        if (len(line) >= 2):
+                            client.search(' '.join(line[1:]))
+                        else:
+                            print("Syntax error. Usage: SEARCH <fileName | words>")
+
+                    elif(line[0]=="SEARCH_DIGEST"):
+                        if (len(line) == 2):
+                            client.searchdigest(line[1])
+                        else:
+                            print("Syntax error. Usage: SEARCH_DIGEST <sha256>")
+
+                    elif(line[0]=="SEARCH_NAME"):
+                        if (3 <= len(line) <= 5):
+                            client.searchname(*line[1:])
+                        else:
+                            print("Syntax error. Usage: SEARCH_NAME <PREFIX | SUBSTRING> <pattern> [offset] [limit]")
+
+                    elif(line[0]=="STATS"):
+                        if (len(line) <= 2):
+                            client.stats(*line[1:])
+                        else:
+                            print("Syntax error. Usage: STATS [TEXT | PROMETHEUS]")
+
                     elif(line[0]=="DISCONNECT"):
                         if (len(line) == 2):
                             client.disconnect(line[1])
@@ -747,11 +1790,20 @@ class client:
                         else:
                             print("Syntax error. Usage: GET_FILE <userName> <remote_fileName> <local_fileName>")
 
+                    elif(line[0]=="GET_FILE_SWARM"):
+                        if (len(line) == 3):
+                            client.swarmget(line[1], line[2])
+                        else:
+                            print("Syntax error. Usage: GET_FILE_SWARM <remote_fileName> <local_fileName>")
+
                     elif(line[0]=="QUIT"):
                         if (len(line) == 1):
                             # Desconectar al cliente del sistema si está conectado
                             if client._userName is not None:
                                 client.disconnect(client._userName)
+                            # Cerrar la sesión con el servidor si se abrió
+                            if client._session is not None:
+                                client._session.shutdown()
                             break
                         else:
                             print("Syntax error. Use: QUIT")
@@ -760,12 +1812,36 @@ class client:
             except Exception as e:
                 print("Exception: " + str(e))
 
+    @staticmethod
+    def dateTimeClient():
+        # El WSDL se descarga y se analiza una sola vez; la sesión HTTP mantiene la conexión abierta
+        if client._dateTimeClient is None:
+            transport = Transport(timeout=client.DATETIME_TIMEOUT, operation_timeout=client.DATETIME_TIMEOUT)
+            client._dateTimeClient = ZeepClient(client.DATETIME_URL, transport=transport)
+        return client._dateTimeClient
+
     @staticmethod
     def dateTimeService():
-        # URL del servicio web que devuelve la fecha y hora
-        datetime_service_url = 'http://localhost:8000/?wsdl'
-        datetime_client = ZeepClient(datetime_service_url)
-        current_datetime = datetime_client.service.get_current_datetime()
+        with client._dateTimeLock:
+            now = time.monotonic()
+            base = client._dateTimeBase
+            age = now - base[1] if base is not None else None
+            # Con -t, la fecha se calcula con el reloj monotónico a partir de la última del servicio
+            # web mientras no haya pasado el máximo, que acota lo que puede desviarse. Si el servicio
+            # no responde, se sigue usando hasta el doble del máximo
+            if age is None or age >= client._dateTimeMaxAge:
+                try:
+                    current_datetime = client.dateTimeClient().service.get_current_datetime()
+                    if client._dateTimeMaxAge > 0:
+                        client._dateTimeBase = (datetime.datetime.strptime(current_datetime, client.DATETIME_FORMAT), now)
+                    age = None
+                except Exception:
+                    # Conexión perdida: se vuelve a crear el cliente en la siguiente llamada
+                    client._dateTimeClient = None
+                    if age is None or age >= 2 * client._dateTimeMaxAge:
+                        raise
+            if age is not None:
+                current_datetime = (base[0] + datetime.timedelta(seconds=age)).strftime(client.DATETIME_FORMAT)
         print(current_datetime)
         return current_datetime
 
@@ -774,7 +1850,7 @@ class client:
 
     @staticmethod
     def usage():
-        print("Usage: python3 client.py -s <server> -p <port>")
+        print("Usage: python3 client.py -s <server> -p <port> [-k] [-b] [-P <peer_port>] [-t <seconds>]")
 
     # *
     # * @brief Parses program execution arguments
@@ -783,6 +1859,11 @@ class client:
         parser = argparse.ArgumentParser()
         parser.add_argument('-s', type=str, required=True, help='Server IP')
         parser.add_argument('-p', type=int, required=True, help='Server Port')
+        parser.add_argument('-k', action='store_true', help='Keep one session open with the server')
+        parser.add_argument('-b', action='store_true', help='Use the binary protocol (v2), implies -k')
+        parser.add_argument('-P', type=int, help='Serve GET_FILE with a native peer already listening on this port')
+        parser.add_argument('-t', type=float, default=0,
+                            help='Seconds the local clock may stand in for the timestamp service (default 0: always ask)')
         args = parser.parse_args()
 
         if (args.s is None):
@@ -792,9 +1873,19 @@ class client:
         if ((args.p < 1024) or (args.p > 65535)):
             parser.error("Error: Port must be in the range 1024 <= port <= 65535")
             return False
+        if args.P is not None and ((args.P < 1024) or (args.P > 65535)):
+            parser.error("Error: Port must be in the range 1024 <= port <= 65535")
+            return False
+        if args.t < 0:
+            parser.error("Error: -t must be 0 or more seconds")
+            return False
         
         client._server = args.s
         client._port = args.p
+        client._useSession = args.k or args.b
+        client._useBinary = args.b
+        client._peerPort = args.P
+        client._dateTimeMaxAge = args.t
 
         return True
 
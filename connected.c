@@ -0,0 +1,289 @@
+// connected.c
+// Conjunto de usuarios conectados para LIST_USERS, publicado como versiones inmutables.
+// Los escritores (CONNECT, DISCONNECT, UNREGISTER) construyen una versión nueva copiando la
+// anterior y la publican con un intercambio atómico del puntero. Los lectores no bloquean
+// ningún mutex: anuncian la época en la que empiezan a leer y una versión sustituida solo se
+// libera cuando ningún lector que pudiera verla sigue activo (reclamación por épocas).
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "connected.h"
+#include "lines.h"
+#include "protocol.h"
+#include "registry.h"
+
+static _Atomic(ConnectedSet*) current = NULL;
+static atomic_ullong epoch = 1;
+static atomic_ullong readerEpoch[CONNECTED_MAX_READERS];    // 0 si el lector no está leyendo
+static atomic_int readersCount = 0;
+static __thread int readerSlot = -1;    // -1 sin asignar, -2 sin hueco libre (lee con mutex)
+
+// Serializa a los escritores y protege la lista de versiones sustituidas
+static pthread_mutex_t writerMutex = PTHREAD_MUTEX_INITIALIZER;
+static ConnectedSet* retired = NULL;
+
+/** Función para reservar una versión con capacidad para count usuarios */
+static ConnectedSet* set_alloc(int count) {
+    ConnectedSet* set = calloc(1, sizeof(ConnectedSet));
+    if (!set) {
+        perror("Error al asignar memoria para la lista de conectados");
+        return NULL;
+    }
+    set->users = malloc(sizeof(ConnectedUser*) * (count > 0 ? count : 1));
+    if (!set->users) {
+        perror("Error al asignar memoria para la lista de conectados");
+        free(set);
+        return NULL;
+    }
+    set->count = count;
+    return set;
+}
+
+/** Función para liberar una versión sustituida y el usuario que salió con ella */
+static void set_free(ConnectedSet* set) {
+    free(atomic_load(&set->payload[0]));
+    free(atomic_load(&set->payload[1]));
+    free(set->removed);
+    free(set->users);
+    free(set);
+}
+
+/** Función para liberar las versiones sustituidas que ya no puede estar leyendo nadie */
+static void reclaim(void) {
+    // Época más antigua anunciada por un lector activo
+    unsigned long long oldest = 0;
+    int readers = atomic_load(&readersCount);
+    for (int i = 0; i < readers && i < CONNECTED_MAX_READERS; i++) {
+        unsigned long long e = atomic_load(&readerEpoch[i]);
+        if (e != 0 && (oldest == 0 || e < oldest)) {
+            oldest = e;
+        }
+    }
+    ConnectedSet** link = &retired;
+    while (*link != NULL) {
+        ConnectedSet* set = *link;
+        // Un lector que anunció una época posterior a la sustitución ya ve la versión nueva
+        if (oldest == 0 || set->retireEpoch < oldest) {
+            *link = set->nextRetired;
+            set_free(set);
+        } else {
+            link = &set->nextRetired;
+        }
+    }
+}
+
+/** Función para publicar una versión nueva (con writerMutex bloqueado) */
+static void publish(ConnectedSet* set, ConnectedUser* removed) {
+    ConnectedSet* old = atomic_load(&current);
+    set->version = old->version + 1;
+    old->removed = removed;
+    atomic_store(&current, set);
+    old->retireEpoch = atomic_fetch_add(&epoch, 1);
+    old->nextRetired = retired;
+    retired = old;
+    reclaim();
+}
+
+/** Función para buscar la posición de un número de registro en una versión */
+static int find_position(const ConnectedSet* set, unsigned long long seq) {
+    int lo = 0, hi = set->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (set->users[mid]->seq < seq) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/** Función para crear un usuario conectado inmutable */
+static ConnectedUser* user_alloc(unsigned long long seq, const char* userName, const char* ip, const char* port) {
+    size_t nameLen = strlen(userName) + 1, ipLen = strlen(ip) + 1, portLen = strlen(port) + 1;
+    ConnectedUser* user = malloc(sizeof(ConnectedUser) + nameLen + ipLen + portLen);
+    if (!user) {
+        perror("Error al asignar memoria para el usuario conectado");
+        return NULL;
+    }
+    user->seq = seq;
+    memcpy(user->userName, userName, nameLen);
+    user->ip = memcpy(user->userName + nameLen, ip, ipLen);
+    user->port = memcpy(user->userName + nameLen + ipLen, port, portLen);
+    return user;
+}
+
+/** Función para crear la primera versión con los usuarios conectados de la tabla */
+// Recibe el primer nodo en orden de registro; se llama antes de arrancar los threads.
+int connected_init(const UserNode* first) {
+    int count = 0;
+    for (const UserNode* node = first; node != NULL; node = node->next) {
+        if (node->user.status == USER_CONNECTED) count++;
+    }
+    ConnectedSet* set = set_alloc(count);
+    if (!set) {
+        return -1;
+    }
+    set->count = 0;
+    for (const UserNode* node = first; node != NULL; node = node->next) {
+        const User* u = &node->user;
+        if (u->status != USER_CONNECTED) continue;
+        char ip[REGISTRY_IP_LEN], port[REGISTRY_PORT_LEN];
+        registry_format_addr(&u->addr, ip, port);
+        ConnectedUser* user = user_alloc(node->seq, u->userName, ip, port);
+        if (!user) {
+            atomic_store(&current, set);
+            connected_destroy();
+            return -1;
+        }
+        set->users[set->count++] = user;
+    }
+    atomic_store(&current, set);
+    return 0;
+}
+
+/** Función para liberar todas las versiones (sin lectores activos) */
+void connected_destroy(void) {
+    pthread_mutex_lock(&writerMutex);
+    while (retired != NULL) {
+        ConnectedSet* next = retired->nextRetired;
+        set_free(retired);
+        retired = next;
+    }
+    ConnectedSet* set = atomic_exchange(&current, NULL);
+    if (set != NULL) {
+        for (int i = 0; i < set->count; i++) {
+            free(set->users[i]);
+        }
+        set_free(set);
+    }
+    pthread_mutex_unlock(&writerMutex);
+}
+
+/** Función para añadir un usuario conectado, en su posición según el orden de registro */
+int connected_add(unsigned long long seq, const char* userName, const char* ip, const char* port) {
+    ConnectedUser* user = user_alloc(seq, userName, ip, port);
+    if (!user) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&writerMutex);
+    ConnectedSet* old = atomic_load(&current);
+    ConnectedSet* set = set_alloc(old->count + 1);
+    if (!set) {
+        pthread_mutex_unlock(&writerMutex);
+        free(user);
+        return -1;
+    }
+    int pos = find_position(old, seq);
+    memcpy(set->users, old->users, sizeof(ConnectedUser*) * pos);
+    set->users[pos] = user;
+    memcpy(set->users + pos + 1, old->users + pos, sizeof(ConnectedUser*) * (old->count - pos));
+    publish(set, NULL);
+    pthread_mutex_unlock(&writerMutex);
+    return 0;
+}
+
+/** Función para quitar un usuario del conjunto de conectados, -1 si no estaba */
+int connected_remove(unsigned long long seq) {
+    pthread_mutex_lock(&writerMutex);
+    ConnectedSet* old = atomic_load(&current);
+    int pos = find_position(old, seq);
+    if (pos == old->count || old->users[pos]->seq != seq) {
+        pthread_mutex_unlock(&writerMutex);
+        return -1;
+    }
+    ConnectedSet* set = set_alloc(old->count - 1);
+    if (!set) {
+        pthread_mutex_unlock(&writerMutex);
+        return -1;
+    }
+    memcpy(set->users, old->users, sizeof(ConnectedUser*) * pos);
+    memcpy(set->users + pos, old->users + pos + 1, sizeof(ConnectedUser*) * (old->count - pos - 1));
+    // El usuario se libera junto con la última versión que lo contiene
+    publish(set, old->users[pos]);
+    pthread_mutex_unlock(&writerMutex);
+    return 0;
+}
+
+/** Función para obtener la versión actual sin bloquear; se suelta con connected_release */
+const ConnectedSet* connected_acquire(void) {
+    if (readerSlot == -1) {
+        readerSlot = atomic_fetch_add(&readersCount, 1);
+        if (readerSlot >= CONNECTED_MAX_READERS) {
+            readerSlot = -2;
+        }
+    }
+    if (readerSlot == -2) {
+        // Sin hueco para anunciar la época: leer con los escritores bloqueados
+        pthread_mutex_lock(&writerMutex);
+        return atomic_load(&current);
+    }
+    // Anunciar la época antes de leer el puntero: una versión sustituida después de este
+    // punto no se libera hasta que el lector termine
+    atomic_store(&readerEpoch[readerSlot], atomic_load(&epoch));
+    return atomic_load(&current);
+}
+
+/** Función para obtener la respuesta de LIST_USERS de una versión (obtenida con connected_acquire) */
+// La versión es inmutable, así que su respuesta solo se serializa una vez por protocolo (1
+// texto, 2 binario): cada CONNECT, DISCONNECT o UNREGISTER publica una versión nueva (número
+// de versión = generación) sin respuesta, y la primera lectura la construye. NULL si no hay
+// memoria.
+const ConnectedPayload* connected_payload(const ConnectedSet* set, int protocol) {
+    ConnectedSet* mutableSet = (ConnectedSet*) set;
+    _Atomic(ConnectedPayload*)* slot = &mutableSet->payload[protocol == 2 ? 1 : 0];
+    ConnectedPayload* payload = atomic_load(slot);
+    if (payload != NULL) {
+        return payload;
+    }
+
+    // Número de usuarios y userName, ip y puerto de cada uno
+    MsgBuffer msg;
+    initMsgBuffer(&msg);
+    int error = protocol == 2 ? appendTLVInt32(&msg, TLV_COUNT, set->count) : appendInt(&msg, set->count);
+    for (int i = 0; i < set->count && !error; i++) {
+        const ConnectedUser* u = set->users[i];
+        if (protocol == 2) {
+            error = appendTLVString(&msg, TLV_USER, u->userName) == -1 || appendTLVString(&msg, TLV_IP, u->ip) == -1 ||
+                    appendTLVInt32(&msg, TLV_PORT, atoi(u->port)) == -1;
+        } else {
+            error = appendString(&msg, u->userName) == -1 || appendString(&msg, u->ip) == -1 ||
+                    appendString(&msg, u->port) == -1;
+        }
+    }
+    payload = error ? NULL : malloc(sizeof(ConnectedPayload) + msg.len);
+    if (!payload) {
+        perror("Error al asignar memoria para la lista de conectados");
+        freeMsgBuffer(&msg);
+        return NULL;
+    }
+    payload->len = msg.len;
+    memcpy(payload->data, msg.data, msg.len);
+    freeMsgBuffer(&msg);
+
+    // Si otro lector la ha construido a la vez, se usa la suya
+    ConnectedPayload* expected = NULL;
+    if (!atomic_compare_exchange_strong(slot, &expected, payload)) {
+        free(payload);
+        return expected;
+    }
+    return payload;
+}
+
+/** Función para buscar un usuario en una versión por su número de registro, NULL si no está */
+const ConnectedUser* connected_find(const ConnectedSet* set, unsigned long long seq) {
+    int pos = find_position(set, seq);
+    if (pos == set->count || set->users[pos]->seq != seq) {
+        return NULL;
+    }
+    return set->users[pos];
+}
+
+/** Función para terminar de leer la versión obtenida con connected_acquire */
+void connected_release(void) {
+    if (readerSlot == -2) {
+        pthread_mutex_unlock(&writerMutex);
+        return;
+    }
+    atomic_store(&readerEpoch[readerSlot], 0);
+}
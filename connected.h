@@ -0,0 +1,45 @@
+#ifndef CONNECTED_H
+#define CONNECTED_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include "registry.h"
+
+#define CONNECTED_MAX_READERS   64  // threads que pueden leer sin bloquear a la vez
+
+// Usuario conectado (inmutable: compartido por todas las versiones que lo contienen)
+typedef struct {
+    unsigned long long seq;     // número de registro, ordena la lista como LIST_USERS
+    const char* ip;
+    const char* port;
+    char userName[];            // userName, ip y puerto seguidos, terminados en '\0'
+} ConnectedUser;
+
+// Respuesta de LIST_USERS ya serializada tras el resultado: número de usuarios y userName,
+// ip y puerto de cada uno, terminados en '\0' (protocolo de texto) o como campos TLV (binario)
+typedef struct {
+    size_t len;
+    char data[];
+} ConnectedPayload;
+
+// Versión inmutable del conjunto de usuarios conectados, en orden de registro
+typedef struct ConnectedSet {
+    unsigned long long version;
+    int count;
+    ConnectedUser** users;
+    _Atomic(ConnectedPayload*) payload[2];  // por protocolo; se construye con la primera lectura
+    ConnectedUser* removed;             // usuario que ya no está en la versión siguiente
+    unsigned long long retireEpoch;     // época en la que se sustituyó
+    struct ConnectedSet* nextRetired;
+} ConnectedSet;
+
+int connected_init(const UserNode* first);
+void connected_destroy(void);
+int connected_add(unsigned long long seq, const char* userName, const char* ip, const char* port);
+int connected_remove(unsigned long long seq);
+const ConnectedSet* connected_acquire(void);
+const ConnectedPayload* connected_payload(const ConnectedSet* set, int protocol);
+const ConnectedUser* connected_find(const ConnectedSet* set, unsigned long long seq);
+void connected_release(void);
+
+#endif
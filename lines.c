@@ -3,6 +3,8 @@
 #include "lines.h"
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
@@ -23,6 +25,30 @@ int sendMessage(int socket, char *buffer, int len)
         return(0);	/* full length has been sent */
 }
 
+/* Envía varios bloques con writev (tantas llamadas como escrituras parciales haya) */
+int sendMessageV(int socket, struct iovec *iov, int iovcnt)
+{
+    while (iovcnt > 0) {
+        ssize_t r = writev(socket, iov, iovcnt);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return (-1);   /* fail */
+        }
+        /* Saltar los bloques ya enviados y ajustar el primero pendiente */
+        while (iovcnt > 0 && (size_t) r >= iov->iov_len) {
+            r -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + r;
+            iov->iov_len -= r;
+        }
+    }
+    return(0);	/* full length has been sent */
+}
+
 int recvMessage(int socket, char *buffer, int len)
 {
     int r;
@@ -86,6 +112,180 @@ ssize_t readLine(int fd, void *buffer, size_t n)
 }
 
 
+#define ONES  0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
+/* Busca el primer '\n' o '\0' en [p, end): compara 8 bytes por iteración */
+static const char *findLineEnd(const char *p, const char *end)
+{
+    while (p + sizeof(uint64_t) <= end) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        uint64_t nl = v ^ (ONES * '\n');
+        if (((v - ONES) & ~v & HIGHS) | ((nl - ONES) & ~nl & HIGHS))
+            break;		/* hay un terminador en esta palabra */
+        p += sizeof(uint64_t);
+    }
+    for (; p < end; p++) {
+        if (*p == '\n' || *p == '\0')
+            return p;
+    }
+    return NULL;
+}
+
+void initLineReader(LineReader *reader, int fd)
+{
+    reader->fd = fd;
+    reader->start = 0;
+    reader->end = 0;
+    reader->lineLen = 0;
+    reader->eof = 0;
+}
+
+/*
+ * Igual que readLine, pero con un read() por bloque en lugar de uno por byte.
+ * Con sockets no bloqueantes devuelve -1 con errno EAGAIN si la línea aún no está
+ * completa; lo ya recibido queda en buffer, que debe ser el mismo en la siguiente llamada.
+ * Devuelve 0 con reader->eof activo si se cerró la conexión sin datos pendientes.
+ */
+ssize_t readLineBuffered(LineReader *reader, void *buffer, size_t n)
+{
+    char *buf = buffer;
+
+    if (n <= 0 || buffer == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (;;) {
+        if (reader->start == reader->end) {
+            if (reader->eof) {	/* EOF: la línea pendiente termina aquí */
+                size_t totRead = reader->lineLen;
+                buf[totRead] = '\0';
+                reader->lineLen = 0;
+                return totRead;
+            }
+            ssize_t numRead = read(reader->fd, reader->buf, LINE_READER_SIZE);
+            if (numRead == -1) {
+                if (errno == EINTR)	/* interrupted -> restart read() */
+                    continue;
+                return -1;		/* EAGAIN u otro error */
+            }
+            reader->start = 0;
+            reader->end = numRead;
+            if (numRead == 0)
+                reader->eof = 1;
+            continue;
+        }
+
+        const char *p = reader->buf + reader->start;
+        const char *end = reader->buf + reader->end;
+        const char *stop = findLineEnd(p, end);
+        size_t len = (stop ? stop : end) - p;
+
+        /* discard > (n-1) bytes */
+        if (reader->lineLen < n - 1) {
+            size_t room = n - 1 - reader->lineLen;
+            size_t copy = len < room ? len : room;
+            memcpy(buf + reader->lineLen, p, copy);
+            reader->lineLen += copy;
+        }
+        if (stop == NULL) {
+            reader->start = reader->end;
+            continue;
+        }
+        reader->start += len + 1;
+        size_t totRead = reader->lineLen;
+        buf[totRead] = '\0';
+        reader->lineLen = 0;
+        return totRead;
+    }
+}
+
+
+/*
+ * Lee exactamente n bytes con el mismo buffer de bloques que readLineBuffered.
+ * Con sockets no bloqueantes devuelve -1 con errno EAGAIN si aún no han llegado todos;
+ * lo ya recibido queda en buffer, que debe ser el mismo en la siguiente llamada.
+ * Devuelve menos de n bytes (con reader->eof activo) si se cerró la conexión antes.
+ */
+ssize_t readBytesBuffered(LineReader *reader, void *buffer, size_t n)
+{
+    char *buf = buffer;
+
+    while (reader->lineLen < n) {
+        if (reader->start == reader->end) {
+            if (reader->eof) {
+                size_t totRead = reader->lineLen;
+                reader->lineLen = 0;
+                return totRead;
+            }
+            ssize_t numRead = read(reader->fd, reader->buf, LINE_READER_SIZE);
+            if (numRead == -1) {
+                if (errno == EINTR)	/* interrupted -> restart read() */
+                    continue;
+                return -1;		/* EAGAIN u otro error */
+            }
+            reader->start = 0;
+            reader->end = numRead;
+            if (numRead == 0)
+                reader->eof = 1;
+            continue;
+        }
+        size_t avail = reader->end - reader->start;
+        size_t copy = n - reader->lineLen < avail ? n - reader->lineLen : avail;
+        memcpy(buf + reader->lineLen, reader->buf + reader->start, copy);
+        reader->start += copy;
+        reader->lineLen += copy;
+    }
+    reader->lineLen = 0;
+    return n;
+}
+
+/*
+ * Devuelve en c el siguiente byte sin consumirlo: 1 si lo hay, 0 si se cerró la conexión
+ * y -1 con errno EAGAIN si aún no ha llegado nada.
+ */
+ssize_t peekBuffered(LineReader *reader, char *c)
+{
+    while (reader->start == reader->end) {
+        if (reader->eof)
+            return 0;
+        ssize_t numRead = read(reader->fd, reader->buf, LINE_READER_SIZE);
+        if (numRead == -1) {
+            if (errno == EINTR)	/* interrupted -> restart read() */
+                continue;
+            return -1;		/* EAGAIN u otro error */
+        }
+        reader->start = 0;
+        reader->end = numRead;
+        if (numRead == 0)
+            reader->eof = 1;
+    }
+    *c = reader->buf[reader->start];
+    return 1;
+}
+
+/* Envía los bloques como una trama: su longitud total (4 bytes, orden de red) y los datos */
+int sendFrameV(int socket, struct iovec *iov, int iovcnt)
+{
+    struct iovec frame[FRAME_MAX_IOV + 1];
+    uint32_t len = 0;
+
+    if (iovcnt > FRAME_MAX_IOV) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (int i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+        frame[i + 1] = iov[i];
+    }
+    uint32_t len_net = htonl(len);
+    frame[0].iov_base = &len_net;
+    frame[0].iov_len = sizeof(len_net);
+    return sendMessageV(socket, frame, iovcnt + 1);
+}
+
 int recvInt32(int socket, int *dest) {
     int32_t int_net;
     if (recvMessage(socket, (char *) &int_net, sizeof(int32_t)) == -1) {
@@ -135,4 +335,118 @@ int sendV_value2(int socket, double* V_value2, int N_value2) {
         }
     }
     return 0;
-}
\ No newline at end of file
+}
+
+void initMsgBuffer(MsgBuffer *msg) {
+    msg->data = NULL;
+    msg->len = 0;
+    msg->capacity = 0;
+}
+
+/* Reserva espacio para len bytes más al final del mensaje */
+static int reserveMsgBuffer(MsgBuffer *msg, size_t len) {
+    if (msg->len + len > msg->capacity) {
+        size_t capacity = msg->capacity ? msg->capacity : 1024;
+        while (capacity < msg->len + len) capacity *= 2;
+        char *data = realloc(msg->data, capacity);
+        if (data == NULL) {
+            perror("Error realloc (reserveMsgBuffer)");
+            return -1;
+        }
+        msg->data = data;
+        msg->capacity = capacity;
+    }
+    return 0;
+}
+
+/* Añade una cadena al mensaje incluyendo su '\0' final */
+int appendString(MsgBuffer *msg, const char *str) {
+    size_t len = strlen(str) + 1;
+    if (reserveMsgBuffer(msg, len) == -1)
+        return -1;
+    memcpy(msg->data + msg->len, str, len);
+    msg->len += len;
+    return 0;
+}
+
+/* Añade un entero en texto, como lo envían los servicios ("%d" y '\0') */
+int appendInt(MsgBuffer *msg, int num) {
+    char buffer[16];
+    sprintf(buffer, "%d", num);
+    return appendString(msg, buffer);
+}
+
+void freeMsgBuffer(MsgBuffer *msg) {
+    free(msg->data);
+    initMsgBuffer(msg);
+}
+
+void packFrameHeader(const FrameHeader *header, unsigned char *out) {
+    uint32_t length = htonl(header->length);
+    uint32_t requestId = htonl(header->requestId);
+    uint16_t opcode = htons(header->opcode);
+    uint16_t status = htons(header->status);
+    memcpy(out, &length, 4);
+    memcpy(out + 4, &requestId, 4);
+    memcpy(out + 8, &opcode, 2);
+    memcpy(out + 10, &status, 2);
+}
+
+void unpackFrameHeader(const unsigned char *in, FrameHeader *header) {
+    uint32_t length, requestId;
+    uint16_t opcode, status;
+    memcpy(&length, in, 4);
+    memcpy(&requestId, in + 4, 4);
+    memcpy(&opcode, in + 8, 2);
+    memcpy(&status, in + 10, 2);
+    header->length = ntohl(length);
+    header->requestId = ntohl(requestId);
+    header->opcode = ntohs(opcode);
+    header->status = ntohs(status);
+}
+
+/* Añade un campo TLV con los bytes de la cadena (sin el '\0') */
+int appendTLVString(MsgBuffer *msg, int type, const char *str) {
+    size_t len = strlen(str);
+    if (len > TLV_MAX_LEN) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (reserveMsgBuffer(msg, TLV_HEADER_SIZE + len) == -1)
+        return -1;
+    unsigned char tlv[TLV_HEADER_SIZE] = { type, len };
+    memcpy(msg->data + msg->len, tlv, TLV_HEADER_SIZE);
+    memcpy(msg->data + msg->len + TLV_HEADER_SIZE, str, len);
+    msg->len += TLV_HEADER_SIZE + len;
+    return 0;
+}
+
+/* Añade un campo TLV con un entero de 4 bytes en orden de red */
+int appendTLVInt32(MsgBuffer *msg, int type, int num) {
+    if (reserveMsgBuffer(msg, TLV_HEADER_SIZE + sizeof(int32_t)) == -1)
+        return -1;
+    unsigned char tlv[TLV_HEADER_SIZE] = { type, sizeof(int32_t) };
+    int32_t num_net = htonl(num);
+    memcpy(msg->data + msg->len, tlv, TLV_HEADER_SIZE);
+    memcpy(msg->data + msg->len + TLV_HEADER_SIZE, &num_net, sizeof(int32_t));
+    msg->len += TLV_HEADER_SIZE + sizeof(int32_t);
+    return 0;
+}
+
+/*
+ * Lee el campo TLV que empieza en *pos y avanza *pos al siguiente.
+ * Devuelve 1 si hay campo, 0 al final de los datos y -1 si el campo se sale de ellos.
+ */
+int nextTLV(const char *data, size_t len, size_t *pos, int *type, const char **value, size_t *valueLen) {
+    if (*pos == len)
+        return 0;
+    if (*pos + TLV_HEADER_SIZE > len)
+        return -1;
+    *type = (unsigned char) data[*pos];
+    *valueLen = (unsigned char) data[*pos + 1];
+    if (*pos + TLV_HEADER_SIZE + *valueLen > len)
+        return -1;
+    *value = data + *pos + TLV_HEADER_SIZE;
+    *pos += TLV_HEADER_SIZE + *valueLen;
+    return 1;
+}
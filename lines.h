@@ -1,10 +1,66 @@
 #include <unistd.h>
+#include <stdint.h>
 #include <arpa/inet.h>
+#include <sys/uio.h>
+
+#define LINE_READER_SIZE 4096
+#define FRAME_MAX_IOV    8      /* bloques de datos por trama en sendFrameV */
+
+/* Protocolo binario (v2): el cliente saluda con PROTOCOL_MAGIC y su versión (4 bytes) y el
+   servidor responde igual con la versión aceptada. Después, cada petición y cada respuesta
+   es una cabecera fija seguida de campos TLV: tipo (1 byte), longitud (1 byte) y valor.
+   Los campos no pasan de 255 bytes, como en el protocolo de texto */
+#define PROTOCOL_MAGIC      "\0P2P"    /* 4 bytes; un cliente de texto nunca empieza por '\0' */
+#define PROTOCOL_MAGIC_LEN  4
+#define PROTOCOL_VERSION    2
+#define FRAME_HEADER_SIZE   12
+#define TLV_HEADER_SIZE     2
+#define TLV_MAX_LEN         255
+
+/* Cabecera de una trama v2 (en el socket, en orden de red) */
+typedef struct {
+    uint32_t length;        /* bytes de campos TLV que siguen a la cabecera */
+    uint32_t requestId;     /* elegido por el cliente; la respuesta lo repite */
+    uint16_t opcode;
+    uint16_t status;        /* resultado de la operación (solo en respuestas) */
+} FrameHeader;
+
+/* Lector de líneas con buffer: lee del socket por bloques y separa las líneas en memoria */
+typedef struct {
+    int fd;
+    size_t start;       /* primer byte sin consumir de buf */
+    size_t end;         /* fin de los datos leídos en buf */
+    size_t lineLen;     /* bytes de la línea (o bloque) en curso ya copiados al destino */
+    int eof;            /* el otro extremo ha cerrado la conexión */
+    char buf[LINE_READER_SIZE];
+} LineReader;
+
+/* Mensaje de respuesta formado por varios campos terminados en '\0' */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+} MsgBuffer;
 
 int sendMessage(int socket, char *buffer, int len);
+int sendMessageV(int socket, struct iovec *iov, int iovcnt);
+int sendFrameV(int socket, struct iovec *iov, int iovcnt);
 int recvMessage(int socket, char *buffer, int len);
 ssize_t readLine(int fd, void *buffer, size_t n);
+ssize_t readLineBuffered(LineReader *reader, void *buffer, size_t n);
+ssize_t readBytesBuffered(LineReader *reader, void *buffer, size_t n);
+ssize_t peekBuffered(LineReader *reader, char *c);
+void initLineReader(LineReader *reader, int fd);
 int recvInt32(int socket, int *dest);
 int recvV_value2(int socket, double *V_value2, int N_value2);
 int sendInt32(int socket, int num);
-int sendV_value2(int socket, double* V_value2, int N_value2);
\ No newline at end of file
+int sendV_value2(int socket, double* V_value2, int N_value2);
+void initMsgBuffer(MsgBuffer *msg);
+int appendString(MsgBuffer *msg, const char *str);
+int appendInt(MsgBuffer *msg, int num);
+void freeMsgBuffer(MsgBuffer *msg);
+void packFrameHeader(const FrameHeader *header, unsigned char *out);
+void unpackFrameHeader(const unsigned char *in, FrameHeader *header);
+int appendTLVString(MsgBuffer *msg, int type, const char *str);
+int appendTLVInt32(MsgBuffer *msg, int type, int num);
+int nextTLV(const char *data, size_t len, size_t *pos, int *type, const char **value, size_t *valueLen);
\ No newline at end of file
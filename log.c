@@ -0,0 +1,269 @@
+// log.c
+// Traza del servidor sin bloquear a los threads que la escriben.
+// Cada thread tiene un buffer circular propio del que solo él escribe y solo el thread volcador
+// lee, así que basta con dos índices atómicos y no hay cerrojos en el camino de las peticiones.
+// El volcador junta las líneas pendientes de todos los buffers en orden de tiempo y las escribe
+// en la salida estándar con una sola llamada por bloque. Si un buffer está lleno, la línea se
+// descarta y se cuenta: la traza nunca frena al servidor.
+// En modo síncrono (o en los threads sin buffer) cada línea se escribe en el momento.
+// Formato de cada línea: segundos desde el arranque, nivel, thread y texto:
+//     12.345678 I  3 s> OPERATION FROM ana
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include "log.h"
+
+#define LOG_OUT_SIZE  65536     // bloque de salida del volcador
+
+// Línea pendiente de volcar
+typedef struct {
+    uint64_t time;              // ns desde log_init
+    uint8_t level;
+    uint8_t len;
+    char text[LOG_LINE_MAX];
+} LogEntry;
+
+// Buffer circular de un thread. head solo lo avanza el thread y tail el volcador; van en
+// líneas de caché distintas para que no se disputen
+typedef struct {
+    _Alignas(64) atomic_size_t head;    // siguiente entrada que escribe el thread
+    _Alignas(64) atomic_size_t tail;    // siguiente entrada que vuelca el volcador
+    atomic_ullong dropped;              // líneas descartadas por buffer lleno
+    int id;
+    LogEntry entries[LOG_RING_SLOTS];
+} LogRing;
+
+LogLevel logLevel = LOG_LEVEL_INFO;
+
+static _Atomic(LogRing*) rings[LOG_MAX_THREADS];
+static atomic_int ringsCount = 0;
+static __thread LogRing* local;         // buffer del thread, NULL si escribe de forma síncrona
+static __thread int localChecked;       // ya se intentó reservar el buffer del thread
+static int syncMode = 0;
+static uint64_t startNs;
+static pthread_t flusher;
+static int flusherRunning = 0;
+static atomic_int stopFlusher = 0;
+static char out[LOG_OUT_SIZE];          // solo lo usa el volcador
+
+static const char* levelNames[] = { "OFF", "ERROR", "WARN", "INFO", "DEBUG" };
+static const char levelChars[] = "-EWID";
+
+/** Función para obtener el instante actual en ns desde log_init */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec - startNs;
+}
+
+/** Función para escribir un bloque completo en la salida estándar */
+static void write_out(const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, data, len);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return;     // sin salida no hay a quién avisar
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+/** Función para dar formato a una línea de la traza; devuelve su longitud */
+static int format_line(char* dest, size_t size, uint64_t time, int level, int id, const char* text, int len) {
+    int n = snprintf(dest, size, "%llu.%06llu %c %2d %.*s\n",
+                     (unsigned long long) (time / 1000000000ull), (unsigned long long) (time % 1000000000ull / 1000),
+                     levelChars[level], id, len, text);
+    return n < (int) size ? n : (int) size - 1;
+}
+
+/** Función para volcar las líneas pendientes de todos los buffers; devuelve cuántas */
+static long flush_rings(void) {
+    size_t pos[LOG_MAX_THREADS], head[LOG_MAX_THREADS];
+    int count = atomic_load(&ringsCount);
+    if (count > LOG_MAX_THREADS) count = LOG_MAX_THREADS;
+    for (int i = 0; i < count; i++) {
+        LogRing* ring = atomic_load(&rings[i]);
+        pos[i] = head[i] = 0;
+        if (ring != NULL) {
+            pos[i] = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+            head[i] = atomic_load_explicit(&ring->head, memory_order_acquire);
+        }
+    }
+
+    // Mezclar las líneas por tiempo: cada buffer ya está ordenado
+    long lines = 0;
+    size_t used = 0;
+    for (;;) {
+        int next = -1;
+        uint64_t nextTime = 0;
+        for (int i = 0; i < count; i++) {
+            if (pos[i] == head[i]) continue;
+            LogRing* ring = atomic_load_explicit(&rings[i], memory_order_relaxed);
+            uint64_t time = ring->entries[pos[i] & (LOG_RING_SLOTS - 1)].time;
+            if (next == -1 || time < nextTime) {
+                next = i;
+                nextTime = time;
+            }
+        }
+        if (next == -1) break;
+
+        if (LOG_OUT_SIZE - used < LOG_LINE_MAX + 32) {
+            write_out(out, used);
+            used = 0;
+        }
+        LogRing* ring = atomic_load_explicit(&rings[next], memory_order_relaxed);
+        LogEntry* entry = &ring->entries[pos[next] & (LOG_RING_SLOTS - 1)];
+        used += format_line(out + used, LOG_OUT_SIZE - used, entry->time, entry->level, ring->id, entry->text, entry->len);
+        // La entrada ya está copiada: el thread puede reutilizarla
+        atomic_store_explicit(&ring->tail, ++pos[next], memory_order_release);
+        lines++;
+    }
+    write_out(out, used);
+    return lines;
+}
+
+/** Función del thread volcador */
+static void* flusher_thread(void* arg) {
+    (void) arg;
+    struct timespec pause = { 0, LOG_FLUSH_MS * 1000000L };
+    while (!atomic_load(&stopFlusher)) {
+        if (flush_rings() == 0) {
+            nanosleep(&pause, NULL);
+        }
+    }
+    flush_rings();
+    return NULL;
+}
+
+/** Función para reservar el buffer del thread que la llama */
+static LogRing* thread_ring(void) {
+    if (localChecked) {
+        return local;
+    }
+    localChecked = 1;
+    int slot = atomic_fetch_add(&ringsCount, 1);
+    if (slot >= LOG_MAX_THREADS) {
+        return NULL;
+    }
+    LogRing* ring = aligned_alloc(64, sizeof(LogRing));
+    if (!ring) {
+        return NULL;
+    }
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->dropped, 0);
+    ring->id = slot + 1;
+    atomic_store(&rings[slot], ring);
+    local = ring;
+    return local;
+}
+
+/** Función para obtener el nivel de la traza a partir de su nombre */
+int log_parse_level(const char* name, LogLevel* level) {
+    for (int i = LOG_LEVEL_OFF; i <= LOG_LEVEL_DEBUG; i++) {
+        if (strcasecmp(name, levelNames[i]) == 0) {
+            *level = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/** Función para iniciar la traza con su nivel y arrancar el volcador si es asíncrona */
+int log_init(LogLevel level, int sync) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    startNs = (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    logLevel = level;
+    syncMode = sync;
+    if (sync || level == LOG_LEVEL_OFF) {
+        return 0;
+    }
+    // El volcador no atiende señales: las del programa deben llegar a los threads que las esperan
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &previous);
+    int err = pthread_create(&flusher, NULL, flusher_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (err != 0) {
+        perror("Error al crear el thread de la traza");
+        syncMode = 1;
+        return -1;
+    }
+    flusherRunning = 1;
+    return 0;
+}
+
+/** Función para escribir una línea en la traza */
+// Se llama a través de las macros log_*, que ya han comprobado el nivel.
+void log_write(LogLevel level, const char* format, ...) {
+    va_list args;
+    LogRing* ring = syncMode ? NULL : thread_ring();
+    if (ring == NULL) {
+        char text[LOG_LINE_MAX], line[LOG_LINE_MAX + 32];
+        va_start(args, format);
+        int len = vsnprintf(text, sizeof(text), format, args);
+        va_end(args);
+        if (len < 0) return;
+        if (len >= LOG_LINE_MAX) len = LOG_LINE_MAX - 1;
+        write_out(line, format_line(line, sizeof(line), now_ns(), level, 0, text, len));
+        return;
+    }
+
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == LOG_RING_SLOTS) {
+        atomic_store_explicit(&ring->dropped, atomic_load_explicit(&ring->dropped, memory_order_relaxed) + 1,
+                              memory_order_relaxed);
+        return;
+    }
+    LogEntry* entry = &ring->entries[head & (LOG_RING_SLOTS - 1)];
+    va_start(args, format);
+    int len = vsnprintf(entry->text, LOG_LINE_MAX, format, args);
+    va_end(args);
+    if (len < 0) return;
+    entry->len = len >= LOG_LINE_MAX ? LOG_LINE_MAX - 1 : len;
+    entry->level = level;
+    entry->time = now_ns();
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/** Función para obtener las líneas descartadas por tener el buffer lleno */
+unsigned long long log_dropped(void) {
+    unsigned long long dropped = 0;
+    int count = atomic_load(&ringsCount);
+    for (int i = 0; i < count && i < LOG_MAX_THREADS; i++) {
+        LogRing* ring = atomic_load(&rings[i]);
+        if (ring != NULL) {
+            dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+        }
+    }
+    return dropped;
+}
+
+/** Función para volcar lo pendiente, parar el volcador y liberar los buffers */
+// Los demás threads ya deben haber terminado.
+void log_destroy(void) {
+    if (flusherRunning) {
+        atomic_store(&stopFlusher, 1);
+        pthread_join(flusher, NULL);
+        flusherRunning = 0;
+    }
+    unsigned long long dropped = log_dropped();
+    if (dropped > 0) {
+        fprintf(stderr, "Traza: %llu líneas descartadas por buffer lleno\n", dropped);
+    }
+    logLevel = LOG_LEVEL_OFF;
+    for (int i = 0; i < LOG_MAX_THREADS; i++) {
+        free(atomic_exchange(&rings[i], NULL));
+    }
+}
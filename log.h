@@ -0,0 +1,33 @@
+#ifndef LOG_H
+#define LOG_H
+
+#define LOG_MAX_THREADS 32      // threads con buffer propio (el resto escribe de forma síncrona)
+#define LOG_RING_SLOTS  1024    // líneas del buffer de cada thread (potencia de 2)
+#define LOG_LINE_MAX    120     // longitud máxima del texto de una línea
+#define LOG_FLUSH_MS    10      // espera del volcador cuando no hay líneas pendientes
+
+// Niveles de la traza, de menos a más detallado
+typedef enum {
+    LOG_LEVEL_OFF = 0,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG
+} LogLevel;
+
+extern LogLevel logLevel;
+
+// Las macros no evalúan los argumentos si el nivel está desactivado
+#define log_at(level, ...) do { if ((level) <= logLevel) log_write((level), __VA_ARGS__); } while (0)
+#define log_error(...) log_at(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define log_warn(...)  log_at(LOG_LEVEL_WARN, __VA_ARGS__)
+#define log_info(...)  log_at(LOG_LEVEL_INFO, __VA_ARGS__)
+#define log_debug(...) log_at(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+int log_parse_level(const char* name, LogLevel* level);
+int log_init(LogLevel level, int sync);
+void log_write(LogLevel level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+unsigned long long log_dropped(void);
+void log_destroy(void);
+
+#endif
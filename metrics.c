@@ -0,0 +1,330 @@
+// metrics.c
+// Métricas del servidor: contadores e histogramas de latencia de cada operación.
+// Cada thread anota en su propia zona, que solo escribe él: no hay cerrojos ni operaciones
+// atómicas de lectura-modificación-escritura en el camino de las peticiones. El informe
+// (STATS) lee las zonas de todos los threads y las suma.
+// Los histogramas son logarítmicos como los de HDR Histogram: los valores menores que
+// METRICS_SUB_BUCKETS ns tienen un bucket cada uno y cada potencia de 2 posterior se divide
+// en METRICS_SUB_BUCKETS buckets iguales, por lo que el error relativo está acotado.
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "metrics.h"
+
+// Histograma de tiempos en ns
+typedef struct {
+    atomic_ullong buckets[METRICS_BUCKETS];
+    atomic_ullong count;
+    atomic_ullong sum;
+    atomic_ullong max;
+} Histogram;
+
+// Métricas anotadas por un thread
+typedef struct {
+    atomic_ullong requests[METRICS_MAX_OPS];
+    atomic_ullong failed[METRICS_MAX_OPS];     // respuestas con resultado distinto de 0
+    atomic_ullong connections;
+    Histogram histograms[METRICS_MAX_OPS][METRIC_KINDS];
+} ThreadMetrics;
+
+// Suma de los histogramas de todos los threads
+typedef struct {
+    unsigned long long buckets[METRICS_BUCKETS];
+    unsigned long long count;
+    unsigned long long sum;
+    unsigned long long max;
+} HistogramTotal;
+
+// Texto del informe
+typedef struct {
+    char* data;
+    size_t len;
+    size_t capacity;
+} Report;
+
+static _Atomic(ThreadMetrics*) threadMetrics[METRICS_MAX_THREADS];
+static atomic_int threadsCount = 0;
+static __thread ThreadMetrics* local;  // zona del thread, NULL si no anota métricas
+static const char* opNames[METRICS_MAX_OPS];
+static int opsCount;
+
+static const char* kindNames[METRIC_KINDS] = { "servicio", "cola", "cerrojos", "log" };
+static const char* kindMetrics[METRIC_KINDS] = {
+    "p2p_request_duration_seconds", "p2p_queue_wait_seconds",
+    "p2p_lock_wait_seconds", "p2p_persist_duration_seconds"
+};
+static const char* kindHelp[METRIC_KINDS] = {
+    "Tiempo en atender la petición y enviar la respuesta.",
+    "Espera de la petición en el buffer hasta que la recoge un thread.",
+    "Espera por los cerrojos de la tabla de usuarios y los mutex de contenidos.",
+    "Escritura de la mutación en el log hasta que está en disco."
+};
+static const double quantiles[] = { 0.5, 0.99, 0.999 };
+
+/** Función para sumar a un contador del propio thread (único escritor) */
+static inline void add(atomic_ullong* counter, unsigned long long n) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+/** Función para obtener el bucket de un tiempo */
+static int bucket_index(uint64_t ns) {
+    if (ns < METRICS_SUB_BUCKETS) {
+        return (int) ns;
+    }
+    int msb = 63 - __builtin_clzll(ns);
+    if (msb >= METRICS_MAX_BITS) {
+        return METRICS_BUCKETS - 1;
+    }
+    int shift = msb - METRICS_SUB_BITS;
+    return (shift + 1) * METRICS_SUB_BUCKETS + (int) ((ns >> shift) - METRICS_SUB_BUCKETS);
+}
+
+/** Función para obtener el mayor tiempo que cae en un bucket */
+static uint64_t bucket_upper(int index) {
+    if (index < METRICS_SUB_BUCKETS) {
+        return index;
+    }
+    int shift = index / METRICS_SUB_BUCKETS - 1;
+    uint64_t sub = index % METRICS_SUB_BUCKETS;
+    return ((METRICS_SUB_BUCKETS + sub) << shift) + ((uint64_t) 1 << shift) - 1;
+}
+
+/** Función para inicializar las métricas con los nombres de las operaciones */
+// La operación 0 agrupa las peticiones que no corresponden a ninguna otra.
+int metrics_init(const char* const* names, int count) {
+    if (count > METRICS_MAX_OPS) {
+        fprintf(stderr, "Error: demasiadas operaciones para las métricas\n");
+        return -1;
+    }
+    for (int op = 0; op < count; op++) {
+        opNames[op] = names[op] != NULL ? names[op] : "OTHER";
+    }
+    opsCount = count;
+    return 0;
+}
+
+/** Función para reservar la zona de métricas del thread que la llama */
+void metrics_thread_init(void) {
+    if (local != NULL) {
+        return;
+    }
+    int slot = atomic_fetch_add(&threadsCount, 1);
+    if (slot >= METRICS_MAX_THREADS) {
+        fprintf(stderr, "Sin hueco para las métricas del thread\n");
+        return;
+    }
+    local = calloc(1, sizeof(ThreadMetrics));
+    if (!local) {
+        perror("Error al asignar memoria para las métricas");
+        return;
+    }
+    atomic_store(&threadMetrics[slot], local);
+}
+
+/** Función para obtener el instante actual en ns (reloj monótono) */
+uint64_t metrics_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/** Función para anotar un tiempo de una operación */
+void metrics_record(int op, MetricKind kind, uint64_t ns) {
+    if (local == NULL || op < 0 || op >= opsCount) {
+        return;
+    }
+    Histogram* histogram = &local->histograms[op][kind];
+    add(&histogram->buckets[bucket_index(ns)], 1);
+    add(&histogram->count, 1);
+    add(&histogram->sum, ns);
+    if (ns > atomic_load_explicit(&histogram->max, memory_order_relaxed)) {
+        atomic_store_explicit(&histogram->max, ns, memory_order_relaxed);
+    }
+}
+
+/** Función para contar una petición atendida y si su resultado fue distinto de 0 */
+void metrics_count(int op, int failed) {
+    if (local == NULL || op < 0 || op >= opsCount) {
+        return;
+    }
+    add(&local->requests[op], 1);
+    if (failed) {
+        add(&local->failed[op], 1);
+    }
+}
+
+/** Función para contar una conexión aceptada */
+void metrics_connection(void) {
+    if (local != NULL) {
+        add(&local->connections, 1);
+    }
+}
+
+/** Función para añadir texto con formato al informe */
+static int report_printf(Report* report, const char* format, ...) {
+    for (;;) {
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(report->data + report->len, report->capacity - report->len, format, args);
+        va_end(args);
+        if (n < 0) {
+            return -1;
+        }
+        if ((size_t) n < report->capacity - report->len) {
+            report->len += n;
+            return 0;
+        }
+        size_t capacity = report->capacity * 2 > report->len + n + 1 ? report->capacity * 2 : report->len + n + 1;
+        char* data = realloc(report->data, capacity);
+        if (!data) {
+            perror("Error al asignar memoria para el informe de métricas");
+            return -1;
+        }
+        report->data = data;
+        report->capacity = capacity;
+    }
+}
+
+/** Función para sumar el histograma de una operación de todos los threads */
+static void sum_histogram(int op, MetricKind kind, HistogramTotal* total) {
+    memset(total, 0, sizeof(*total));
+    for (int t = 0; t < METRICS_MAX_THREADS; t++) {
+        ThreadMetrics* metrics = atomic_load(&threadMetrics[t]);
+        if (metrics == NULL) {
+            continue;
+        }
+        Histogram* histogram = &metrics->histograms[op][kind];
+        for (int b = 0; b < METRICS_BUCKETS; b++) {
+            total->buckets[b] += atomic_load_explicit(&histogram->buckets[b], memory_order_relaxed);
+        }
+        total->count += atomic_load_explicit(&histogram->count, memory_order_relaxed);
+        total->sum += atomic_load_explicit(&histogram->sum, memory_order_relaxed);
+        unsigned long long max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+        if (max > total->max) total->max = max;
+    }
+}
+
+/** Función para obtener el percentil q (0-1) de un histograma, en ns */
+static uint64_t histogram_quantile(const HistogramTotal* total, double q) {
+    // Los buckets se leen mientras se anotan: se usa su suma, no el contador
+    unsigned long long count = 0;
+    for (int b = 0; b < METRICS_BUCKETS; b++) count += total->buckets[b];
+    unsigned long long target = (unsigned long long) (q * count + 0.999999);
+    if (target == 0) target = 1;
+    unsigned long long seen = 0;
+    for (int b = 0; b < METRICS_BUCKETS; b++) {
+        seen += total->buckets[b];
+        if (seen >= target) {
+            uint64_t upper = bucket_upper(b);
+            return upper < total->max ? upper : total->max;
+        }
+    }
+    return total->max;
+}
+
+/** Función para sumar un contador de todos los threads */
+static unsigned long long sum_counter(size_t offset) {
+    unsigned long long total = 0;
+    for (int t = 0; t < METRICS_MAX_THREADS; t++) {
+        ThreadMetrics* metrics = atomic_load(&threadMetrics[t]);
+        if (metrics != NULL) {
+            total += atomic_load_explicit((atomic_ullong*) ((char*) metrics + offset), memory_order_relaxed);
+        }
+    }
+    return total;
+}
+
+/** Función para generar el informe de métricas: texto legible o formato de Prometheus */
+// Devuelve el texto (líneas terminadas en '\n', a liberar con free) o NULL si no hay memoria.
+char* metrics_report(int prometheus) {
+    Report report = { .data = malloc(4096), .len = 0, .capacity = 4096 };
+    if (!report.data) {
+        perror("Error al asignar memoria para el informe de métricas");
+        return NULL;
+    }
+    report.data[0] = '\0';
+    HistogramTotal* total = malloc(sizeof(HistogramTotal));
+    if (!total) {
+        perror("Error al asignar memoria para el informe de métricas");
+        free(report.data);
+        return NULL;
+    }
+
+    int error = 0;
+    unsigned long long connections = sum_counter(offsetof(ThreadMetrics, connections));
+    if (prometheus) {
+        error |= report_printf(&report, "# HELP p2p_connections_total Conexiones aceptadas.\n"
+                                        "# TYPE p2p_connections_total counter\n"
+                                        "p2p_connections_total %llu\n", connections);
+        error |= report_printf(&report, "# HELP p2p_requests_total Peticiones atendidas.\n"
+                                        "# TYPE p2p_requests_total counter\n");
+        for (int op = 0; op < opsCount; op++) {
+            error |= report_printf(&report, "p2p_requests_total{op=\"%s\"} %llu\n", opNames[op],
+                                   sum_counter(offsetof(ThreadMetrics, requests) + op * sizeof(atomic_ullong)));
+        }
+        error |= report_printf(&report, "# HELP p2p_request_errors_total Peticiones con resultado distinto de 0.\n"
+                                        "# TYPE p2p_request_errors_total counter\n");
+        for (int op = 0; op < opsCount; op++) {
+            error |= report_printf(&report, "p2p_request_errors_total{op=\"%s\"} %llu\n", opNames[op],
+                                   sum_counter(offsetof(ThreadMetrics, failed) + op * sizeof(atomic_ullong)));
+        }
+        for (int kind = 0; kind < METRIC_KINDS; kind++) {
+            error |= report_printf(&report, "# HELP %s %s\n# TYPE %s summary\n",
+                                   kindMetrics[kind], kindHelp[kind], kindMetrics[kind]);
+            for (int op = 0; op < opsCount; op++) {
+                sum_histogram(op, kind, total);
+                if (total->count == 0) {
+                    continue;
+                }
+                for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+                    error |= report_printf(&report, "%s{op=\"%s\",quantile=\"%g\"} %.9f\n", kindMetrics[kind],
+                                           opNames[op], quantiles[q], histogram_quantile(total, quantiles[q]) / 1e9);
+                }
+                error |= report_printf(&report, "%s_sum{op=\"%s\"} %.9f\n%s_count{op=\"%s\"} %llu\n",
+                                       kindMetrics[kind], opNames[op], total->sum / 1e9,
+                                       kindMetrics[kind], opNames[op], total->count);
+            }
+        }
+    } else {
+        error |= report_printf(&report, "conexiones aceptadas: %llu\n", connections);
+        error |= report_printf(&report, "operación     tiempo       n         p50 (us)   p99 (us)  p999 (us)   max (us)\n");
+        for (int op = 0; op < opsCount; op++) {
+            unsigned long long requests = sum_counter(offsetof(ThreadMetrics, requests) + op * sizeof(atomic_ullong));
+            if (requests == 0) {
+                continue;
+            }
+            unsigned long long failed = sum_counter(offsetof(ThreadMetrics, failed) + op * sizeof(atomic_ullong));
+            error |= report_printf(&report, "%-13s peticiones %llu, resultado distinto de 0: %llu\n",
+                                   opNames[op], requests, failed);
+            for (int kind = 0; kind < METRIC_KINDS; kind++) {
+                sum_histogram(op, kind, total);
+                if (total->count == 0) {
+                    continue;
+                }
+                error |= report_printf(&report, "%-13s %-9s %9llu %10.1f %10.1f %10.1f %10.1f\n",
+                                       opNames[op], kindNames[kind], total->count,
+                                       histogram_quantile(total, 0.5) / 1e3, histogram_quantile(total, 0.99) / 1e3,
+                                       histogram_quantile(total, 0.999) / 1e3, total->max / 1e3);
+            }
+        }
+    }
+    free(total);
+    if (error) {
+        free(report.data);
+        return NULL;
+    }
+    return report.data;
+}
+
+/** Función para liberar las zonas de métricas (sin threads anotando) */
+void metrics_destroy(void) {
+    for (int t = 0; t < METRICS_MAX_THREADS; t++) {
+        free(atomic_exchange(&threadMetrics[t], NULL));
+    }
+    atomic_store(&threadsCount, 0);
+    local = NULL;
+}
@@ -0,0 +1,33 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+#define METRICS_MAX_THREADS 32      // threads que pueden anotar métricas
+#define METRICS_MAX_OPS     16      // operaciones distintas (la 0 agrupa las no reconocidas)
+// Histogramas logarítmicos con METRICS_SUB_BUCKETS subdivisiones por potencia de 2 (error
+// relativo menor del 6,25 %) hasta 2^METRICS_MAX_BITS ns (unos 68 s)
+#define METRICS_SUB_BITS    4
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BITS)
+#define METRICS_MAX_BITS    36
+#define METRICS_BUCKETS     ((METRICS_MAX_BITS - METRICS_SUB_BITS + 1) * METRICS_SUB_BUCKETS)
+
+// Tiempos que se miden de cada petición
+typedef enum {
+    METRIC_SERVICE = 0,     // atender la petición y enviar la respuesta
+    METRIC_QUEUE,           // espera en el buffer de peticiones hasta que la recoge un thread
+    METRIC_LOCK,            // espera por los cerrojos de la tabla y los mutex de contenidos
+    METRIC_PERSIST,         // escritura en el log y espera a que esté en disco
+    METRIC_KINDS
+} MetricKind;
+
+int metrics_init(const char* const* opNames, int opCount);
+void metrics_thread_init(void);
+uint64_t metrics_now(void);
+void metrics_record(int op, MetricKind kind, uint64_t ns);
+void metrics_count(int op, int failed);
+void metrics_connection(void);
+char* metrics_report(int prometheus);
+void metrics_destroy(void);
+
+#endif
@@ -0,0 +1,718 @@
+// peer.c
+// Servidor de ficheros entre pares: atiende las peticiones GET_FILE de otros clientes en lugar
+// del hilo de escucha de client.py. Habla el mismo protocolo de texto, con campos terminados
+// en '\0':
+//   GET_FILE, fichero, dateTime
+//       respuesta: resultado ("0", "1" si no existe o "2" si falla) y, si es 0, el contenido
+//       del fichero hasta que se cierra la conexión.
+//   GET_FILE_RANGE, fichero, dateTime, offset, longitud (0 hasta el final)
+//       respuesta: resultado ("3" si el offset pasa del final), tamaño del fichero y su
+//       SHA-256 en hexadecimal y, si es 0, los bytes pedidos hasta que se cierra la conexión.
+//       Con el tamaño y el resumen por delante, el cliente puede reanudar una descarga
+//       cortada pidiendo el resto y comprobar el fichero al terminar.
+//   GET_FILE_HASHES, fichero, dateTime
+//       respuesta: resultado, tamaño, SHA-256 del fichero, tamaño de trozo (PEER_CHUNK_SIZE),
+//       número de trozos y el SHA-256 de cada trozo, para descargar cada uno de un par
+//       distinto y comprobarlo en cuanto llega.
+// Cada thread tiene su propio epoll y acepta del socket de escucha compartido (EPOLLEXCLUSIVE
+// reparte las conexiones). Los sockets no son bloqueantes y el fichero se envía con sendfile
+// directamente desde la caché de páginas, sin copiarlo al proceso, así que unos pocos threads
+// atienden muchas descargas simultáneas.
+// El resumen de cada fichero se calcula una vez en un thread aparte (las descargas que lo
+// esperan quedan en pausa sin bloquear su epoll) y se guarda mientras el fichero no cambie.
+// Uso: ./peer -p <puerto> [-d directorio] [-t threads] [-l nivel] [-s]
+//      -d directorio desde el que se sirven los ficheros (por defecto, el actual)
+#define _GNU_SOURCE     // accept4
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "lines.h"
+#include "log.h"
+#include "sha256.h"
+
+#define MAX_PEER_THREADS    64
+#define MAX_EVENTS          64      // eventos atendidos por cada epoll_wait
+#define PEER_FIELDS         5       // campos de la petición más larga (GET_FILE_RANGE)
+#define FIELD_SIZE          256
+#define HASH_BUCKETS        256     // buckets de la tabla de resúmenes
+#define PEER_CHUNK_SIZE     (4 << 20)   // bytes de cada trozo con resumen propio
+
+// Resultados de GET_FILE
+#define GET_FILE_OK         "0"
+#define GET_FILE_NOT_EXIST  "1"
+#define GET_FILE_FAIL       "2"
+#define GET_FILE_BAD_RANGE  "3"
+
+// Operaciones
+enum {
+    PEER_GET_FILE = 0,
+    PEER_GET_FILE_RANGE,
+    PEER_GET_FILE_HASHES
+};
+
+// Nombre y campos de la petición de cada operación, en el orden de su enum
+static const struct {
+    const char* name;
+    int fields;
+} operations[] = {
+    { "GET_FILE", 3 },
+    { "GET_FILE_RANGE", 5 },
+    { "GET_FILE_HASHES", 3 }
+};
+
+// Estado de una descarga
+enum {
+    PEER_REQUEST = 0,           // leyendo la petición
+    PEER_HASHING,               // esperando el resumen del fichero (no se toca desde el epoll)
+    PEER_HEADER,                // resumen listo: falta enviar la respuesta
+    PEER_HASH_FAILED,           // no se pudo calcular el resumen
+    PEER_BODY                   // enviando el fichero
+};
+
+struct PeerLoop;
+
+// Descarga en curso
+typedef struct PeerConn {
+    int sc;
+    struct PeerLoop* loop;      // thread que la atiende
+    int state;                  // solo lo cambia el thread que la atiende
+    int op;
+    LineReader reader;
+    int fieldsRead;             // campos de la petición ya leídos
+    int fieldsCount;            // campos de la operación pedida
+    char fields[PEER_FIELDS][FIELD_SIZE];
+    int fd;                     // fichero que se envía, -1 hasta tener la petición
+    off_t offset;               // siguiente byte que se envía
+    off_t end;                  // fin del rango pedido
+    off_t size;                 // tamaño del fichero
+    char* reply;                // respuesta con el resumen, enviada antes de los datos
+    size_t replyLen;
+    size_t replySent;
+    int hashOk;                 // resultado del cálculo del resumen
+    struct PeerConn* nextWaiter;    // siguiente descarga que espera el resumen o ya lo tiene
+} PeerConn;
+
+// Thread que atiende descargas: los threads de resúmenes le devuelven las que esperaban
+typedef struct PeerLoop {
+    pthread_t thread;
+    int wakeFd;                 // eventfd para avisarle de que hay descargas listas
+    pthread_mutex_t mutex;
+    PeerConn* ready;            // descargas con el resumen ya calculado
+} PeerLoop;
+
+// Resumen de un fichero, válido mientras no cambien su tamaño ni su fecha de modificación
+typedef struct HashEntry {
+    struct HashEntry* next;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    int ready;                  // 0 mientras se calcula
+    int superseded;             // el fichero cambió durante el cálculo: ya no está en la tabla
+    char hash[SHA256_HEX_SIZE];
+    unsigned char* chunks;      // resúmenes de los trozos de PEER_CHUNK_SIZE bytes
+    size_t chunkCount;
+    PeerConn* waiters;          // descargas que esperan el resumen
+} HashEntry;
+
+// Cálculo de un resumen en segundo plano
+typedef struct {
+    HashEntry* entry;
+    int fd;                     // copia del descriptor del fichero
+} HashJob;
+
+static int sd = -1;             // socket de escucha
+static int rootFd = -1;         // directorio desde el que se sirven los ficheros
+static int stopFd = -1;         // eventfd que despierta a todos los threads al terminar
+static volatile sig_atomic_t terminar = 0;
+static HashEntry* hashTable[HASH_BUCKETS];
+static pthread_mutex_t hashMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Función de manejo de la señal SIGINT (Ctrl+C) */
+static void signal_ctrlc(int signal) {
+    (void) signal;
+    terminar = 1;
+    uint64_t one = 1;
+    if (write(stopFd, &one, sizeof(one)) == -1) {
+        // No hay nada más que hacer dentro del manejador
+    }
+}
+
+/** Función para comprobar que un nombre de fichero no sale del directorio servido */
+static int valid_name(const char* name) {
+    if (name[0] == '\0' || name[0] == '/') {
+        return 0;
+    }
+    for (const char* p = name; *p != '\0'; ) {
+        const char* slash = strchr(p, '/');
+        size_t len = slash ? (size_t) (slash - p) : strlen(p);
+        if (len == 2 && p[0] == '.' && p[1] == '.') {
+            return 0;
+        }
+        p += len + (slash != NULL);
+    }
+    return 1;
+}
+
+/** Función para cerrar una descarga y liberar su estado */
+static void close_conn(PeerConn* conn) {
+    if (conn->fd != -1) {
+        close(conn->fd);
+    }
+    close(conn->sc);    // también la quita del epoll
+    free(conn->reply);
+    free(conn);
+}
+
+/** Función para enviar la respuesta a la petición */
+// Con MSG_MORE la respuesta sale en el mismo segmento que el principio del fichero.
+static int send_reply(PeerConn* conn, const char* data, size_t len, int more) {
+    ssize_t n = send(conn->sc, data, len, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+    // La respuesta cabe siempre en el buffer vacío del socket
+    return n == (ssize_t) len ? 0 : -1;
+}
+
+/** Función para enviar solo el resultado */
+static int send_result(PeerConn* conn, const char* result, int more) {
+    return send_reply(conn, result, strlen(result) + 1, more);
+}
+
+/** Función para preparar la respuesta con el resumen del fichero */
+// Resultado, tamaño y resumen; en GET_FILE_HASHES, también el resumen de cada trozo.
+static int build_reply(PeerConn* conn, const char* hash, const unsigned char* chunks, size_t chunkCount) {
+    size_t capacity = 64 + SHA256_HEX_SIZE;
+    if (conn->op == PEER_GET_FILE_HASHES) {
+        capacity += 48 + chunkCount * SHA256_HEX_SIZE;
+    }
+    conn->reply = malloc(capacity);
+    if (!conn->reply) {
+        perror("Error al asignar memoria para la respuesta (peer)");
+        return -1;
+    }
+    int len = snprintf(conn->reply, capacity, "%s%c%lld%c%s", GET_FILE_OK, '\0', (long long) conn->size, '\0', hash) + 1;
+    if (conn->op == PEER_GET_FILE_HASHES) {
+        len += snprintf(conn->reply + len, capacity - len, "%d%c%zu", PEER_CHUNK_SIZE, '\0', chunkCount) + 1;
+        for (size_t i = 0; i < chunkCount; i++) {
+            sha256_hex(chunks + i * SHA256_SIZE, conn->reply + len);
+            len += SHA256_HEX_SIZE;
+        }
+    }
+    conn->replyLen = len;
+    conn->replySent = 0;
+    return 0;
+}
+
+/** Función para enviar la respuesta preparada con build_reply */
+// Devuelve 0 si se ha enviado entera, 1 si el socket no admite más y -1 si falla.
+static int send_pending_reply(PeerConn* conn) {
+    while (conn->replySent < conn->replyLen) {
+        ssize_t n = send(conn->sc, conn->reply + conn->replySent, conn->replyLen - conn->replySent,
+                         MSG_NOSIGNAL | (conn->offset < conn->end ? MSG_MORE : 0));
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 1 : -1;
+        }
+        conn->replySent += n;
+    }
+    free(conn->reply);
+    conn->reply = NULL;
+    return 0;
+}
+
+/** Función del thread que calcula un resumen y lo entrega a las descargas que lo esperan */
+static void* hash_thread(void* arg) {
+    HashJob* job = arg;
+    HashEntry* entry = job->entry;
+    char hash[SHA256_HEX_SIZE];
+    unsigned char* chunks = NULL;
+    size_t chunkCount = 0;
+    int ok = sha256_file(job->fd, PEER_CHUNK_SIZE, hash, &chunks, &chunkCount) == 0;
+    close(job->fd);
+    free(job);
+
+    pthread_mutex_lock(&hashMutex);
+    PeerConn* waiters = entry->waiters;
+    entry->waiters = NULL;
+    if (ok) {
+        memcpy(entry->hash, hash, sizeof(hash));
+        free(entry->chunks);
+        entry->chunks = chunks;
+        entry->chunkCount = chunkCount;
+        entry->ready = 1;
+        // Las respuestas se preparan aquí: la lista de trozos puede cambiar al soltar el mutex
+        for (PeerConn* conn = waiters; conn != NULL; conn = conn->nextWaiter) {
+            conn->hashOk = build_reply(conn, hash, chunks, chunkCount) == 0;
+        }
+    }
+    else {
+        // Quitar la entrada para que la siguiente petición lo vuelva a intentar
+        if (!entry->superseded) {
+            HashEntry** link = &hashTable[entry->ino % HASH_BUCKETS];
+            while (*link != entry) link = &(*link)->next;
+            *link = entry->next;
+        }
+        entry->superseded = 1;
+        for (PeerConn* conn = waiters; conn != NULL; conn = conn->nextWaiter) {
+            conn->hashOk = 0;
+        }
+    }
+    if (entry->superseded) {
+        // Nadie más la encuentra: las respuestas ya están preparadas
+        free(entry->chunks);
+        free(entry);
+    }
+    pthread_mutex_unlock(&hashMutex);
+
+    // Devolver cada descarga al thread que la atiende
+    while (waiters != NULL) {
+        PeerConn* conn = waiters;
+        waiters = conn->nextWaiter;
+        PeerLoop* loop = conn->loop;
+        pthread_mutex_lock(&loop->mutex);
+        conn->nextWaiter = loop->ready;
+        loop->ready = conn;
+        pthread_mutex_unlock(&loop->mutex);
+        uint64_t one = 1;
+        if (write(loop->wakeFd, &one, sizeof(one)) == -1) {
+            perror("Error al avisar al thread de la descarga (peer)");
+        }
+    }
+    return NULL;
+}
+
+/** Función para obtener el resumen de un fichero abierto */
+// Devuelve 0 si ya estaba calculado (y la respuesta preparada), 1 si la descarga tiene que
+// esperarlo y -1 si falla.
+static int lookup_hash(PeerConn* conn, const struct stat* st) {
+    pthread_mutex_lock(&hashMutex);
+    HashEntry* entry = hashTable[st->st_ino % HASH_BUCKETS];
+    while (entry != NULL && (entry->dev != st->st_dev || entry->ino != st->st_ino)) {
+        entry = entry->next;
+    }
+    int changed = entry != NULL && (entry->size != st->st_size || entry->mtime.tv_sec != st->st_mtim.tv_sec
+                                    || entry->mtime.tv_nsec != st->st_mtim.tv_nsec);
+    if (entry != NULL && entry->ready && !changed) {
+        int err = build_reply(conn, entry->hash, entry->chunks, entry->chunkCount);
+        pthread_mutex_unlock(&hashMutex);
+        return err;
+    }
+    if (entry != NULL && !entry->ready && !changed) {
+        // Ya se está calculando: esperar al mismo resultado
+        conn->nextWaiter = entry->waiters;
+        entry->waiters = conn;
+        pthread_mutex_unlock(&hashMutex);
+        return 1;
+    }
+
+    // Calcularlo (otra vez si el fichero ha cambiado)
+    if (entry != NULL && !entry->ready) {
+        // Ha cambiado durante el cálculo en curso, que termina solo para las descargas que ya
+        // lo esperaban: esta necesita el resumen del fichero que ha visto con fstat
+        HashEntry** link = &hashTable[entry->ino % HASH_BUCKETS];
+        while (*link != entry) link = &(*link)->next;
+        *link = entry->next;
+        entry->superseded = 1;
+        entry = NULL;
+    }
+    HashJob* job = malloc(sizeof(HashJob));
+    if (entry == NULL) {
+        entry = calloc(1, sizeof(HashEntry));
+        if (entry != NULL) {
+            entry->dev = st->st_dev;
+            entry->ino = st->st_ino;
+            entry->next = hashTable[st->st_ino % HASH_BUCKETS];
+            hashTable[st->st_ino % HASH_BUCKETS] = entry;
+        }
+    }
+    if (entry == NULL || job == NULL || (job->fd = dup(conn->fd)) == -1) {
+        pthread_mutex_unlock(&hashMutex);
+        perror("Error al preparar el resumen del fichero (peer)");
+        free(job);
+        return -1;
+    }
+    entry->size = st->st_size;
+    entry->mtime = st->st_mtim;
+    entry->ready = 0;
+    entry->waiters = conn;
+    conn->nextWaiter = NULL;
+    job->entry = entry;
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int err = pthread_create(&thread, &attr, hash_thread, job);
+    pthread_attr_destroy(&attr);
+    pthread_mutex_unlock(&hashMutex);
+    if (err != 0) {
+        // Sin thread, calcularlo aquí: hash_thread entrega el resultado igual
+        hash_thread(job);
+    }
+    return 1;
+}
+
+/** Función para leer el rango de GET_FILE_RANGE: desde offset, length bytes (0 hasta el final) */
+static int parse_range(PeerConn* conn) {
+    char* end;
+    errno = 0;
+    long long offset = strtoll(conn->fields[3], &end, 10);
+    int valid = end != conn->fields[3] && *end == '\0';
+    long long length = strtoll(conn->fields[4], &end, 10);
+    valid = valid && end != conn->fields[4] && *end == '\0' && errno == 0;
+    if (!valid || offset < 0 || length < 0 || offset > conn->size) {
+        return -1;
+    }
+    conn->offset = offset;
+    if (length > 0 && length < conn->size - offset) {
+        conn->end = offset + length;
+    }
+    return 0;
+}
+
+/** Función para abrir el fichero pedido y responder a la petición */
+// Devuelve 0 si hay que enviar el fichero y -1 si la descarga ha terminado.
+static int start_transfer(PeerConn* conn) {
+    const char* fileName = conn->fields[1];
+    log_info("p> %s %s", conn->fields[0], fileName);
+
+    struct stat st;
+    if (!valid_name(fileName)) {
+        send_result(conn, GET_FILE_NOT_EXIST, 0);
+        return -1;
+    }
+    conn->fd = openat(rootFd, fileName, O_RDONLY | O_CLOEXEC);
+    if (conn->fd == -1 || fstat(conn->fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        send_result(conn, errno == ENOENT || conn->fd != -1 ? GET_FILE_NOT_EXIST : GET_FILE_FAIL, 0);
+        return -1;
+    }
+    conn->size = st.st_size;
+    conn->offset = 0;
+    conn->end = conn->size;
+    // Aviso al kernel: el fichero se va a leer de principio a fin
+    posix_fadvise(conn->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (conn->op == PEER_GET_FILE) {
+        conn->state = PEER_BODY;
+        return send_result(conn, GET_FILE_OK, conn->size > 0);
+    }
+    if (conn->op == PEER_GET_FILE_HASHES) {
+        conn->end = 0;      // solo la respuesta, sin datos
+    }
+    else if (parse_range(conn) != 0) {
+        send_result(conn, GET_FILE_BAD_RANGE, 0);
+        return -1;
+    }
+
+    int pending = lookup_hash(conn, &st);
+    if (pending == -1) {
+        send_result(conn, GET_FILE_FAIL, 0);
+        return -1;
+    }
+    conn->state = pending ? PEER_HASHING : PEER_HEADER;
+    return 0;
+}
+
+/** Función para avanzar una descarga hasta que el socket no admita más */
+// Devuelve 0 si la descarga sigue pendiente y -1 si ha terminado (y hay que cerrarla).
+static int progress(PeerConn* conn) {
+    // Leer la petición
+    while (conn->state == PEER_REQUEST) {
+        ssize_t len = readLineBuffered(&conn->reader, conn->fields[conn->fieldsRead], FIELD_SIZE);
+        if (len == -1) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        if (len == 0 && conn->reader.eof) {
+            return -1;      // el otro extremo cerró sin completar la petición
+        }
+        if (conn->fieldsRead++ == 0) {
+            // client.py envía la operación como "GET_FILE "
+            char* op = conn->fields[0];
+            while (len > 0 && op[len - 1] == ' ') {
+                op[--len] = '\0';
+            }
+            conn->fieldsCount = 0;
+            for (int i = 0; i < (int) (sizeof(operations) / sizeof(operations[0])); i++) {
+                if (strcmp(op, operations[i].name) == 0) {
+                    conn->op = i;
+                    conn->fieldsCount = operations[i].fields;
+                }
+            }
+            if (conn->fieldsCount == 0) {
+                log_info("p> operación desconocida %s", op);
+                send_result(conn, GET_FILE_FAIL, 0);
+                return -1;
+            }
+        }
+        if (conn->fieldsRead == conn->fieldsCount && start_transfer(conn) != 0) {
+            return -1;
+        }
+    }
+
+    if (conn->state == PEER_HASHING) {
+        return 0;
+    }
+    if (conn->state == PEER_HASH_FAILED) {
+        send_result(conn, GET_FILE_FAIL, 0);
+        return -1;
+    }
+    if (conn->state == PEER_HEADER) {
+        int err = send_pending_reply(conn);
+        if (err != 0) {
+            return err == 1 ? 0 : -1;
+        }
+        conn->state = PEER_BODY;
+    }
+
+    // Enviar el fichero sin pasar por el proceso
+    while (conn->offset < conn->end) {
+        ssize_t sent = sendfile(conn->sc, conn->fd, &conn->offset, conn->end - conn->offset);
+        if (sent == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            if (errno != EPIPE && errno != ECONNRESET) {
+                perror("Error en sendfile (peer)");
+            }
+            return -1;
+        }
+        if (sent == 0) {
+            break;      // el fichero se ha acortado mientras se enviaba
+        }
+    }
+    return -1;
+}
+
+/** Función para atender las descargas cuyo resumen ya se ha calculado */
+static void resume_ready(PeerLoop* loop) {
+    uint64_t count;
+    if (read(loop->wakeFd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+        perror("Error al leer el aviso de resúmenes (peer)");
+    }
+    pthread_mutex_lock(&loop->mutex);
+    PeerConn* ready = loop->ready;
+    loop->ready = NULL;
+    pthread_mutex_unlock(&loop->mutex);
+    while (ready != NULL) {
+        PeerConn* conn = ready;
+        ready = conn->nextWaiter;
+        conn->state = conn->hashOk ? PEER_HEADER : PEER_HASH_FAILED;
+        if (progress(conn) != 0) {
+            close_conn(conn);
+        }
+    }
+}
+
+/** Función de cada thread: acepta conexiones y atiende sus descargas */
+static void* peer_thread(void* arg) {
+    PeerLoop* loop = arg;
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) {
+        perror("Error en epoll_create1 (peer)");
+        return NULL;
+    }
+    struct epoll_event ev, events[MAX_EVENTS];
+    // El socket de escucha despierta a un solo thread por conexión
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = NULL;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, sd, &ev);
+    ev.events = EPOLLIN;
+    ev.data.ptr = &stopFd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, stopFd, &ev);
+    ev.events = EPOLLIN;
+    ev.data.ptr = loop;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, loop->wakeFd, &ev);
+
+    while (!terminar) {
+        int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("Error en epoll_wait (peer)");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == &stopFd) {
+                continue;
+            }
+            if (events[i].data.ptr == loop) {
+                resume_ready(loop);
+                continue;
+            }
+            if (events[i].data.ptr == NULL) {
+                // Aceptar todas las conexiones pendientes
+                for (;;) {
+                    struct sockaddr_in addr;
+                    socklen_t size = sizeof(addr);
+                    int sc = accept4(sd, (struct sockaddr*) &addr, &size, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if (sc == -1) {
+                        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                            perror("Error en accept (peer)");
+                        }
+                        break;
+                    }
+                    log_debug("Conexión aceptada de IP: %s   Puerto: %d", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+                    PeerConn* conn = calloc(1, sizeof(PeerConn));
+                    if (conn == NULL) {
+                        perror("Error al asignar memoria para la conexión (peer)");
+                        close(sc);
+                        continue;
+                    }
+                    conn->sc = sc;
+                    conn->fd = -1;
+                    conn->loop = loop;
+                    initLineReader(&conn->reader, sc);
+                    // Lectura de la petición y escritura del fichero, ambas por flanco
+                    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+                    ev.data.ptr = conn;
+                    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sc, &ev) == -1) {
+                        perror("Error en epoll_ctl (peer)");
+                        free(conn);
+                        close(sc);
+                        continue;
+                    }
+                    // La petición suele llegar junto con la conexión
+                    if (progress(conn) != 0) {
+                        close_conn(conn);
+                    }
+                }
+                continue;
+            }
+            PeerConn* conn = events[i].data.ptr;
+            if (conn->state == PEER_HASHING) {
+                continue;   // la retoma resume_ready cuando esté el resumen
+            }
+            if (progress(conn) != 0 || (events[i].events & (EPOLLERR | EPOLLHUP))) {
+                close_conn(conn);
+            }
+        }
+    }
+    close(epfd);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    int port = 0;
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char* dir = ".";
+    LogLevel level = LOG_LEVEL_INFO;
+    int syncLog = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:d:t:l:s")) != -1) {
+        switch (opt) {
+            case 'p': port = atoi(optarg); break;
+            case 'd': dir = optarg; break;
+            case 't': threads = atoi(optarg); break;
+            case 'l':
+                if (log_parse_level(optarg, &level) != 0) {
+                    fprintf(stderr, "Error: Log level must be OFF, ERROR, WARN, INFO or DEBUG\n");
+                    return -1;
+                }
+                break;
+            case 's': syncLog = 1; break;
+            default:
+                fprintf(stderr, "Usage: %s -p <port> [-d <dir>] [-t <threads>] [-l <log_level>] [-s]\n", argv[0]);
+                return -1;
+        }
+    }
+    if (port < 1024 || port > 65535) {
+        fprintf(stderr, "Error: Port must be in the range 1024 <= port <= 65535\n");
+        return -1;
+    }
+    if (threads < 1) threads = 1;
+    if (threads > MAX_PEER_THREADS) threads = MAX_PEER_THREADS;
+
+    rootFd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (rootFd == -1) {
+        perror("Error al abrir el directorio de ficheros (peer)");
+        return -1;
+    }
+    stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (stopFd == -1) {
+        perror("Error en eventfd (peer)");
+        return -1;
+    }
+    log_init(level, syncLog);
+
+    // Los threads no reciben SIGINT: lo atiende el principal, que espera en pthread_join
+    if (signal(SIGINT, signal_ctrlc) == SIG_ERR) {
+        perror("Error al registrar el manejador de señales (peer)");
+        return -1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    // Admitir tantas conexiones abiertas como permita el sistema
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max) {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+    sd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sd == -1) {
+        perror("Error al crear el socket (peer)");
+        return -1;
+    }
+    int val = 1;
+    setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(sd, (struct sockaddr*) &addr, sizeof(addr)) == -1) {
+        perror("Error en bind (peer)");
+        return -1;
+    }
+    if (listen(sd, SOMAXCONN) == -1) {
+        perror("Error en listen (peer)");
+        return -1;
+    }
+    log_info("p> init peer 0.0.0.0:%d (%s, %d threads)", port, dir, threads);
+
+    sigset_t blocked, previous;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &blocked, &previous);
+    PeerLoop loops[MAX_PEER_THREADS];
+    int started = 0;
+    for (; started < threads; started++) {
+        PeerLoop* loop = &loops[started];
+        loop->ready = NULL;
+        pthread_mutex_init(&loop->mutex, NULL);
+        loop->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (loop->wakeFd == -1 || pthread_create(&loop->thread, NULL, peer_thread, loop) != 0) {
+            perror("Error al crear el thread (peer)");
+            if (loop->wakeFd != -1) close(loop->wakeFd);
+            pthread_mutex_destroy(&loop->mutex);
+            terminar = 1;
+            break;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (terminar) {
+        uint64_t one = 1;
+        if (write(stopFd, &one, sizeof(one)) == -1) {
+            perror("Error al parar los threads (peer)");
+        }
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(loops[i].thread, NULL);
+        close(loops[i].wakeFd);
+        pthread_mutex_destroy(&loops[i].mutex);
+    }
+
+    close(sd);
+    close(stopFd);
+    close(rootFd);
+    log_destroy();
+    return 0;
+}
@@ -0,0 +1,51 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+// Códigos de operación del protocolo binario (v2)
+#define OP_REGISTER         1
+#define OP_UNREGISTER       2
+#define OP_CONNECT          3
+#define OP_DISCONNECT       4
+#define OP_PUBLISH          5
+#define OP_DELETE           6
+#define OP_LIST_USERS       7
+#define OP_LIST_CONTENT     8
+#define OP_SEARCH           9
+#define OP_SEARCH_NAME      10
+#define OP_PUBLISH_BATCH    11
+#define OP_DELETE_BATCH     12
+#define OP_STATS            13
+#define OP_PUBLISH_HASHED   14
+#define OP_SEARCH_DIGEST    15
+#define OP_COUNT            16
+
+// Tipos de los campos TLV. Las peticiones llevan dateTime y userName y después los campos
+// de la operación; las respuestas, los mismos datos que en texto salvo el resultado, que va
+// en el campo status de la cabecera. En PUBLISH_BATCH y DELETE_BATCH, TLV_COUNT indica los
+// contenidos del lote y sus campos (TLV_FILE y TLV_DESCRIPTION) se repiten en orden; en
+// PUBLISH_HASHED, TLV_COUNT indica los trozos del fichero y se repite TLV_CHUNK
+#define TLV_DATETIME        1   // cadena
+#define TLV_USER            2   // cadena
+#define TLV_IP              3   // cadena
+#define TLV_PORT            4   // entero
+#define TLV_FILE            5   // cadena
+#define TLV_DESCRIPTION     6   // cadena
+#define TLV_REMOTE_USER     7   // cadena
+#define TLV_QUERY           8   // cadena
+#define TLV_MODE            9   // cadena (PREFIX o SUBSTRING)
+#define TLV_PATTERN         10  // cadena
+#define TLV_OFFSET          11  // entero
+#define TLV_LIMIT           12  // entero
+#define TLV_COUNT           13  // entero: elementos que siguen en la respuesta
+#define TLV_TOTAL           14  // entero: coincidencias totales de SEARCH_NAME
+#define TLV_RESULT          15  // entero: resultado de cada contenido de un lote
+#define TLV_FORMAT          16  // cadena: formato de STATS (TEXT o PROMETHEUS)
+#define TLV_LINE            17  // cadena: línea del informe de STATS
+#define TLV_SIZE            18  // cadena: tamaño de un fichero en bytes (puede pasar de 32 bits)
+#define TLV_DIGEST          19  // cadena: SHA-256 de un fichero en hexadecimal
+#define TLV_CHUNK_SIZE      20  // entero: tamaño de los trozos de un fichero
+#define TLV_CHUNK           21  // cadena: SHA-256 de un trozo en hexadecimal
+
+#define STATUS_UNKNOWN_OP   0xFFFF  // status de la respuesta a un código de operación desconocido
+
+#endif
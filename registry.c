@@ -0,0 +1,586 @@
+// registry.c
+// Tabla de usuarios residente en memoria, indexada por userName.
+// La tabla se divide en REGISTRY_SHARDS particiones, cada una con su propio cerrojo de
+// lectura/escritura: las operaciones sobre usuarios de particiones distintas no compiten.
+// El llamante bloquea la partición del usuario (registry_rdlock/registry_wrlock) antes de
+// usar las funciones de la tabla, o todas las particiones para recorrerla entera.
+// Los nombres y descripciones se guardan en el pool de cadenas compartidas (strpool.c) y
+// la IP y el puerto en binario, para que cada usuario y contenido ocupe pocos bytes.
+// El resumen de un contenido (tamaño, SHA-256 del fichero y de sus trozos) es también una
+// cadena del pool: los usuarios que publican el mismo fichero comparten una sola copia.
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "registry.h"
+#include "strpool.h"
+
+#define INITIAL_BUCKETS     16
+#define INITIAL_CONTENT_SLOTS   16  // entradas iniciales del índice de contenidos de un usuario
+
+// Partición de la tabla: buckets propios protegidos por su cerrojo
+typedef struct {
+    pthread_rwlock_t lock;
+    UserNode** buckets;
+    unsigned int bucketCount;
+    int usersCount;
+} __attribute__((aligned(64))) Shard;
+
+static Shard shards[REGISTRY_SHARDS];
+// Lista doblemente enlazada en orden de registro (mismo orden que tenía users.txt). Se
+// modifica con la partición del usuario bloqueada en escritura más orderMutex, por lo que
+// es estable mientras se mantienen todas las particiones bloqueadas
+static pthread_mutex_t orderMutex = PTHREAD_MUTEX_INITIALIZER;
+static UserNode* head = NULL;
+static UserNode* tail = NULL;
+static unsigned long long nextSeq = 1;
+// Tiempo que el thread ha esperado por cerrojos ocupados de las particiones (métricas)
+static __thread unsigned long long lockWaitNs;
+
+/** Función para obtener el instante actual en ns (reloj monótono) */
+static unsigned long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/** Función hash FNV-1a del nombre de usuario (o de un fichero) */
+static unsigned int hash_name(const char* name) {
+    unsigned int h = 2166136261u;
+    while (*name) {
+        h ^= (unsigned char) *name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/** Función para obtener la partición de un hash (bits altos; los bajos eligen el bucket) */
+static Shard* shard_of(unsigned int hash) {
+    return &shards[(hash >> 24) % REGISTRY_SHARDS];
+}
+
+/** Función para duplicar el número de buckets de una partición cuando se llena */
+static int grow_buckets(Shard* shard) {
+    unsigned int newCount = shard->bucketCount * 2;
+    UserNode** newBuckets = calloc(newCount, sizeof(UserNode*));
+    if (!newBuckets) {
+        perror("Error al redimensionar la tabla de usuarios");
+        return -1;
+    }
+    // Recolocar los nodos existentes; los nodos no se mueven en memoria
+    for (unsigned int i = 0; i < shard->bucketCount; i++) {
+        UserNode* node = shard->buckets[i];
+        while (node != NULL) {
+            UserNode* next = node->bucketNext;
+            unsigned int b = node->hash & (newCount - 1);
+            node->bucketNext = newBuckets[b];
+            newBuckets[b] = node;
+            node = next;
+        }
+    }
+    free(shard->buckets);
+    shard->buckets = newBuckets;
+    shard->bucketCount = newCount;
+    return 0;
+}
+
+/** Función para inicializar la tabla de usuarios */
+int registry_init(void) {
+    for (int i = 0; i < REGISTRY_SHARDS; i++) {
+        Shard* shard = &shards[i];
+        shard->buckets = calloc(INITIAL_BUCKETS, sizeof(UserNode*));
+        if (!shard->buckets) {
+            perror("Error al asignar memoria para la tabla de usuarios");
+            return -1;
+        }
+        shard->bucketCount = INITIAL_BUCKETS;
+        shard->usersCount = 0;
+        pthread_rwlock_init(&shard->lock, NULL);
+    }
+    head = tail = NULL;
+    return 0;
+}
+
+/** Función para liberar un nodo con sus contenidos y sus referencias al pool */
+static void free_node(UserNode* node) {
+    User* user = &node->user;
+    for (int i = 0; i < user->contentsUsed; i++) {
+        strpool_release(user->contents[i].fileName);
+        strpool_release(user->contents[i].description);
+        strpool_release(user->contents[i].manifest);
+    }
+    free(user->contents);
+    free(user->contentsIndex);
+    strpool_release(user->userName);
+    free(node);
+}
+
+/** Función para liberar la tabla de usuarios */
+void registry_destroy(void) {
+    UserNode* node = head;
+    while (node != NULL) {
+        UserNode* next = node->next;
+        free_node(node);
+        node = next;
+    }
+    for (int i = 0; i < REGISTRY_SHARDS; i++) {
+        free(shards[i].buckets);
+        shards[i].buckets = NULL;
+        shards[i].bucketCount = 0;
+        shards[i].usersCount = 0;
+        pthread_rwlock_destroy(&shards[i].lock);
+    }
+    head = tail = NULL;
+}
+
+/** Función para bloquear en lectura la partición de un usuario */
+void registry_rdlock(const char* userName) {
+    pthread_rwlock_t* lock = &shard_of(hash_name(userName))->lock;
+    // Solo se mide la espera cuando el cerrojo está ocupado
+    if (pthread_rwlock_tryrdlock(lock) != 0) {
+        unsigned long long start = now_ns();
+        pthread_rwlock_rdlock(lock);
+        lockWaitNs += now_ns() - start;
+    }
+}
+
+/** Función para bloquear en escritura la partición de un usuario */
+void registry_wrlock(const char* userName) {
+    pthread_rwlock_t* lock = &shard_of(hash_name(userName))->lock;
+    if (pthread_rwlock_trywrlock(lock) != 0) {
+        unsigned long long start = now_ns();
+        pthread_rwlock_wrlock(lock);
+        lockWaitNs += now_ns() - start;
+    }
+}
+
+/** Función para obtener (y poner a 0) lo que el thread ha esperado por los cerrojos, en ns */
+unsigned long long registry_lock_wait(void) {
+    unsigned long long wait = lockWaitNs;
+    lockWaitNs = 0;
+    return wait;
+}
+
+/** Función para desbloquear la partición de un usuario */
+void registry_unlock(const char* userName) {
+    pthread_rwlock_unlock(&shard_of(hash_name(userName))->lock);
+}
+
+/** Función para bloquear en lectura todas las particiones (recorridos de la tabla completa) */
+void registry_rdlock_all(void) {
+    // Siempre en el mismo orden, para no provocar interbloqueos
+    for (int i = 0; i < REGISTRY_SHARDS; i++) {
+        pthread_rwlock_rdlock(&shards[i].lock);
+    }
+}
+
+/** Función para desbloquear todas las particiones */
+void registry_unlock_all(void) {
+    for (int i = REGISTRY_SHARDS - 1; i >= 0; i--) {
+        pthread_rwlock_unlock(&shards[i].lock);
+    }
+}
+
+/** Función para buscar el nodo de un usuario */
+static UserNode* find_node(const char* userName, unsigned int hash) {
+    Shard* shard = shard_of(hash);
+    for (UserNode* node = shard->buckets[hash & (shard->bucketCount - 1)]; node != NULL; node = node->bucketNext) {
+        if (node->hash == hash && strcmp(node->user.userName, userName) == 0) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+/** Función para buscar un usuario en la tabla, NULL si no está registrado */
+User* registry_find(const char* userName) {
+    UserNode* node = find_node(userName, hash_name(userName));
+    return node ? &node->user : NULL;
+}
+
+/** Función para registrar un usuario nuevo (DISCONNECTED), NULL si ya existe o no hay memoria */
+User* registry_insert(const char* userName) {
+    unsigned int hash = hash_name(userName);
+    if (find_node(userName, hash) != NULL) {
+        return NULL;
+    }
+    Shard* shard = shard_of(hash);
+    if ((unsigned int) shard->usersCount >= shard->bucketCount) {
+        if (grow_buckets(shard) != 0) {
+            return NULL;
+        }
+    }
+
+    UserNode* node = calloc(1, sizeof(UserNode));
+    if (!node) {
+        perror("Error al asignar memoria para el usuario");
+        return NULL;
+    }
+    node->user.userName = strpool_intern(userName);
+    if (!node->user.userName) {
+        free(node);
+        return NULL;
+    }
+    registry_set_disconnected(&node->user);
+    node->hash = hash;
+
+    // Insertar en el bucket y al final del orden de registro
+    unsigned int b = hash & (shard->bucketCount - 1);
+    node->bucketNext = shard->buckets[b];
+    shard->buckets[b] = node;
+    shard->usersCount++;
+    pthread_mutex_lock(&orderMutex);
+    node->seq = nextSeq++;
+    node->prev = tail;
+    if (tail) tail->next = node; else head = node;
+    tail = node;
+    pthread_mutex_unlock(&orderMutex);
+    return &node->user;
+}
+
+/** Función para eliminar un usuario de la tabla, -1 si no estaba registrado */
+int registry_remove(const char* userName) {
+    unsigned int hash = hash_name(userName);
+    Shard* shard = shard_of(hash);
+    UserNode** link = &shard->buckets[hash & (shard->bucketCount - 1)];
+    while (*link != NULL) {
+        UserNode* node = *link;
+        if (node->hash == hash && strcmp(node->user.userName, userName) == 0) {
+            *link = node->bucketNext;
+            shard->usersCount--;
+            pthread_mutex_lock(&orderMutex);
+            if (node->prev) node->prev->next = node->next; else head = node->next;
+            if (node->next) node->next->prev = node->prev; else tail = node->prev;
+            pthread_mutex_unlock(&orderMutex);
+            free_node(node);
+            return 0;
+        }
+        link = &node->bucketNext;
+    }
+    return -1;
+}
+
+/** Función para recorrer los usuarios en orden de registro (con todas las particiones bloqueadas) */
+UserNode* registry_first(void) {
+    return head;
+}
+
+/** Función para obtener el número de registro de un usuario (orden de LIST_USERS) */
+unsigned long long registry_seq(const User* user) {
+    // User es el primer campo del nodo
+    return ((const UserNode*) user)->seq;
+}
+
+/** Función para obtener el número de usuarios registrados (con todas las particiones bloqueadas) */
+int registry_count(void) {
+    int count = 0;
+    for (int i = 0; i < REGISTRY_SHARDS; i++) {
+        count += shards[i].usersCount;
+    }
+    return count;
+}
+
+/** Función para convertir una IP y un puerto en texto a binario, -1 si no son válidos */
+int registry_parse_addr(const char* ip, const char* port, UserAddr* addr) {
+    char* end;
+    long number = strtol(port, &end, 10);
+    if (*port == '\0' || *end != '\0' || number < 0 || number > 65535) {
+        return -1;
+    }
+    memset(addr, 0, sizeof(*addr));
+    if (inet_pton(AF_INET, ip, &addr->v4.sin_addr) == 1) {
+        addr->v4.sin_family = AF_INET;
+        addr->v4.sin_port = htons((unsigned short) number);
+        return 0;
+    }
+    if (inet_pton(AF_INET6, ip, &addr->v6.sin6_addr) == 1) {
+        addr->v6.sin6_family = AF_INET6;
+        addr->v6.sin6_port = htons((unsigned short) number);
+        return 0;
+    }
+    return -1;
+}
+
+/** Función para obtener la IP y el puerto en texto (buffers de REGISTRY_IP_LEN y REGISTRY_PORT_LEN) */
+void registry_format_addr(const UserAddr* addr, char* ip, char* port) {
+    if (addr->sa.sa_family == AF_INET6) {
+        inet_ntop(AF_INET6, &addr->v6.sin6_addr, ip, REGISTRY_IP_LEN);
+        snprintf(port, REGISTRY_PORT_LEN, "%u", ntohs(addr->v6.sin6_port));
+    } else {
+        inet_ntop(AF_INET, &addr->v4.sin_addr, ip, REGISTRY_IP_LEN);
+        snprintf(port, REGISTRY_PORT_LEN, "%u", ntohs(addr->v4.sin_port));
+    }
+}
+
+/** Función para marcar a un usuario como CONNECTED con su IP y puerto, -1 si no son válidos */
+int registry_set_connected(User* user, const char* ip, const char* port) {
+    if (registry_parse_addr(ip, port, &user->addr) != 0) {
+        return -1;
+    }
+    user->status = USER_CONNECTED;
+    return 0;
+}
+
+/** Función para marcar a un usuario como DISCONNECTED (IP 0.0.0.0 y puerto 0) */
+void registry_set_disconnected(User* user) {
+    user->status = USER_DISCONNECTED;
+    memset(&user->addr, 0, sizeof(user->addr));
+    user->addr.v4.sin_family = AF_INET;
+}
+
+/** Función para obtener la posición inicial de un fileName en el índice de contenidos */
+static unsigned int content_home(const User* user, const char* fileName) {
+    return hash_name(fileName) & (user->contentsIndexCapacity - 1);
+}
+
+/** Función para rellenar el índice de contenidos con las posiciones ocupadas de la lista */
+static void fill_content_index(User* user) {
+    unsigned int mask = user->contentsIndexCapacity - 1;
+    memset(user->contentsIndex, 0, sizeof(int) * user->contentsIndexCapacity);
+    for (int i = 0; i < user->contentsUsed; i++) {
+        if (user->contents[i].fileName == NULL) {
+            continue;
+        }
+        unsigned int slot = content_home(user, user->contents[i].fileName);
+        while (user->contentsIndex[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        user->contentsIndex[slot] = i + 1;
+    }
+}
+
+/** Función para quitar los huecos de la lista de contenidos conservando el orden */
+static void compact_contents(User* user) {
+    int count = 0;
+    for (int i = 0; i < user->contentsUsed; i++) {
+        if (user->contents[i].fileName != NULL) {
+            user->contents[count++] = user->contents[i];
+        }
+    }
+    user->contentsUsed = count;
+    if (user->contentsIndex != NULL) {
+        fill_content_index(user);
+    }
+}
+
+/** Función para buscar la entrada del índice de contenidos de un fileName, -1 si no está */
+static int find_content_slot(const User* user, const char* fileName) {
+    if (user->contentsIndex == NULL) {
+        return -1;
+    }
+    unsigned int mask = user->contentsIndexCapacity - 1;
+    for (unsigned int slot = content_home(user, fileName); user->contentsIndex[slot] != 0; slot = (slot + 1) & mask) {
+        if (strcmp(user->contents[user->contentsIndex[slot] - 1].fileName, fileName) == 0) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+/** Función para buscar un fileName en la lista de contents del usuario */
+int registry_find_content(const User* user, const char* fileName) {
+    int slot = find_content_slot(user, fileName);
+    return slot == -1 ? -1 : user->contentsIndex[slot] - 1;
+}
+
+/** Función para comprobar que un texto es un resumen SHA-256 en hexadecimal (minúsculas) */
+static int valid_digest(const char* digest, size_t len) {
+    if (len != CONTENT_DIGEST_LEN) {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (!isxdigit((unsigned char) digest[i]) || isupper((unsigned char) digest[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/** Función para leer un entero decimal no negativo, -1 si no es válido */
+static long long parse_size(const char* text, const char** end) {
+    char* stop;
+    if (!isdigit((unsigned char) *text)) {
+        return -1;
+    }
+    errno = 0;
+    long long value = strtoll(text, &stop, 10);
+    if (errno != 0) {
+        return -1;
+    }
+    if (end != NULL) {
+        *end = stop;
+    } else if (*stop != '\0') {
+        return -1;
+    }
+    return value;
+}
+
+/** Función para construir el manifest de un contenido a partir de los campos de la petición */
+// Formato: "<size> <chunkSize> <digest> <chunks>", con los resúmenes de los trozos seguidos.
+// Devuelve 0 y la cadena en *manifest (reservada con malloc), 1 si los campos no son válidos
+// (el número de trozos no corresponde al tamaño, algún resumen no es SHA-256 en hexadecimal)
+// y -1 si no hay memoria.
+int registry_make_manifest(const char* size, const char* digest, const char* chunkSize, int chunkCount,
+                           const char* const* chunks, char** manifest) {
+    long long fileSize = parse_size(size, NULL);
+    long long blockSize = parse_size(chunkSize, NULL);
+    if (fileSize < 0 || blockSize <= 0 || blockSize > INT_MAX || !valid_digest(digest, strlen(digest)) ||
+        chunkCount < 0 || chunkCount > CONTENT_MAX_CHUNKS ||
+        chunkCount != fileSize / blockSize + (fileSize % blockSize != 0)) {
+        return 1;
+    }
+    for (int i = 0; i < chunkCount; i++) {
+        if (!valid_digest(chunks[i], strlen(chunks[i]))) {
+            return 1;
+        }
+    }
+    size_t len = 64 + CONTENT_DIGEST_LEN * (chunkCount + 1);
+    char* text = malloc(len);
+    if (!text) {
+        perror("Error al asignar memoria para el resumen del contenido");
+        return -1;
+    }
+    int pos = snprintf(text, len, "%lld %lld %s ", fileSize, blockSize, digest);
+    for (int i = 0; i < chunkCount; i++) {
+        memcpy(text + pos, chunks[i], CONTENT_DIGEST_LEN);
+        pos += CONTENT_DIGEST_LEN;
+    }
+    text[pos] = '\0';
+    *manifest = text;
+    return 0;
+}
+
+/** Función para leer los campos de un manifest, -1 si no tiene el formato esperado */
+int registry_parse_manifest(const char* manifest, ContentManifest* parsed) {
+    const char* p = manifest;
+    parsed->size = parse_size(p, &p);
+    if (parsed->size < 0 || *p++ != ' ') {
+        return -1;
+    }
+    long long chunkSize = parse_size(p, &p);
+    if (chunkSize <= 0 || chunkSize > INT_MAX || *p++ != ' ' || !valid_digest(p, strnlen(p, CONTENT_DIGEST_LEN)) ||
+        p[CONTENT_DIGEST_LEN] != ' ') {
+        return -1;
+    }
+    parsed->chunkSize = chunkSize;
+    parsed->digest = p;
+    parsed->chunks = p + CONTENT_DIGEST_LEN + 1;
+    size_t chunksLen = strlen(parsed->chunks);
+    parsed->chunkCount = chunksLen / CONTENT_DIGEST_LEN;
+    if (chunksLen % CONTENT_DIGEST_LEN != 0 ||
+        parsed->chunkCount != parsed->size / chunkSize + (parsed->size % chunkSize != 0)) {
+        return -1;
+    }
+    return 0;
+}
+
+/** Función para añadir un contenido a la lista del usuario */
+// manifest es el resumen del fichero (registry_make_manifest) o NULL si se publica sin él.
+int registry_add_content(User* user, const char* fileName, const char* description, const char* manifest) {
+    if ((user->contentsCount + 1) * 2 > user->contentsIndexCapacity) {
+        // Mantener el índice como mucho a la mitad de su capacidad
+        int capacity = user->contentsIndexCapacity ? user->contentsIndexCapacity * 2 : INITIAL_CONTENT_SLOTS;
+        int* index = malloc(sizeof(int) * capacity);
+        if (!index) {
+            perror("Error al redimensionar memoria");
+            return -1;
+        }
+        free(user->contentsIndex);
+        user->contentsIndex = index;
+        user->contentsIndexCapacity = capacity;
+        fill_content_index(user);
+    }
+    if (user->contentsUsed == user->contentsCapacity) {
+        if (user->contentsUsed > user->contentsCount) {
+            compact_contents(user);
+        } else {
+            // Sí se alcanza la capacidad, reservar más memoria
+            int capacity = user->contentsCapacity ? user->contentsCapacity * 2 : 10;
+            Content* contents = realloc(user->contents, sizeof(Content) * capacity);
+            if (!contents) {
+                perror("Error al redimensionar memoria");
+                return -1;
+            }
+            user->contents = contents;
+            user->contentsCapacity = capacity;
+        }
+    }
+    // Las cadenas repetidas (descripciones, ficheros publicados por varios) se comparten
+    const char* pooledName = strpool_intern(fileName);
+    const char* pooledDescription = pooledName ? strpool_intern(description) : NULL;
+    const char* pooledManifest = manifest && pooledDescription ? strpool_intern(manifest) : NULL;
+    if (!pooledDescription || (manifest && !pooledManifest)) {
+        strpool_release(pooledName);
+        strpool_release(pooledDescription);
+        return -1;
+    }
+    int position = user->contentsUsed++;
+    Content* content = &user->contents[position];
+    content->fileName = pooledName;
+    content->description = pooledDescription;
+    content->manifest = pooledManifest;
+    user->contentsCount++;
+
+    unsigned int mask = user->contentsIndexCapacity - 1;
+    unsigned int slot = content_home(user, pooledName);
+    while (user->contentsIndex[slot] != 0) {
+        slot = (slot + 1) & mask;
+    }
+    user->contentsIndex[slot] = position + 1;
+    return 0;
+}
+
+/** Función para eliminar un contenido de la lista del usuario */
+void registry_remove_content(User* user, int index) {
+    // Quitar la entrada del índice desplazando hacia atrás las que siguen en la secuencia de
+    // sondeo, para que no queden marcas de borrado
+    unsigned int mask = user->contentsIndexCapacity - 1;
+    unsigned int hole = find_content_slot(user, user->contents[index].fileName);
+    for (unsigned int slot = (hole + 1) & mask; user->contentsIndex[slot] != 0; slot = (slot + 1) & mask) {
+        unsigned int home = content_home(user, user->contents[user->contentsIndex[slot] - 1].fileName);
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+            user->contentsIndex[hole] = user->contentsIndex[slot];
+            hole = slot;
+        }
+    }
+    user->contentsIndex[hole] = 0;
+
+    strpool_release(user->contents[index].fileName);
+    strpool_release(user->contents[index].description);
+    strpool_release(user->contents[index].manifest);
+    // Dejar un hueco para conservar el orden de publicación sin mover los demás
+    user->contents[index].fileName = NULL;
+    user->contents[index].description = NULL;
+    user->contents[index].manifest = NULL;
+    user->contentsCount--;
+    while (user->contentsUsed > 0 && user->contents[user->contentsUsed - 1].fileName == NULL) {
+        user->contentsUsed--;
+    }
+    // Compactar cuando los huecos superan a los contenidos
+    if (user->contentsUsed - user->contentsCount > user->contentsCount) {
+        compact_contents(user);
+    }
+}
+
+/** Función para eliminar de una pasada los contenidos marcados de la lista del usuario */
+// marked tiene una posición por cada una de las ocupadas (contentsUsed).
+void registry_remove_contents(User* user, const char* marked) {
+    for (int i = 0; i < user->contentsUsed; i++) {
+        if (marked[i] && user->contents[i].fileName != NULL) {
+            strpool_release(user->contents[i].fileName);
+            strpool_release(user->contents[i].description);
+            strpool_release(user->contents[i].manifest);
+            user->contents[i].fileName = NULL;
+            user->contents[i].description = NULL;
+            user->contents[i].manifest = NULL;
+            user->contentsCount--;
+        }
+    }
+    // Compactar la lista conservando el orden de publicación de los que quedan
+    compact_contents(user);
+}
@@ -0,0 +1,94 @@
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <netinet/in.h>
+
+#define REGISTRY_SHARDS     64  // particiones de la tabla, cada una con su cerrojo
+#define REGISTRY_IP_LEN     INET6_ADDRSTRLEN    // tamaño para la IP en texto
+#define REGISTRY_PORT_LEN   6                   // tamaño para el puerto en texto
+#define CONTENT_DIGEST_LEN  64      // resumen SHA-256 en hexadecimal
+#define CONTENT_MAX_CHUNKS  4096    // resúmenes de trozos de un contenido como máximo
+
+// Estado del usuario
+typedef enum {
+    USER_DISCONNECTED = 0,
+    USER_CONNECTED
+} UserStatus;
+
+// Dirección en la que el usuario atiende las descargas (IPv4 o IPv6)
+typedef union {
+    struct sockaddr sa;
+    struct sockaddr_in v4;
+    struct sockaddr_in6 v6;
+} UserAddr;
+
+// Estructura content (cadenas del pool compartido)
+typedef struct {
+    const char* fileName;
+    const char* description;
+    const char* manifest;           // resumen del fichero (registry_make_manifest), NULL si no se publicó
+} Content;
+
+// Resumen de un fichero leído de su manifest: tamaño, SHA-256 del fichero completo y de cada
+// trozo de chunkSize bytes. Los resúmenes apuntan dentro del manifest y no terminan en '\0'
+typedef struct {
+    long long size;
+    int chunkSize;
+    const char* digest;             // CONTENT_DIGEST_LEN caracteres
+    const char* chunks;             // chunkCount resúmenes de CONTENT_DIGEST_LEN caracteres seguidos
+    int chunkCount;
+} ContentManifest;
+
+// Estructura usuario
+typedef struct {
+    const char* userName;           // cadena del pool compartido
+    UserStatus status;
+    UserAddr addr;
+    // Contenidos publicados por el usuario (protegidos por su mutex de contenidos), en orden de
+    // publicación. Los eliminados quedan como huecos (fileName NULL) hasta que se compacta
+    Content* contents;
+    int contentsCount;              // contenidos publicados
+    int contentsUsed;               // posiciones ocupadas de contents, huecos incluidos
+    int contentsCapacity;
+    // Índice hash de direccionamiento abierto fileName -> posición en contents + 1 (0 libre)
+    int* contentsIndex;
+    int contentsIndexCapacity;      // potencia de 2
+} User;
+
+// Nodo de la tabla hash de usuarios (dirección estable mientras el usuario esté registrado)
+typedef struct UserNode {
+    User user;
+    unsigned int hash;
+    unsigned long long seq;         // número de registro (crece con cada REGISTER)
+    struct UserNode* bucketNext;    // siguiente nodo en el mismo bucket
+    struct UserNode* prev;          // anterior en orden de registro
+    struct UserNode* next;          // siguiente en orden de registro
+} UserNode;
+
+int registry_init(void);
+void registry_destroy(void);
+void registry_rdlock(const char* userName);
+void registry_wrlock(const char* userName);
+void registry_unlock(const char* userName);
+unsigned long long registry_lock_wait(void);
+void registry_rdlock_all(void);
+void registry_unlock_all(void);
+User* registry_find(const char* userName);
+User* registry_insert(const char* userName);
+int registry_remove(const char* userName);
+UserNode* registry_first(void);
+int registry_count(void);
+unsigned long long registry_seq(const User* user);
+int registry_parse_addr(const char* ip, const char* port, UserAddr* addr);
+void registry_format_addr(const UserAddr* addr, char* ip, char* port);
+int registry_set_connected(User* user, const char* ip, const char* port);
+void registry_set_disconnected(User* user);
+int registry_find_content(const User* user, const char* fileName);
+int registry_make_manifest(const char* size, const char* digest, const char* chunkSize, int chunkCount,
+                           const char* const* chunks, char** manifest);
+int registry_parse_manifest(const char* manifest, ContentManifest* parsed);
+int registry_add_content(User* user, const char* fileName, const char* description, const char* manifest);
+void registry_remove_content(User* user, int index);
+void registry_remove_contents(User* user, const char* marked);
+
+#endif
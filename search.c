@@ -0,0 +1,712 @@
+// search.c
+// Índice invertido de los contenidos publicados: de cada término a los contenidos que lo
+// contienen. Los términos de un contenido son su fileName exacto, las palabras (letras y
+// dígitos, en minúsculas) de su fileName y su description, y los unigramas, bigramas y
+// trigramas del fileName en minúsculas, que resuelven las búsquedas por subcadena sin
+// recorrer todos los nombres. Aparte, los contenidos se guardan ordenados por nombre en una
+// lista de bloques, en la que una búsqueda por prefijo es un rango. Los contenidos publicados con su resumen
+// tienen además como término el SHA-256 del fichero, con el que se encuentran todos los que
+// publican el mismo fichero aunque lo llamen de otra forma.
+// Se actualiza en PUBLISH, DELETE y UNREGISTER con su propio cerrojo de lectura/escritura,
+// que se bloquea después del mutex de contenidos del usuario.
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "registry.h"
+#include "search.h"
+#include "strpool.h"
+
+#define INITIAL_TERMS       1024
+#define MAX_TOKENS          256     // palabras distintas por contenido como máximo
+#define EXACT_PREFIX        '\x01'  // marca la clave del fileName exacto frente a las palabras
+#define GRAM_PREFIX         '\x02'  // marca la clave de un n-grama del nombre
+#define DIGEST_PREFIX       '\x04'  // marca la clave del resumen del fichero
+#define GRAM_SIZE           3       // n-gramas de 1 a GRAM_SIZE caracteres
+#define MAX_GRAMS           (GRAM_SIZE * 256)
+#define NAME_BLOCK          256     // contenidos por bloque de la lista ordenada por nombre
+
+// Término del índice con la lista de contenidos que lo contienen
+typedef struct SearchTerm {
+    char* key;
+    unsigned int hash;
+    SearchEntry** entries;
+    int count;
+    int capacity;
+    struct SearchTerm* next;    // siguiente término del mismo bucket
+} SearchTerm;
+
+// Bloque de la lista de contenidos ordenada por nombre
+typedef struct {
+    int count;
+    SearchEntry* entries[NAME_BLOCK];
+} NameBlock;
+
+static pthread_rwlock_t indexLock = PTHREAD_RWLOCK_INITIALIZER;
+static SearchTerm** terms = NULL;
+static unsigned int termBuckets = 0;
+static unsigned int termCount = 0;
+static NameBlock** nameBlocks = NULL;   // bloques en orden, ninguno vacío
+static int nameBlockCount = 0;
+static int nameBlockCapacity = 0;
+
+/** Función hash FNV-1a de un término */
+static unsigned int hash_key(const char* key) {
+    unsigned int h = 2166136261u;
+    while (*key) {
+        h ^= (unsigned char) *key++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/** Función para buscar un término, NULL si no está en el índice */
+static SearchTerm* find_term(const char* key, unsigned int hash) {
+    for (SearchTerm* term = terms[hash & (termBuckets - 1)]; term != NULL; term = term->next) {
+        if (term->hash == hash && strcmp(term->key, key) == 0) {
+            return term;
+        }
+    }
+    return NULL;
+}
+
+/** Función para duplicar los buckets de términos */
+static int grow_terms(void) {
+    unsigned int newBuckets = termBuckets * 2;
+    SearchTerm** newTerms = calloc(newBuckets, sizeof(SearchTerm*));
+    if (!newTerms) {
+        perror("Error al redimensionar el índice de búsqueda");
+        return -1;
+    }
+    for (unsigned int i = 0; i < termBuckets; i++) {
+        SearchTerm* term = terms[i];
+        while (term != NULL) {
+            SearchTerm* next = term->next;
+            unsigned int b = term->hash & (newBuckets - 1);
+            term->next = newTerms[b];
+            newTerms[b] = term;
+            term = next;
+        }
+    }
+    free(terms);
+    terms = newTerms;
+    termBuckets = newBuckets;
+    return 0;
+}
+
+/** Función para obtener un término, creándolo si no existe */
+static SearchTerm* get_term(const char* key) {
+    unsigned int hash = hash_key(key);
+    SearchTerm* term = find_term(key, hash);
+    if (term != NULL) {
+        return term;
+    }
+    if (termCount >= termBuckets && grow_terms() != 0) {
+        return NULL;
+    }
+    term = calloc(1, sizeof(SearchTerm));
+    if (!term || !(term->key = strdup(key))) {
+        perror("Error al asignar memoria para el índice de búsqueda");
+        free(term);
+        return NULL;
+    }
+    term->hash = hash;
+    unsigned int b = hash & (termBuckets - 1);
+    term->next = terms[b];
+    terms[b] = term;
+    termCount++;
+    return term;
+}
+
+/** Función para eliminar un término que ya no tiene contenidos */
+static void drop_term(SearchTerm* term) {
+    SearchTerm** link = &terms[term->hash & (termBuckets - 1)];
+    while (*link != term) {
+        link = &(*link)->next;
+    }
+    *link = term->next;
+    termCount--;
+    free(term->entries);
+    free(term->key);
+    free(term);
+}
+
+/** Función para añadir un contenido a la lista de un término */
+static int term_append(SearchTerm* term, SearchEntry* entry) {
+    if (term->count == term->capacity) {
+        int capacity = term->capacity ? term->capacity * 2 : 4;
+        SearchEntry** entries = realloc(term->entries, sizeof(SearchEntry*) * capacity);
+        if (!entries) {
+            perror("Error al redimensionar el índice de búsqueda");
+            return -1;
+        }
+        term->entries = entries;
+        term->capacity = capacity;
+    }
+    SearchRef* ref = &entry->refs[entry->nrefs++];
+    ref->term = term;
+    ref->pos = term->count;
+    term->entries[term->count++] = entry;
+    return 0;
+}
+
+/** Función para quitar un contenido de la lista de un término (intercambio con el último) */
+static void term_remove(SearchRef* ref) {
+    SearchTerm* term = ref->term;
+    SearchEntry* last = term->entries[--term->count];
+    if (ref->pos != term->count) {
+        term->entries[ref->pos] = last;
+        // Actualizar la posición guardada en el contenido movido
+        for (int i = 0; i < last->nrefs; i++) {
+            if (last->refs[i].term == term) {
+                last->refs[i].pos = ref->pos;
+                break;
+            }
+        }
+    }
+    if (term->count == 0) {
+        drop_term(term);
+    }
+}
+
+/** Función para separar un texto en palabras en minúsculas sin repetir */
+// Las palabras se escriben en storage separadas por '\0'; devuelve cuántas hay.
+static int tokenize(const char* text, char* storage, size_t storageLen, char** tokens, int ntokens, int max) {
+    size_t used = 0;
+    for (int t = 0; t < ntokens; t++) {
+        used += strlen(tokens[t]) + 1;
+    }
+    const char* p = text;
+    while (*p && ntokens < max) {
+        while (*p && !isalnum((unsigned char) *p)) p++;
+        if (!*p) break;
+        char* token = storage + used;
+        size_t len = 0;
+        while (isalnum((unsigned char) *p)) {
+            if (used + len + 1 < storageLen) token[len++] = tolower((unsigned char) *p);
+            p++;
+        }
+        if (used + len + 1 >= storageLen) break;
+        token[len] = '\0';
+        int repeated = 0;
+        for (int t = 0; t < ntokens && !repeated; t++) {
+            repeated = strcmp(tokens[t], token) == 0;
+        }
+        if (!repeated) {
+            tokens[ntokens++] = token;
+            used += len + 1;
+        }
+    }
+    return ntokens;
+}
+
+/** Función para escribir un fileName en minúsculas */
+static size_t lower_name(const char* fileName, char* out, size_t outLen) {
+    size_t len = 0;
+    for (const char* p = fileName; *p && len < outLen - 1; p++) {
+        out[len++] = tolower((unsigned char) *p);
+    }
+    out[len] = '\0';
+    return len;
+}
+
+/** Función para obtener los n-gramas distintos de size caracteres de un nombre en minúsculas */
+// Cada n-grama se escribe como clave (marca y size bytes) en grams[ngrams], grams[ngrams + 1]...;
+// devuelve el nuevo número de n-gramas.
+static int name_grams(const char* lower, size_t len, size_t size, char grams[][GRAM_SIZE + 2], int ngrams) {
+    for (size_t i = 0; i + size <= len; i++) {
+        // Repetido si ya aparece antes en el nombre
+        int repeated = 0;
+        for (size_t j = 0; j < i && !repeated; j++) {
+            repeated = memcmp(lower + j, lower + i, size) == 0;
+        }
+        if (!repeated) {
+            grams[ngrams][0] = GRAM_PREFIX;
+            memcpy(grams[ngrams] + 1, lower + i, size);
+            grams[ngrams][size + 1] = '\0';
+            ngrams++;
+        }
+    }
+    return ngrams;
+}
+
+/** Función para ordenar contenidos por nombre sin distinguir mayúsculas, fileName y userName */
+static int name_order(const SearchEntry* a, const SearchEntry* b) {
+    int cmp = strcasecmp(a->fileName, b->fileName);
+    if (cmp == 0) cmp = strcmp(a->fileName, b->fileName);
+    return cmp != 0 ? cmp : strcmp(a->userName, b->userName);
+}
+
+/** Función para comparar dos contenidos con name_order desde qsort */
+static int compare_names(const void* a, const void* b) {
+    return name_order(*(SearchEntry* const*) a, *(SearchEntry* const*) b);
+}
+
+/** Función para saber si un contenido va antes que otro en la lista ordenada */
+static int before_entry(const SearchEntry* entry, const void* key) {
+    return name_order(entry, key) < 0;
+}
+
+/** Función para saber si el nombre de un contenido va antes que los que empiezan por un patrón */
+static int before_prefix(const SearchEntry* entry, const void* key) {
+    const char* pattern = key;
+    return strncasecmp(entry->fileName, pattern, strlen(pattern)) < 0;
+}
+
+/** Función para buscar en la lista ordenada el primer contenido para el que before es falso */
+// Deja en *block y *pos su bloque y su posición; *block es nameBlockCount si no hay ninguno.
+static void names_lower_bound(int (*before)(const SearchEntry*, const void*), const void* key,
+                              int* block, int* pos) {
+    int lo = 0, hi = nameBlockCount;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        NameBlock* b = nameBlocks[mid];
+        if (before(b->entries[b->count - 1], key)) lo = mid + 1;
+        else hi = mid;
+    }
+    *block = lo;
+    *pos = 0;
+    if (lo == nameBlockCount) {
+        return;
+    }
+    NameBlock* b = nameBlocks[lo];
+    hi = b->count - 1;  // el último ya se sabe que no va antes
+    lo = 0;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (before(b->entries[mid], key)) lo = mid + 1;
+        else hi = mid;
+    }
+    *pos = lo;
+}
+
+/** Función para insertar un bloque vacío en la lista ordenada */
+static NameBlock* names_new_block(int block) {
+    if (nameBlockCount == nameBlockCapacity) {
+        int capacity = nameBlockCapacity ? nameBlockCapacity * 2 : 16;
+        NameBlock** blocks = realloc(nameBlocks, sizeof(NameBlock*) * capacity);
+        if (!blocks) {
+            perror("Error al redimensionar el índice de búsqueda");
+            return NULL;
+        }
+        nameBlocks = blocks;
+        nameBlockCapacity = capacity;
+    }
+    NameBlock* b = malloc(sizeof(NameBlock));
+    if (!b) {
+        perror("Error al asignar memoria para el índice de búsqueda");
+        return NULL;
+    }
+    b->count = 0;
+    memmove(&nameBlocks[block + 1], &nameBlocks[block], sizeof(NameBlock*) * (nameBlockCount - block));
+    nameBlocks[block] = b;
+    nameBlockCount++;
+    return b;
+}
+
+/** Función para añadir un contenido a la lista ordenada por nombre */
+static int names_insert(SearchEntry* entry) {
+    int block, pos;
+    names_lower_bound(before_entry, entry, &block, &pos);
+    if (block == nameBlockCount && block > 0) {
+        // Va detrás de todos: al final del último bloque
+        block--;
+        pos = nameBlocks[block]->count;
+    }
+    if (nameBlockCount == 0 && names_new_block(0) == NULL) {
+        return -1;
+    }
+    NameBlock* b = nameBlocks[block];
+    if (b->count == NAME_BLOCK) {
+        // Bloque lleno: pasar su segunda mitad a un bloque nuevo
+        NameBlock* next = names_new_block(block + 1);
+        if (next == NULL) {
+            return -1;
+        }
+        next->count = NAME_BLOCK / 2;
+        b->count = NAME_BLOCK - next->count;
+        memcpy(next->entries, &b->entries[b->count], sizeof(SearchEntry*) * next->count);
+        if (pos > b->count) {
+            pos -= b->count;
+            b = next;
+        }
+    }
+    memmove(&b->entries[pos + 1], &b->entries[pos], sizeof(SearchEntry*) * (b->count - pos));
+    b->entries[pos] = entry;
+    b->count++;
+    return 0;
+}
+
+/** Función para quitar un contenido de la lista ordenada por nombre */
+static void names_remove(SearchEntry* entry) {
+    int block, pos;
+    names_lower_bound(before_entry, entry, &block, &pos);
+    if (block == nameBlockCount || nameBlocks[block]->entries[pos] != entry) {
+        return;     // No está (no llegó a insertarse)
+    }
+    NameBlock* b = nameBlocks[block];
+    b->count--;
+    memmove(&b->entries[pos], &b->entries[pos + 1], sizeof(SearchEntry*) * (b->count - pos));
+    if (b->count == 0) {
+        free(b);
+        nameBlockCount--;
+        memmove(&nameBlocks[block], &nameBlocks[block + 1], sizeof(NameBlock*) * (nameBlockCount - block));
+    }
+}
+
+/** Función para inicializar el índice vacío */
+int search_init(void) {
+    terms = calloc(INITIAL_TERMS, sizeof(SearchTerm*));
+    if (!terms) {
+        perror("Error al asignar memoria para el índice de búsqueda");
+        return -1;
+    }
+    termBuckets = INITIAL_TERMS;
+    termCount = 0;
+    return 0;
+}
+
+/** Función para liberar un contenido del índice y sus referencias al pool */
+static void entry_free(SearchEntry* entry) {
+    strpool_release(entry->userName);
+    strpool_release(entry->fileName);
+    strpool_release(entry->manifest);
+    free(entry);
+}
+
+/** Función para liberar el índice */
+void search_destroy(void) {
+    pthread_rwlock_wrlock(&indexLock);
+    for (unsigned int i = 0; i < termBuckets; i++) {
+        SearchTerm* term = terms[i];
+        while (term != NULL) {
+            SearchTerm* next = term->next;
+            // Cada contenido está en un único término exacto y se libera desde él. Se decide por
+            // la clave del término: los demás pueden apuntar a contenidos ya liberados
+            if (term->key[0] == EXACT_PREFIX) {
+                for (int e = 0; e < term->count; e++) {
+                    entry_free(term->entries[e]);
+                }
+            }
+            free(term->entries);
+            free(term->key);
+            free(term);
+            term = next;
+        }
+    }
+    free(terms);
+    terms = NULL;
+    termBuckets = termCount = 0;
+    for (int b = 0; b < nameBlockCount; b++) {
+        free(nameBlocks[b]);
+    }
+    free(nameBlocks);
+    nameBlocks = NULL;
+    nameBlockCount = nameBlockCapacity = 0;
+    pthread_rwlock_unlock(&indexLock);
+}
+
+/** Función para añadir al índice un contenido publicado */
+// manifest es el resumen del fichero (registry_make_manifest) o NULL si se publicó sin él.
+int search_add(unsigned long long seq, const char* userName, const char* fileName, const char* description,
+               const char* manifest) {
+    // Términos: el fileName exacto, las palabras del fileName y la description y el resumen
+    char exact[258];
+    snprintf(exact, sizeof(exact), "%c%s", EXACT_PREFIX, fileName);
+    char storage[1024];
+    char* tokens[MAX_TOKENS];
+    int ntokens = tokenize(fileName, storage, sizeof(storage), tokens, 0, MAX_TOKENS);
+    ntokens = tokenize(description, storage, sizeof(storage), tokens, ntokens, MAX_TOKENS);
+    char lower[256];
+    size_t lowerLen = lower_name(fileName, lower, sizeof(lower));
+    char grams[MAX_GRAMS][GRAM_SIZE + 2];
+    int ngrams = 0;
+    for (size_t size = 1; size <= GRAM_SIZE; size++) {
+        ngrams = name_grams(lower, lowerLen, size, grams, ngrams);
+    }
+    char digest[CONTENT_DIGEST_LEN + 2] = "";
+    ContentManifest parsed;
+    if (manifest != NULL && registry_parse_manifest(manifest, &parsed) == 0) {
+        snprintf(digest, sizeof(digest), "%c%.*s", DIGEST_PREFIX, CONTENT_DIGEST_LEN, parsed.digest);
+    }
+
+    // Un único bloque con el contenido y sus referencias; las cadenas son las del pool
+    int nrefs = 1 + ntokens + ngrams + (digest[0] != '\0');
+    SearchEntry* entry = malloc(sizeof(SearchEntry) + sizeof(SearchRef) * nrefs);
+    if (!entry) {
+        perror("Error al asignar memoria para el índice de búsqueda");
+        return -1;
+    }
+    entry->seq = seq;
+    entry->nrefs = 0;
+    entry->refs = (SearchRef*) (entry + 1);
+    entry->userName = strpool_intern(userName);
+    entry->fileName = strpool_intern(fileName);
+    entry->manifest = manifest ? strpool_intern(manifest) : NULL;
+    if (!entry->userName || !entry->fileName || (manifest && !entry->manifest)) {
+        entry_free(entry);
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&indexLock);
+    SearchTerm* term = get_term(exact);
+    int err = term == NULL || term_append(term, entry) != 0;
+    for (int t = 0; t < ntokens && !err; t++) {
+        term = get_term(tokens[t]);
+        err = term == NULL || term_append(term, entry) != 0;
+    }
+    for (int g = 0; g < ngrams && !err; g++) {
+        term = get_term(grams[g]);
+        err = term == NULL || term_append(term, entry) != 0;
+    }
+    if (digest[0] != '\0' && !err) {
+        term = get_term(digest);
+        err = term == NULL || term_append(term, entry) != 0;
+    }
+    if (!err && names_insert(entry) != 0) {
+        err = 1;
+        term = NULL;
+    }
+    if (err) {
+        // Deshacer las inserciones ya hechas
+        if (term != NULL && term->count == 0) drop_term(term);
+        for (int i = entry->nrefs - 1; i >= 0; i--) {
+            term_remove(&entry->refs[i]);
+        }
+        entry_free(entry);
+    }
+    pthread_rwlock_unlock(&indexLock);
+    return err ? -1 : 0;
+}
+
+/** Función para quitar del índice un contenido de un usuario */
+void search_remove(const char* userName, const char* fileName) {
+    char exact[258];
+    snprintf(exact, sizeof(exact), "%c%s", EXACT_PREFIX, fileName);
+
+    pthread_rwlock_wrlock(&indexLock);
+    // Entre los que publican un fichero con ese nombre, buscar el del usuario
+    SearchTerm* term = find_term(exact, hash_key(exact));
+    SearchEntry* entry = NULL;
+    for (int i = 0; term != NULL && i < term->count; i++) {
+        if (strcmp(term->entries[i]->userName, userName) == 0) {
+            entry = term->entries[i];
+            break;
+        }
+    }
+    if (entry != NULL) {
+        names_remove(entry);
+        for (int i = entry->nrefs - 1; i >= 0; i--) {
+            term_remove(&entry->refs[i]);
+        }
+        entry_free(entry);
+    }
+    pthread_rwlock_unlock(&indexLock);
+}
+
+/** Función para bloquear el índice en lectura mientras se usan los resultados de una búsqueda */
+void search_rdlock(void) {
+    pthread_rwlock_rdlock(&indexLock);
+}
+
+/** Función para desbloquear el índice */
+void search_unlock(void) {
+    pthread_rwlock_unlock(&indexLock);
+}
+
+/** Función para comprobar si un contenido contiene un término */
+static int entry_has_term(const SearchEntry* entry, const SearchTerm* term) {
+    for (int i = 0; i < entry->nrefs; i++) {
+        if (entry->refs[i].term == term) return 1;
+    }
+    return 0;
+}
+
+/** Función para buscar los contenidos que coinciden con una consulta */
+// Coinciden los contenidos cuyo fileName es exactamente la consulta y los que contienen
+// todas sus palabras. Devuelve el número de resultados (en *results, que libera el llamante)
+// o -1; los resultados solo son válidos mientras se mantiene search_rdlock.
+int search_query(const char* query, SearchEntry*** results) {
+    *results = NULL;
+    char exact[258];
+    snprintf(exact, sizeof(exact), "%c%s", EXACT_PREFIX, query);
+    char storage[1024];
+    char* tokens[MAX_TOKENS];
+    int ntokens = tokenize(query, storage, sizeof(storage), tokens, 0, MAX_TOKENS);
+
+    SearchTerm* exactTerm = find_term(exact, hash_key(exact));
+    // Para las palabras se recorre la lista más corta y se comprueban las demás
+    SearchTerm* tokenTerms[MAX_TOKENS];
+    SearchTerm* shortest = NULL;
+    for (int t = 0; t < ntokens; t++) {
+        tokenTerms[t] = find_term(tokens[t], hash_key(tokens[t]));
+        if (tokenTerms[t] == NULL) {
+            ntokens = 0;    // Alguna palabra no aparece: ningún contenido las tiene todas
+            shortest = NULL;
+            break;
+        }
+        if (shortest == NULL || tokenTerms[t]->count < shortest->count) {
+            shortest = tokenTerms[t];
+        }
+    }
+
+    int capacity = (exactTerm ? exactTerm->count : 0) + (shortest ? shortest->count : 0);
+    *results = malloc(sizeof(SearchEntry*) * (capacity > 0 ? capacity : 1));
+    if (!*results) {
+        perror("Error al asignar memoria para la búsqueda");
+        return -1;
+    }
+    int count = 0;
+    for (int i = 0; exactTerm != NULL && i < exactTerm->count; i++) {
+        (*results)[count++] = exactTerm->entries[i];
+    }
+    for (int i = 0; shortest != NULL && i < shortest->count; i++) {
+        SearchEntry* entry = shortest->entries[i];
+        if (exactTerm != NULL && entry_has_term(entry, exactTerm)) {
+            continue;   // Ya incluido por el nombre exacto
+        }
+        int all = 1;
+        for (int t = 0; t < ntokens && all; t++) {
+            all = tokenTerms[t] == shortest || entry_has_term(entry, tokenTerms[t]);
+        }
+        if (all) {
+            (*results)[count++] = entry;
+        }
+    }
+    return count;
+}
+
+/** Función para comprobar si un fileName contiene un patrón en minúsculas */
+static int name_contains(const char* fileName, const char* pattern) {
+    char lower[256];
+    lower_name(fileName, lower, sizeof(lower));
+    return strstr(lower, pattern) != NULL;
+}
+
+/** Función para subir un contenido en un montículo de máximos según name_order */
+static void heap_up(SearchEntry** heap, int i) {
+    while (i > 0 && name_order(heap[(i - 1) / 2], heap[i]) < 0) {
+        SearchEntry* tmp = heap[i];
+        heap[i] = heap[(i - 1) / 2];
+        heap[(i - 1) / 2] = tmp;
+        i = (i - 1) / 2;
+    }
+}
+
+/** Función para bajar la raíz de un montículo de máximos según name_order */
+static void heap_down(SearchEntry** heap, int n) {
+    int i = 0;
+    for (;;) {
+        int largest = i;
+        int l = 2 * i + 1, r = 2 * i + 2;
+        if (l < n && name_order(heap[l], heap[largest]) > 0) largest = l;
+        if (r < n && name_order(heap[r], heap[largest]) > 0) largest = r;
+        if (largest == i) return;
+        SearchEntry* tmp = heap[i];
+        heap[i] = heap[largest];
+        heap[largest] = tmp;
+        i = largest;
+    }
+}
+
+/** Función para buscar los contenidos cuyo fileName empieza por o contiene un patrón */
+// La comparación no distingue mayúsculas y solo cuentan los contenidos para los que keep
+// devuelve distinto de 0. Deja en page, que tiene sitio para limit contenidos, los de las
+// posiciones [offset, offset + limit) en el orden de name_order, y en *total cuántos hay.
+// Un prefijo es un rango de la lista ordenada, que se recorre en orden sin ordenar nada. Para
+// una subcadena, los candidatos salen de la lista más corta entre los n-gramas del patrón
+// (para uno o dos caracteres, el propio patrón: justo los que coinciden) y solo se ordenan
+// los offset + limit primeros, en un montículo. Devuelve cuántos deja en page o -1; son
+// válidos mientras se mantiene search_rdlock.
+int search_names(const char* pattern, int prefix, search_keep_fn keep, const void* arg,
+                 int offset, int limit, SearchEntry** page, int* total) {
+    *total = 0;
+    char lower[256];
+    size_t lowerLen = lower_name(pattern, lower, sizeof(lower));
+    int returned = 0;
+
+    if (prefix) {
+        int block, pos;
+        names_lower_bound(before_prefix, lower, &block, &pos);
+        for (; block < nameBlockCount; block++, pos = 0) {
+            NameBlock* b = nameBlocks[block];
+            for (; pos < b->count; pos++) {
+                SearchEntry* entry = b->entries[pos];
+                if (strncasecmp(entry->fileName, lower, lowerLen) != 0) {
+                    return returned;    // Fin del rango
+                }
+                if (!keep(entry, arg)) continue;
+                if (*total >= offset && returned < limit) {
+                    page[returned++] = entry;
+                }
+                (*total)++;
+            }
+        }
+        return returned;
+    }
+
+    char grams[MAX_GRAMS][GRAM_SIZE + 2];
+    int ngrams = name_grams(lower, lowerLen, lowerLen < GRAM_SIZE ? lowerLen : GRAM_SIZE, grams, 0);
+    SearchTerm* shortest = NULL;
+    for (int g = 0; g < ngrams; g++) {
+        SearchTerm* term = find_term(grams[g], hash_key(grams[g]));
+        if (term == NULL) {
+            return 0;   // Algún n-grama no aparece en ningún nombre
+        }
+        if (shortest == NULL || term->count < shortest->count) {
+            shortest = term;
+        }
+    }
+    if (shortest == NULL) {
+        return 0;
+    }
+
+    // Montículo de máximos con los offset + limit primeros en orden
+    long long wanted = (long long) offset + limit;
+    int capacity = wanted < shortest->count ? (int) wanted : shortest->count;
+    SearchEntry** heap = malloc(sizeof(SearchEntry*) * (capacity > 0 ? capacity : 1));
+    if (!heap) {
+        perror("Error al asignar memoria para la búsqueda");
+        return -1;
+    }
+    int n = 0;
+    for (int i = 0; i < shortest->count; i++) {
+        SearchEntry* entry = shortest->entries[i];
+        if (!name_contains(entry->fileName, lower) || !keep(entry, arg)) continue;
+        (*total)++;
+        if (n < capacity) {
+            heap[n++] = entry;
+            heap_up(heap, n - 1);
+        } else if (capacity > 0 && name_order(entry, heap[0]) < 0) {
+            heap[0] = entry;
+            heap_down(heap, n);
+        }
+    }
+    qsort(heap, n, sizeof(SearchEntry*), compare_names);
+    for (int i = offset; i < n; i++) {
+        page[returned++] = heap[i];
+    }
+    free(heap);
+    return returned;
+}
+
+/** Función para buscar los contenidos publicados con un resumen (SHA-256 en hexadecimal) */
+// Devuelve el número de resultados (en *results, que libera el llamante) o -1, válidos
+// mientras se mantiene search_rdlock.
+int search_digest(const char* digest, SearchEntry*** results) {
+    char key[CONTENT_DIGEST_LEN + 2];
+    snprintf(key, sizeof(key), "%c%s", DIGEST_PREFIX, digest);
+    SearchTerm* term = strlen(digest) == CONTENT_DIGEST_LEN ? find_term(key, hash_key(key)) : NULL;
+    int count = term != NULL ? term->count : 0;
+    *results = malloc(sizeof(SearchEntry*) * (count > 0 ? count : 1));
+    if (!*results) {
+        perror("Error al asignar memoria para la búsqueda");
+        return -1;
+    }
+    if (count > 0) {
+        memcpy(*results, term->entries, sizeof(SearchEntry*) * count);
+    }
+    return count;
+}
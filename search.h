@@ -0,0 +1,37 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+struct SearchTerm;
+
+// Posición de un contenido en la lista de uno de sus términos
+typedef struct {
+    struct SearchTerm* term;
+    int pos;
+} SearchRef;
+
+// Contenido publicado, tal como aparece en el índice
+typedef struct {
+    unsigned long long seq;     // número de registro del usuario que lo publica
+    const char* userName;       // cadenas del pool compartido
+    const char* fileName;
+    const char* manifest;       // resumen del fichero (registry.h), NULL si se publicó sin él
+    int nrefs;
+    SearchRef* refs;            // términos del contenido (nombre exacto y palabras)
+} SearchEntry;
+
+// Filtro de los resultados de search_names: distinto de 0 si el contenido cuenta
+typedef int (*search_keep_fn)(const SearchEntry* entry, const void* arg);
+
+int search_init(void);
+void search_destroy(void);
+int search_add(unsigned long long seq, const char* userName, const char* fileName, const char* description,
+               const char* manifest);
+void search_remove(const char* userName, const char* fileName);
+void search_rdlock(void);
+void search_unlock(void);
+int search_query(const char* query, SearchEntry*** results);
+int search_names(const char* pattern, int prefix, search_keep_fn keep, const void* arg,
+                 int offset, int limit, SearchEntry** page, int* total);
+int search_digest(const char* digest, SearchEntry*** results);
+
+#endif
@@ -1,73 +1,131 @@
 // servidor.c
+#define _GNU_SOURCE     // accept4
 #include <pthread.h>
 #include <stdio.h>
-#include <dirent.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdint.h>
 #include <signal.h>
+#include <time.h>
 #include <unistd.h>
 #include <strings.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include "lines.h"
+#include "protocol.h"
+#include "registry.h"
+#include "strpool.h"
+#include "wal.h"
+#include "storage.h"
+#include "connected.h"
+#include "search.h"
+#include "metrics.h"
+#include "log.h"
 
 
 #define MAX_THREADS 	10
 #define MAX_SOCKETS 	256
-
-// Estructura usuario
-typedef struct {
-    char userName[256];
-    char status[256];
-    char ip[256];
-    char port[256];
-} User;
-
-// Estructura content
-typedef struct {
+#define MAX_FIELDS      9       // campos de la petición más larga (PUBLISH_HASHED)
+#define MAX_EVENTS      64      // eventos atendidos por cada epoll_wait
+#define MAX_BATCH       WAL_MAX_BATCH       // contenidos de un PUBLISH_BATCH/DELETE_BATCH como máximo
+// Longitud máxima de una petición en modo sesión: la más larga es un lote completo
+#define MAX_FRAME       (MAX_FIELDS * 256 + MAX_BATCH * 2 * (TLV_HEADER_SIZE + TLV_MAX_LEN))
+#define SEND_TIMEOUT    10      // segundos máximos bloqueado al enviar una respuesta
+#define SESSION_BURST   4       // peticiones de una sesión atendidas seguidas antes de ceder el thread
+#define SEARCH_LIMIT        100     // resultados por página de SEARCH_NAME si no se indica
+#define SEARCH_MAX_LIMIT    1000    // resultados por página de SEARCH_NAME como máximo
+#define SNAPSHOT_INTERVAL   60      // segundos entre snapshots si hay mutaciones
+#define SNAPSHOT_RECORDS    100000  // registros del log que fuerzan un snapshot
+
+#define MUTEX_STRIPES   256     // particiones de la tabla de mutex de contenidos
+
+// Estructura para asociar un mutex con la lista de contenidos del usuario. Solo existe
+// mientras algún thread la usa (refs > 0), así que su dirección no cambia mientras tanto
+typedef struct MutexMap {
     char fileName[256];
-    char description[256];
-} Content;
+    pthread_mutex_t mutex;
+    unsigned int hash;
+    int refs;                   // threads que tienen o esperan el mutex
+    struct MutexMap* next;      // siguiente entrada de la misma partición
+} MutexMap;
 
-// Estructura para asociar un mutex con el fichero de contenidos del usuario
+// Partición de la tabla de MutexMap, con su propio mutex
 typedef struct {
-    char fileName[256];
     pthread_mutex_t mutex;
-} MutexMap;
+    MutexMap* head;
+} __attribute__((aligned(64))) MutexStripe;
 
-// Fichero de almacenamiento de los usuarios
+// Directorio de almacenamiento (snapshot y log de mutaciones)
 const char* STORAGE_DIR = "storage";
-const char* USERS_FILE = "users.txt";
-char usersFilePath[256];
 
-// Buffer de sockets, almacena punteros a entero
-int* buffer_sockets[MAX_SOCKETS];
-
-// Mutex y variables condicionales para proteger la copia de sockets del buffer
+// Conexión de un cliente: el reactor acumula los campos de la petición hasta que está completa.
+// El primer byte decide el protocolo: '\0' inicia el saludo del protocolo binario (v2), que
+// deja la conexión abierta; cualquier otro es el código de operación en texto. En texto se
+// atiende una petición y se cierra; tras una petición SESSION queda abierta y cada petición
+// llega como una trama: longitud (4 bytes, orden de red) y campos terminados en '\0'. Las
+// respuestas de la sesión van también precedidas de su longitud. Los contenidos de un lote
+// (PUBLISH_BATCH, DELETE_BATCH) y los resúmenes de los trozos de PUBLISH_HASHED no caben en
+// fields y se acumulan en batch.
+typedef struct {
+    int sc;                         // descriptor del socket del cliente
+    LineReader reader;              // lectura por bloques del socket
+    int nfields;                    // campos completos recibidos
+    char fields[MAX_FIELDS][256];   // op, dateTime, userName y argumentos de la operación
+    int protocol;                   // 0 sin detectar, 1 texto, 2 binario (PROTOCOL_VERSION)
+    int session;                    // 1 si la conexión sigue abierta tras cada petición
+    long frameLen;                  // longitud de la trama en curso, -1 si falta la cabecera
+    unsigned char frameHeader[FRAME_HEADER_SIZE];   // cabecera de la trama en curso
+    char* frame;                    // campos de la trama en curso (crece hasta MAX_FRAME)
+    size_t frameCapacity;
+    MsgBuffer batch;                // campos de los contenidos del lote, terminados en '\0'
+    int batchFields;
+    char item[256];                 // campo del lote en curso en el protocolo de texto
+    uint32_t requestId;             // protocolo binario: identificador de la petición
+    int opcode;                     // protocolo binario: código de la operación
+    uint64_t queuedAt;              // instante en que la petición entró en el buffer (métricas)
+} Conn;
+
+// Buffer de sockets, almacena las conexiones con una petición completa
+Conn* buffer_sockets[MAX_SOCKETS];
+
+// Mutex y variables condicionales para proteger el buffer de sockets
 int n_elementos;			// elementos en el buffer de sockets
-int pos_servicio = 0;       // posición en el buffer de sockets
+int pos_servicio = 0;       // posición de lectura en el buffer de sockets
+int pos_peticion = 0;       // posición de escritura en el buffer de sockets
 pthread_mutex_t mutex;
 pthread_cond_t no_lleno;
 pthread_cond_t no_vacio;
 
 // Mutex para los threads
 pthread_mutex_t mfin;
+pthread_cond_t cfin;
 int fin=false;
 
-// Mutex para el acceso al fichero de usuarios
-pthread_mutex_t users_file_mutex;
-
-// Lista dinámica de MutexMap
-MutexMap* mutexList = NULL;
-int mutexCount = 0;
-int mutexCapacity = 10;
+// Tabla hash de MutexMap por particiones
+MutexStripe mutexStripes[MUTEX_STRIPES];
 
 // Socket del servidor
 int sd;
+// Reactor: conexiones a la espera de (más datos de) una petición
+int epfd = -1;
+
+// Respuesta en curso de cada thread del pool: su formato depende de la conexión
+static __thread const Conn* replyConn;  // conexión de la petición que se está atendiendo
+static __thread int replySent;      // ya se ha enviado la respuesta a la petición
+static __thread int replyFailed;    // no se pudo enviar: la conexión se cierra
+static __thread int replyCode;      // resultado enviado en la respuesta
+// Espera del thread por los mutex de contenidos en la petición en curso (métricas)
+static __thread unsigned long long contentWaitNs;
+// Socket del puerto local de métricas (-m), -1 si no se usa
+int statsSd = -1;
 // Variable global para controlar si se ha presionado Ctrl+C
 volatile sig_atomic_t terminar_servidor = 0;
 
@@ -77,50 +135,145 @@ void signal_ctrlc(int signal) {
         printf("\nSe ha presionado Ctrl+C. Terminando el servidor...\n");
         // Actualizar la variable global para indicar que se debe terminar el servidor
         terminar_servidor = 1;
-        // Cerrar el socket del servidor para que deje de esperar en accept
+        // Cerrar el socket del servidor para no aceptar más conexiones (epoll_wait se interrumpe)
         close(sd);
     }
 }
 
-/** Función para inicializar la mutexList */
-int init_mutex_list() {
-    // Inicializar la lista dinámica para los mutex de los ficheros de contenidos de los usuarios
-    mutexList = malloc(sizeof(MutexMap) * mutexCapacity);
-    if (!mutexList) {
-        perror("Error al asignar memoria para mutexList");
-        mutexCount = 0;
-        mutexCapacity = 0;
-        return -1;
+/** Función para inicializar la tabla de mutex de contenidos */
+void init_mutex_list() {
+    for (int i = 0; i < MUTEX_STRIPES; i++) {
+        pthread_mutex_init(&mutexStripes[i].mutex, NULL);
+        mutexStripes[i].head = NULL;
     }
-    return 0;
 }
 
-/** Función para encontrar un mutex dado un nombre de fichero */
-pthread_mutex_t* get_mutex_for_file(const char* fileName) {
-    // Buscar un mutex asociado al fichero de contenidos
-    for (int i = 0; i < mutexCount; i++) {
-        if (strcmp(mutexList[i].fileName, fileName) == 0) {
-            return &mutexList[i].mutex;
-        }
+/** Función para destruir la tabla de mutex de contenidos */
+void destroy_mutex_list() {
+    for (int i = 0; i < MUTEX_STRIPES; i++) {
+        // Sin threads en marcha no quedan entradas: se liberan al dejar de usarse
+        pthread_mutex_destroy(&mutexStripes[i].mutex);
+    }
+}
+
+/** Función hash FNV-1a de la clave de un mutex */
+unsigned int hash_key(const char* key) {
+    unsigned int h = 2166136261u;
+    while (*key) {
+        h ^= (unsigned char) *key++;
+        h *= 16777619u;
     }
+    return h;
+}
 
+/** Función para bloquear el mutex de la lista de contenidos de un usuario */
+// Devuelve la entrada con su mutex bloqueado (se suelta con unlock_mutex_for_file) o NULL
+// si no hay memoria. La entrada se crea con el primer thread que la pide.
+MutexMap* lock_mutex_for_file(const char* fileName) {
+    unsigned int hash = hash_key(fileName);
+    MutexStripe* stripe = &mutexStripes[hash % MUTEX_STRIPES];
+
+    pthread_mutex_lock(&stripe->mutex);
+    // Buscar un mutex asociado a la lista de contenidos
+    MutexMap* entry = stripe->head;
+    while (entry != NULL && (entry->hash != hash || strcmp(entry->fileName, fileName) != 0)) {
+        entry = entry->next;
+    }
     // Si no se encuentra, añadir uno nuevo
-    if (mutexCount == mutexCapacity) {
-        mutexCapacity *= 2;
-        MutexMap* newList = realloc(mutexList, sizeof(MutexMap) * mutexCapacity);
-        if (!newList) {
-            perror("Error al redimensionar memoria para mutexList");
+    if (entry == NULL) {
+        entry = malloc(sizeof(MutexMap));
+        if (!entry) {
+            perror("Error al asignar memoria para el mutex de contenidos");
+            pthread_mutex_unlock(&stripe->mutex);
             return NULL;
         }
-        mutexList = newList;
+        strncpy(entry->fileName, fileName, sizeof(entry->fileName) - 1);
+        entry->fileName[sizeof(entry->fileName) - 1] = '\0';
+        pthread_mutex_init(&entry->mutex, NULL);
+        entry->hash = hash;
+        entry->refs = 0;
+        entry->next = stripe->head;
+        stripe->head = entry;
+    }
+    // La referencia impide que la entrada se libere mientras se espera su mutex
+    entry->refs++;
+    pthread_mutex_unlock(&stripe->mutex);
+
+    // Solo se mide la espera cuando el mutex está ocupado
+    if (pthread_mutex_trylock(&entry->mutex) != 0) {
+        uint64_t start = metrics_now();
+        pthread_mutex_lock(&entry->mutex);
+        contentWaitNs += metrics_now() - start;
+    }
+    return entry;
+}
+
+/** Función para desbloquear el mutex de contenidos y liberar la entrada si nadie más la usa */
+void unlock_mutex_for_file(MutexMap* entry) {
+    MutexStripe* stripe = &mutexStripes[entry->hash % MUTEX_STRIPES];
+    pthread_mutex_lock(&stripe->mutex);
+    pthread_mutex_unlock(&entry->mutex);
+    if (--entry->refs == 0) {
+        MutexMap** link = &stripe->head;
+        while (*link != entry) {
+            link = &(*link)->next;
+        }
+        *link = entry->next;
+        pthread_mutex_destroy(&entry->mutex);
+        free(entry);
+    }
+    pthread_mutex_unlock(&stripe->mutex);
+}
+
+/** Función para enviar bloques de la respuesta a la petición en curso */
+// En modo sesión del protocolo de texto van en una trama precedida de su longitud.
+int send_replyv(int sc_local, struct iovec* iov, int iovcnt) {
+    int framed = replyConn->protocol == 1 && replyConn->session;
+    int r = framed ? sendFrameV(sc_local, iov, iovcnt) : sendMessageV(sc_local, iov, iovcnt);
+    replySent = 1;
+    if (r == -1) {
+        replyFailed = 1;
     }
+    return r;
+}
+
+/** Función para enviar la respuesta: resultado y datos ya serializados con reply_string/reply_int */
+int send_response(int sc_local, int code, const MsgBuffer* data) {
+    char text[16];
+    unsigned char header[FRAME_HEADER_SIZE];
+    struct iovec iov[2];
+    replyCode = code;
+    if (replyConn->protocol == 2) {
+        // Resultado en la cabecera, datos como campos TLV
+        FrameHeader frame = {
+            .length = data ? data->len : 0, .requestId = replyConn->requestId,
+            .opcode = replyConn->opcode, .status = code,
+        };
+        packFrameHeader(&frame, header);
+        iov[0].iov_base = header;
+        iov[0].iov_len = FRAME_HEADER_SIZE;
+    } else {
+        iov[0].iov_base = text;
+        iov[0].iov_len = sprintf(text, "%d", code) + 1;
+    }
+    iov[1].iov_base = data ? data->data : NULL;
+    iov[1].iov_len = data ? data->len : 0;
+    return send_replyv(sc_local, iov, iov[1].iov_len > 0 ? 2 : 1);
+}
+
+/** Función para enviar una respuesta que solo lleva el resultado */
+int send_result(int sc_local, int code) {
+    return send_response(sc_local, code, NULL);
+}
 
-    // Crear un nuevo mutex
-    strncpy(mutexList[mutexCount].fileName, fileName, sizeof(mutexList[mutexCount].fileName) - 1);
-    mutexList[mutexCount].fileName[sizeof(mutexList[mutexCount].fileName) - 1] = '\0';
-    pthread_mutex_init(&mutexList[mutexCount].mutex, NULL);
+/** Función para añadir una cadena a los datos de la respuesta en el formato de la conexión */
+int reply_string(MsgBuffer* msg, int type, const char* str) {
+    return replyConn->protocol == 2 ? appendTLVString(msg, type, str) : appendString(msg, str);
+}
 
-    return &mutexList[mutexCount++].mutex;
+/** Función para añadir un entero a los datos de la respuesta en el formato de la conexión */
+int reply_int(MsgBuffer* msg, int type, int num) {
+    return replyConn->protocol == 2 ? appendTLVInt32(msg, type, num) : appendInt(msg, num);
 }
 
 /** Función para obtener la IP local del servidor */
@@ -146,1024 +299,1664 @@ void obtener_ip_local(char* buffer, size_t len) {
     strncpy(buffer, inet_ntoa(*address), len);
 }
 
-/** Función para inicializar storage */
-void init_storage() {
-    // Comprobar si el directorio existe, si no crearlo
-    struct stat st = {0};
-    if (stat(STORAGE_DIR, &st) == -1) {
-        mkdir(STORAGE_DIR, 0700);
-    }
-    // Establecer la ruta del fichero de almacenamiento de los usuarios
-    snprintf(usersFilePath, sizeof(usersFilePath), "%s/%s", STORAGE_DIR, USERS_FILE);
-    // Eliminar los ficheros .txt existentes
-    DIR* dir = opendir(STORAGE_DIR);
-    if (dir == NULL) {
-        perror("Failed to open directory");
-        return;
-    }
-    struct dirent* entry;
-    while ((entry = readdir(dir)) != NULL) {
-        // Comprobar si el archivo termina en .txt
-        if (strstr(entry->d_name, ".txt") != NULL) {
-            char path[1024];
-            snprintf(path, sizeof(path), "%s/%s", STORAGE_DIR, entry->d_name);
-            remove(path);
-        }
-    }
-    closedir(dir);
-}
-
-/** Función para inicializar un fichero */
-int init_file(const char *filename) {
-    FILE* file = fopen(filename, "w");
-    if (!file) {
-        perror("Error abriendo el fichero para inicialización");
+/** Función para tomar un snapshot de la tabla de usuarios y compactar el log */
+int take_snapshot() {
+    // Empezar un nuevo fichero del log: lo anterior quedará cubierto por el snapshot
+    if (storage_rotate() != 0) {
         return -1;
     }
-    fclose(file); // Cerrar el fichero lo reinicia
-    return 0;
-}
 
-/** Función para cargar los usuarios del fichero */
-// Formato de los datos:    userName|status|ip|port
-// Ejemplo:                 lorenzo|DISCONNECTED|0.0.0.0|0
-User* load_users(const char *filename, int* count) {
-    // Abrir el fichero para lectura
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        perror("Error abriendo el fichero para lectura");
-        *count = 0;
-        return NULL;
-    }
-    // Memoria dinámica para los usuarios
-    int capacity = 10;
-    User* users = malloc(sizeof(User) * capacity);
-    if (!users) {
-        perror("Error al asignar memoria");
-        *count = 0;
-        fclose(file);
-        return NULL;
-    }
-
-    *count = 0;
-    User temp;
-    // Leer los datos del fichero y crear las estructuras User
-    while (fscanf(file, "%255[^|]|%255[^|]|%255[^|]|%255[^\n]\n", temp.userName, temp.status, temp.ip, temp.port) == 4) {
-        if (*count == capacity) {
-            // Sí se alcanza la capacidad, reservar más memoria
-            capacity *= 2;
-            User* new_users = realloc(users, sizeof(User) * capacity);
-            if (!new_users) {
-                perror("Error al redimensionar memoria");
-                free(users);
-                *count = 0;
-                fclose(file);
-                return NULL;
-            }
-            users = new_users;
+    // Copiar la tabla a una imagen compacta en memoria; la escritura en disco se hace sin mutex
+    SnapshotImage image;
+    snapshot_init(&image);
+    int err = 0;
+    registry_rdlock_all();
+    for (UserNode* node = registry_first(); node != NULL && !err; node = node->next) {
+        MutexMap* contentMutex = lock_mutex_for_file(node->user.userName);
+        if (!contentMutex) {
+            err = 1;
+            break;
         }
-        users[(*count)++] = temp;
+        err = snapshot_add_user(&image, &node->user) != 0;
+        unlock_mutex_for_file(contentMutex);
     }
+    registry_unlock_all();
 
-    fclose(file);
-    return users;
-}
-
-/** Función para guardar los usuarios en el fichero */
-int save_users(const char *filename, User* users, int count) {
-    // Abrir el fichero para lectura
-    FILE *file = fopen(filename, "w");
-    if (!file) {
-        perror("Error abriendo el fichero para escritura");
-        return -1;
-    }
-    // Escribir las estructuras User
-    for (int i = 0; i < count; i++) {
-        fprintf(file, "%s|%s|%s|%s\n", users[i].userName, users[i].status, users[i].ip, users[i].port);
+    if (!err) {
+        err = storage_checkpoint(&image) != 0;
     }
-
-    fclose(file);
-    return 0; // Éxito
+    snapshot_free(&image);
+    return err ? -1 : 0;
 }
 
-/** Función para buscar un usuario en la lista de usuarios */
-int find_user(const User* users, int count, const char* userName) {
-    // Encontrar al usuario en la lista
-    int index = -1;
-    for (int i = 0; i < count; i++) {
-        if (strcmp(users[i].userName, userName) == 0) {
-            index = i;
+/** Función ejecutada por el thread que toma snapshots periódicos */
+void* snapshotter(void* arg) {
+    time_t lastSnapshot = time(NULL);
+    pthread_mutex_lock(&mfin);
+    while (fin == false) {
+        // Esperar un segundo o hasta que se notifique la finalización
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += 1;
+        pthread_cond_timedwait(&cfin, &mfin, &deadline);
+        if (fin == true) {
             break;
         }
-    }
-    return index;
-}
+        pthread_mutex_unlock(&mfin);
 
-
-/** Función para cargar los contenidos de un usuario del fichero */
-// Formato de los datos:    fileName|description
-// Ejemplo:                 fileName|description
-Content* load_contents(const char *filename, int* count) {
-    // Abrir el fichero para lectura
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        perror("Error abriendo el fichero para lectura");
-        *count = 0;
-        return NULL;
-    }
-    // Memoria dinámica para los contenidos
-    int capacity = 10;
-    Content* contents = malloc(sizeof(Content) * capacity);
-    if (!contents) {
-        perror("Error al asignar memoria");
-        *count = 0;
-        fclose(file);
-        return NULL;
-    }
-
-    *count = 0;
-    Content temp;
-    // Leer los datos del fichero y crear las estructuras Content
-    while (fscanf(file, "%255[^|]|%255[^\n]\n", temp.fileName, temp.description) == 2) {
-        if (*count == capacity) {
-            // Sí se alcanza la capacidad, reservar más memoria
-            capacity *= 2;
-            Content* new_contents = realloc(contents, sizeof(Content) * capacity);
-            if (!new_contents) {
-                perror("Error al redimensionar memoria");
-                free(contents);
-                *count = 0;
-                fclose(file);
-                return NULL;
+        long long records = storage_log_records();
+        time_t now = time(NULL);
+        if (records >= SNAPSHOT_RECORDS || (records > 0 && now - lastSnapshot >= SNAPSHOT_INTERVAL)) {
+            if (take_snapshot() != 0) {
+                fprintf(stderr, "Error al tomar el snapshot (snapshotter)\n");
             }
-            contents = new_contents;
+            lastSnapshot = now;
         }
-        contents[(*count)++] = temp;
-    }
-
-    fclose(file);
-    return contents;
-}
 
-/** Función para guardar los contenidos de un usuario en el fichero */
-int save_contents(const char *filename, Content* contents, int count) {
-    // Abrir el fichero para lectura
-    FILE *file = fopen(filename, "w");
-    if (!file) {
-        perror("Error abriendo el fichero para escritura");
-        return -1;
-    }
-    // Escribir las estructuras Content
-    for (int i = 0; i < count; i++) {
-        fprintf(file, "%s|%s\n", contents[i].fileName, contents[i].description);
-    }
-
-    fclose(file);
-    return 0; // Éxito
-}
-
-/** Función para buscar un fileName en la lista de contents */
-int find_content(const Content* contents, int count, const char* fileName) {
-    // Encontrar el fileName en la lista
-    int index = -1;
-    for (int i = 0; i < count; i++) {
-        if (strcmp(contents[i].fileName, fileName) == 0) {
-            index = i;
-            break;
-        }
+        pthread_mutex_lock(&mfin);
     }
-    return index;
+    pthread_mutex_unlock(&mfin);
+    return NULL;
 }
 
 
 /** Servicio REGISTER */
 int register_user(const char* userName) {
-    int count;
-    // Bloqueamos el mutex para el acceso a los datos del fichero
-    pthread_mutex_lock(&users_file_mutex);
-    // Obtener los usuarios del fichero
-    User* users = load_users(usersFilePath, &count);
-    if (!users) {
-        perror("Error al cargar el fichero de usuarios");
-        pthread_mutex_unlock(&users_file_mutex); // Desbloquear al terminar con el fichero
-        return 2; // Error: no se pudo cargar el fichero de datos
-    }
-
-    // Buscar al usuario en la lista
-    int index = find_user(users, count, userName);
+    // Bloqueamos en escritura la partición de la tabla donde está el usuario
+    registry_wrlock(userName);
     // Comprobar si el usuario ya está registrado
-    if (index != -1) {
-        free(users);
-        pthread_mutex_unlock(&users_file_mutex);
+    if (registry_find(userName) != NULL) {
+        registry_unlock(userName);
         return 1;  // Usuario ya registrado
     }
 
-    // Registrar nuevo usuario
-    User new_user;
-    strncpy(new_user.userName, userName, sizeof(new_user.userName) - 1);
-    strcpy(new_user.status, "DISCONNECTED");
-    strcpy(new_user.ip, "0.0.0.0");
-    strcpy(new_user.port, "0");
-
-    // Redimensionar memoria dinámica para la nueva lista de usuarios
-    User* new_users = realloc(users, sizeof(User) * (count + 1));
-    if (!new_users) {
-        perror("Error al redimensionar memoria");
-        free(users);
-        pthread_mutex_unlock(&users_file_mutex);
-        return 2;  // Error al redimensionar memoria
-    }
-    // Actualizar el puntero users con el nuevo bloque
-    users = new_users;
-    // Añadir a la lista de usuarios
-    users[count] = new_user;
-
-    // Guardar los cambios en el fichero
-    if (save_users(usersFilePath, users, count + 1) != 0) {
-        free(users);
-        pthread_mutex_unlock(&users_file_mutex);
-        return 2; // Error al guardar los datos
+    // Registrar nuevo usuario (DISCONNECTED, 0.0.0.0, 0)
+    if (registry_insert(userName) == NULL) {
+        registry_unlock(userName);
+        return 2;  // Error al reservar memoria
     }
-    free(users);
-    pthread_mutex_unlock(&users_file_mutex);  // Desbloquear al terminar con el fichero
 
-    // Inicializar fichero de contenidos para el usuario (estructura de almacenamiento)
-    char contentsFilePath[512];
-    snprintf(contentsFilePath, sizeof(contentsFilePath), "%s/%s.txt", STORAGE_DIR, userName);
-    init_file(contentsFilePath);    // contentsFilePath = storage/userName.txt
+    // Añadir la mutación al log con la partición bloqueada para conservar el orden
+    const char* fields[] = {userName};
+    long long lsn = wal_append(WAL_REGISTER, 1, fields);
+    if (lsn < 0) {
+        registry_remove(userName);  // Deshacer el registro en memoria
+        registry_unlock(userName);
+        return 2; // Error al guardar los datos
+    }
+    registry_unlock(userName);  // Desbloquear al terminar con la tabla
 
+    // Esperar a que la mutación esté en disco (se agrupa con las de otros threads)
+    if (wal_wait(lsn) != 0) {
+        return 2; // Error al guardar los datos
+    }
     return 0;  // Éxito
 }
 
 /** Servicio UNREGISTER */
 int unregister_user(const char* userName) {
-    int count;
-    // Bloqueamos el mutex para el acceso a los datos del fichero
-    pthread_mutex_lock(&users_file_mutex);
-    // Obtener los usuarios del fichero
-    User* users = load_users(usersFilePath, &count);
-    if (!users) {
-        perror("Error al cargar el fichero de usuarios");
-        pthread_mutex_unlock(&users_file_mutex); // Desbloquear al terminar con el ficheros
-        return 2; // Error: no se pudo cargar el fichero de datos
-    }
-
-    // Buscar al usuario en la lista
-    int index = find_user(users, count, userName);
+    // Bloqueamos en escritura la partición de la tabla donde está el usuario
+    registry_wrlock(userName);
     // Comprobar si el usuario está registrado
-    if (index == -1) {
-        free(users);
-        pthread_mutex_unlock(&users_file_mutex);
+    User* user = registry_find(userName);
+    if (user == NULL) {
+        registry_unlock(userName);
         return 1; // Usuario no registrado
     }
 
-    // Eliminar al usuario de la lista moviendo los elementos restantes hacia atrás
-    memmove(&users[index], &users[index + 1], (count - index - 1) * sizeof(User));
-    count--;
+    // Esperar a que terminen las operaciones en curso sobre sus contenidos
+    MutexMap* contentMutex = lock_mutex_for_file(userName);
+    if (!contentMutex) {
+        registry_unlock(userName);
+        return 2; // Error general
+    }
+
+    // Añadir la mutación al log y eliminar al usuario de la tabla
+    const char* fields[] = {userName};
+    long long lsn = wal_append(WAL_UNREGISTER, 1, fields);
+    if (lsn >= 0) {
+        if (user->status == USER_CONNECTED) {
+            connected_remove(registry_seq(user));
+        }
+        // Quitar sus contenidos del índice de búsqueda
+        for (int i = 0; i < user->contentsUsed; i++) {
+            if (user->contents[i].fileName != NULL) search_remove(userName, user->contents[i].fileName);
+        }
+        registry_remove(userName);
+    }
+    unlock_mutex_for_file(contentMutex);
+    registry_unlock(userName);  // Desbloquear al terminar con la tabla
 
-    // Guardar los cambios en el fichero
-    if (save_users(usersFilePath, users, count) != 0) {
-        free(users);
-        pthread_mutex_unlock(&users_file_mutex);
+    if (wal_wait(lsn) != 0) {
         return 2; // Error al guardar los datos
     }
-    free(users);
-    pthread_mutex_unlock(&users_file_mutex);  // Desbloquear al terminar con el fichero
     return 0;  // Éxito
 }
 
 /** Servicio CONNECT */
 int connect_user(const char* userName, const char* ip, const char* port) {
-    int count;
-    // Bloqueamos el mutex para el acceso a los datos del fichero
-    pthread_mutex_lock(&users_file_mutex);
-    // Obtener los usuarios del fichero
-    User* users = load_users(usersFilePath, &count);
-    if (!users) {
-        perror("Error al cargar el fichero de usuarios");
-        pthread_mutex_unlock(&users_file_mutex); // Desbloquear al terminar con el fichero
-        return 3; // Error: no se pudo cargar el fichero de datos
-    }
-
-    // Encontrar al usuario en la lista
-    int index = find_user(users, count, userName);
+    // Bloqueamos en escritura la partición de la tabla donde está el usuario
+    registry_wrlock(userName);
     // Comprobar si el usuario está registrado
-    if (index == -1) {
-        free(users);
-        pthread_mutex_unlock(&users_file_mutex);
+    User* user = registry_find(userName);
+    if (user == NULL) {
+        registry_unlock(userName);
         return 1; // Usuario no registrado
     }
     // Verificar si el usuario ya está conectado
-    if (strcmp(users[index].status, "CONNECTED") == 0) {
-        free(users);
-        pthread_mutex_unlock(&users_file_mutex);
+    if (user->status == USER_CONNECTED) {
+        registry_unlock(userName);
         return 2; // Usuario ya está conectado
     }
-    // Actualizar la IP, el puerto y el estado a "CONNECTED"
-    strncpy(users[index].ip, ip, sizeof(users[index].ip) - 1);
-    users[index].ip[sizeof(users[index].ip) - 1] = '\0';  // Asegurar nul-terminación
 
-    strncpy(users[index].port, port, sizeof(users[index].port) - 1);
-    users[index].port[sizeof(users[index].port) - 1] = '\0';  // Asegurar nul-terminación
+    // Comprobar la dirección; se guarda y se anuncia en su forma canónica
+    UserAddr addr;
+    char canonicalIp[REGISTRY_IP_LEN], canonicalPort[REGISTRY_PORT_LEN];
+    if (registry_parse_addr(ip, port, &addr) != 0) {
+        registry_unlock(userName);
+        return 3; // IP o puerto no válidos
+    }
+    registry_format_addr(&addr, canonicalIp, canonicalPort);
+    ip = canonicalIp;
+    port = canonicalPort;
+
+    // Publicar una versión de la lista de conectados que lo incluya
+    if (connected_add(registry_seq(user), userName, ip, port) != 0) {
+        registry_unlock(userName);
+        return 3; // Error al reservar memoria
+    }
 
-    strcpy(users[index].status, "CONNECTED");
+    // Añadir la mutación al log y actualizar la IP, el puerto y el estado a "CONNECTED"
+    const char* fields[] = {userName, ip, port};
+    long long lsn = wal_append(WAL_CONNECT, 3, fields);
+    if (lsn < 0) {
+        connected_remove(registry_seq(user));
+        registry_unlock(userName);
+        return 3; // Error al guardar los datos
+    }
+    user->addr = addr;
+    user->status = USER_CONNECTED;
+    registry_unlock(userName);  // Desbloquear al terminar con la tabla
 
-    // Guardar los cambios en el fichero
-    if (save_users(usersFilePath, users, count) != 0) {
-        free(users);
-        pthread_mutex_unlock(&users_file_mutex);
+    if (wal_wait(lsn) != 0) {
         return 3; // Error al guardar los datos
     }
-    free(users);
-    pthread_mutex_unlock(&users_file_mutex);  // Desbloquear al terminar con el fichero
     return 0;  // Éxito
 }
 
 /** Servicio DISCONNECT */
 int disconnect_user(const char* userName) {
-    int count;
-    // Bloqueamos el mutex para el acceso a los datos del fichero
-    pthread_mutex_lock(&users_file_mutex);
-    // Obtener los usuarios del fichero
-    User* users = load_users(usersFilePath, &count);
-    if (!users) {
-        perror("Error al cargar el fichero de usuarios");
-        pthread_mutex_unlock(&users_file_mutex); // Desbloquear al terminar con el fichero
-        return 3; // Error: no se pudo cargar el fichero de datos
-    }
-
-    // Encontrar al usuario en la lista
-    int index = find_user(users, count, userName);
+    // Bloqueamos en escritura la partición de la tabla donde está el usuario
+    registry_wrlock(userName);
     // Comprobar si el usuario está registrado
-    if (index == -1) {
-        free(users);
-        pthread_mutex_unlock(&users_file_mutex);
+    User* user = registry_find(userName);
+    if (user == NULL) {
+        registry_unlock(userName);
         return 1; // Usuario no registrado
     }
     // Verificar si el usuario ya está desconectado
-    if (strcmp(users[index].status, "DISCONNECTED") == 0) {
-        free(users);
-        pthread_mutex_unlock(&users_file_mutex);
+    if (user->status == USER_DISCONNECTED) {
+        registry_unlock(userName);
         return 2; // Usuario ya está desconectado
     }
-    // Actualizar la IP, el puerto y el estado a "DISCONNECTED"
-    strcpy(users[index].status, "DISCONNECTED");
-    strcpy(users[index].ip, "0.0.0.0");
-    strcpy(users[index].port, "0");
 
-    // Guardar los cambios en el fichero
-    if (save_users(usersFilePath, users, count) != 0) {
-        free(users);
-        pthread_mutex_unlock(&users_file_mutex);
+    // Añadir la mutación al log y actualizar la IP, el puerto y el estado a "DISCONNECTED"
+    const char* fields[] = {userName};
+    long long lsn = wal_append(WAL_DISCONNECT, 1, fields);
+    if (lsn < 0) {
+        registry_unlock(userName);
+        return 3; // Error al guardar los datos
+    }
+    registry_set_disconnected(user);
+    connected_remove(registry_seq(user));
+    registry_unlock(userName);  // Desbloquear al terminar con la tabla
+
+    if (wal_wait(lsn) != 0) {
         return 3; // Error al guardar los datos
     }
-    free(users);
-    pthread_mutex_unlock(&users_file_mutex);  // Desbloquear al terminar con el fichero
     return 0;  // Éxito
 }
 
-/** Servicio PUBLISH */
-int publish_content(const char* userName, const char* fileName, const char* description) {
-    int usersCount;
-    // Bloqueamos el mutex para el acceso a los datos del fichero
-    pthread_mutex_lock(&users_file_mutex);
-    // Obtener los usuarios del fichero
-    User* users = load_users(usersFilePath, &usersCount);
-    if (!users) {
-        perror("Error al cargar el fichero de usuarios");
-        pthread_mutex_unlock(&users_file_mutex); // Desbloquear al terminar con el fichero
-        return 4; // Error: no se pudo cargar el fichero de datos
-    }
-
-    // Buscar al usuario en la lista
-    int userIndex = find_user(users, usersCount, userName);
+/** Función para bloquear la lista de contenidos de un usuario conectado */
+// Devuelve 0 con el mutex de contenidos bloqueado, o el código de error del servicio.
+// El mutex de contenidos se bloquea antes de soltar la partición del usuario para que
+// no pueda darse de baja mientras se trabaja con su lista.
+int lock_user_contents(const char* userName, User** user, MutexMap** contentMutex) {
+    // Bloqueamos en lectura la partición de la tabla donde está el usuario
+    registry_rdlock(userName);
     // Comprobar si el usuario está registrado
-    if (userIndex == -1) {
-        free(users);
-        pthread_mutex_unlock(&users_file_mutex);
+    *user = registry_find(userName);
+    if (*user == NULL) {
+        registry_unlock(userName);
         return 1;  // Usuario no registrado
     }
     // Comprobar si el usuario está conectado
-    if (strcmp(users[userIndex].status, "DISCONNECTED") == 0) {
-        free(users);
-        pthread_mutex_unlock(&users_file_mutex);
+    if ((*user)->status == USER_DISCONNECTED) {
+        registry_unlock(userName);
         return 2; // Usuario está desconectado
     }
-    // Liberar memoria y desbloquear el mutex de usuarios
-    free(users);
-    pthread_mutex_unlock(&users_file_mutex);
-
-    // Obtener el nombre del fichero de contenidos del usuario
-    char contentsFilePath[512];
-    snprintf(contentsFilePath, sizeof(contentsFilePath), "%s/%s.txt", STORAGE_DIR, userName);
 
-    // Obtener el mutex asociado al fichero de contenidos del usuario
-    pthread_mutex_t* contentMutex = get_mutex_for_file(contentsFilePath);
-    if (!contentMutex) {
-        perror("Error al obtener el mutex para el fichero de contenidos");
+    // Bloquear el mutex asociado a la lista de contenidos del usuario
+    *contentMutex = lock_mutex_for_file(userName);
+    if (!*contentMutex) {
+        registry_unlock(userName);
         return 4; // Error general
     }
+    // Desbloquear la partición
+    registry_unlock(userName);
+    return 0;
+}
 
-    // Bloquear el mutex para acceder al fichero de contenidos
-    pthread_mutex_lock(contentMutex);
+/** Función para añadir al log la publicación de un contenido con su resumen */
+// El manifest va separado en campos: tamaño, resumen, tamaño de trozo y un campo por trozo.
+long long log_publish_hashed(const char* userName, const char* fileName, const char* description,
+                             const char* manifest) {
+    ContentManifest parsed;
+    if (registry_parse_manifest(manifest, &parsed) != 0) {
+        return -1;
+    }
+    const char** fields = malloc(sizeof(char*) * (6 + parsed.chunkCount));
+    char* text = malloc(64 + (CONTENT_DIGEST_LEN + 1) * (parsed.chunkCount + 1));
+    if (!fields || !text) {
+        perror("Error al asignar memoria para el registro del log");
+        free(fields);
+        free(text);
+        return -1;
+    }
+    fields[0] = userName;
+    fields[1] = fileName;
+    fields[2] = description;
+    char* p = text;
+    fields[3] = p;
+    p += sprintf(p, "%lld", parsed.size) + 1;
+    fields[4] = p;
+    p += sprintf(p, "%.*s", CONTENT_DIGEST_LEN, parsed.digest) + 1;
+    fields[5] = p;
+    p += sprintf(p, "%d", parsed.chunkSize) + 1;
+    for (int i = 0; i < parsed.chunkCount; i++) {
+        fields[6 + i] = p;
+        p += sprintf(p, "%.*s", CONTENT_DIGEST_LEN, parsed.chunks + i * CONTENT_DIGEST_LEN) + 1;
+    }
+    long long lsn = wal_append(WAL_PUBLISH_HASHED, 6 + parsed.chunkCount, fields);
+    free(fields);
+    free(text);
+    return lsn;
+}
 
-    // Cargar la lista de contenidos
-    int contentsCount;
-    Content* contents = load_contents(contentsFilePath, &contentsCount);
-    if (!contents) {
-        perror("Error al cargar el fichero de contenidos");
-        pthread_mutex_unlock(contentMutex);
-        return 4;   // Error: no se pudo cargar el fichero de datos
+/** Servicio PUBLISH */
+// manifest es el resumen del fichero (PUBLISH_HASHED) o NULL.
+int publish_content(const char* userName, const char* fileName, const char* description, const char* manifest) {
+    User* user;
+    MutexMap* contentMutex;
+    int resultado = lock_user_contents(userName, &user, &contentMutex);
+    if (resultado != 0) {
+        return resultado;
     }
-    // Buscar el content (fileName) en la lista de contenidos
-    int contentIndex = find_content(contents, contentsCount, fileName);
+
     // Comprobar si el fichero ya está publicado
-    if (contentIndex != -1) {
-        free(contents);
-        pthread_mutex_unlock(contentMutex);
+    if (registry_find_content(user, fileName) != -1) {
+        unlock_mutex_for_file(contentMutex);
         return 3; // El fichero ya está publicado
     }
 
-    // Crear nuevo contenido
-    Content newContent;
-    strncpy(newContent.fileName, fileName, sizeof(newContent.fileName) - 1);
-    newContent.fileName[sizeof(newContent.fileName) - 1] = '\0';    // Asegurar terminación nula
-    strncpy(newContent.description, description, sizeof(newContent.description) - 1);
-    newContent.description[sizeof(newContent.description) - 1] = '\0';  // Asegurar terminación nula
-
-    // Redimensionar memoria dinámica para la nueva lista de contenidos
-    Content* new_contents = realloc(contents, sizeof(Content) * (contentsCount + 1));
-    if (!new_contents) {
-        perror("Error al redimensionar memoria");
-        free(contents);
-        pthread_mutex_unlock(contentMutex);
+    // Añadir a la lista de contenidos y al índice de búsqueda
+    if (registry_add_content(user, fileName, description, manifest) != 0) {
+        unlock_mutex_for_file(contentMutex);
         return 4;   // Error al redimensionar memoria
     }
-    // Actualizar el puntero contents con el nuevo bloque
-    contents = new_contents;
-    // Añadir a la lista de contenidos
-    contents[contentsCount] = newContent;
+    if (search_add(registry_seq(user), userName, fileName, description, manifest) != 0) {
+        registry_remove_content(user, user->contentsUsed - 1);
+        unlock_mutex_for_file(contentMutex);
+        return 4;   // Error al redimensionar memoria
+    }
+
+    // Añadir la mutación al log
+    long long lsn;
+    if (manifest == NULL) {
+        const char* fields[] = {userName, fileName, description};
+        lsn = wal_append(WAL_PUBLISH, 3, fields);
+    } else {
+        lsn = log_publish_hashed(userName, fileName, description, manifest);
+    }
+    if (lsn < 0) {
+        search_remove(userName, fileName);
+        registry_remove_content(user, user->contentsUsed - 1);
+        unlock_mutex_for_file(contentMutex);
+        return 4;   // Error al guardar los datos
+    }
+    unlock_mutex_for_file(contentMutex);  // Desbloquear al terminar con la lista
 
-    // Guardar los cambios en el fichero
-    if (save_contents(contentsFilePath, contents, contentsCount + 1) != 0) {
-        free(contents);
-        pthread_mutex_unlock(contentMutex);
+    if (wal_wait(lsn) != 0) {
         return 4;   // Error al guardar los datos
     }
-    free(contents);
-    pthread_mutex_unlock(contentMutex);  // Desbloquear al terminar con el fichero
     return 0;   // Éxito
 }
 
+/** Servicio PUBLISH_HASHED */
+// PUBLISH con el resumen del fichero: tamaño, SHA-256 del fichero, tamaño de trozo y número
+// de trozos, seguidos del SHA-256 de cada trozo. Devuelve los resultados de PUBLISH o 5 si
+// el resumen no es válido.
+int publish_hashed(const Conn* conn) {
+    int count = atoi(conn->fields[8]);
+    if (count < 0 || count > CONTENT_MAX_CHUNKS || conn->batchFields != count) {
+        return 5;   // Resumen no válido
+    }
+    const char** chunks = malloc(sizeof(char*) * (count > 0 ? count : 1));
+    if (!chunks) {
+        perror("Error al asignar memoria para el resumen del contenido");
+        return 4;
+    }
+    const char* p = conn->batch.data;
+    for (int i = 0; i < count; i++) {
+        chunks[i] = p;
+        p += strlen(p) + 1;
+    }
+    char* manifest;
+    int valid = registry_make_manifest(conn->fields[5], conn->fields[6], conn->fields[7], count, chunks, &manifest);
+    free(chunks);
+    if (valid != 0) {
+        return valid == 1 ? 5 : 4;  // Resumen no válido o error al reservar memoria
+    }
+    int resultado = publish_content(conn->fields[2], conn->fields[3], conn->fields[4], manifest);
+    free(manifest);
+    return resultado;
+}
+
 /** Servicio DELETE */
 int delete_content(const char* userName, const char* fileName) {
-    int usersCount;
-    // Bloqueamos el mutex para el acceso a los datos del fichero
-    pthread_mutex_lock(&users_file_mutex);
-    // Obtener los usuarios del fichero
-    User* users = load_users(usersFilePath, &usersCount);
-    if (!users) {
-        perror("Error al cargar el fichero de usuarios");
-        pthread_mutex_unlock(&users_file_mutex); // Desbloquear al terminar con el fichero
-        return 4; // Error: no se pudo cargar el fichero de datos
-    }
-
-    // Buscar al usuario en la lista
-    int userIndex = find_user(users, usersCount, userName);
-    // Comprobar si el usuario está registrado
-    if (userIndex == -1) {
-        free(users);
-        pthread_mutex_unlock(&users_file_mutex);
-        return 1;  // Usuario no registrado
+    User* user;
+    MutexMap* contentMutex;
+    int resultado = lock_user_contents(userName, &user, &contentMutex);
+    if (resultado != 0) {
+        return resultado;
     }
-    // Comprobar si el usuario está conectado
-    if (strcmp(users[userIndex].status, "DISCONNECTED") == 0) {
-        free(users);
-        pthread_mutex_unlock(&users_file_mutex);
-        return 2; // Usuario está desconectado
+
+    // Comprobar si el fichero ha sido publicado
+    int contentIndex = registry_find_content(user, fileName);
+    if (contentIndex == -1) {
+        unlock_mutex_for_file(contentMutex);
+        return 3; // El fichero no ha sido publicado
     }
-    // Liberar memoria y desbloquear el mutex de usuarios
-    free(users);
-    pthread_mutex_unlock(&users_file_mutex);
 
-    // Obtener el nombre del fichero de contenidos del usuario
-    char contentsFilePath[512];
-    snprintf(contentsFilePath, sizeof(contentsFilePath), "%s/%s.txt", STORAGE_DIR, userName);
+    // Añadir la mutación al log y eliminar el contenido de la lista
+    const char* fields[] = {userName, fileName};
+    long long lsn = wal_append(WAL_DELETE, 2, fields);
+    if (lsn < 0) {
+        unlock_mutex_for_file(contentMutex);
+        return 4;   // Error al guardar los datos
+    }
+    registry_remove_content(user, contentIndex);
+    search_remove(userName, fileName);
+    unlock_mutex_for_file(contentMutex);  // Desbloquear al terminar con la lista
 
-    // Obtener el mutex asociado al fichero de contenidos del usuario
-    pthread_mutex_t* contentMutex = get_mutex_for_file(contentsFilePath);
-    if (!contentMutex) {
-        perror("Error al obtener el mutex para el fichero de contenidos");
-        return 4; // Error general
+    if (wal_wait(lsn) != 0) {
+        return 4;   // Error al guardar los datos
+    }
+    return 0;   // Éxito
+}
+
+/** Servicio PUBLISH_BATCH */
+// Publica los contenidos del lote (nombre y descripción de cada uno, seguidos en items) con una
+// sola toma del mutex de contenidos y un solo registro en el log. Deja en results el resultado
+// de cada contenido: 0 publicado, 3 ya estaba publicado, 4 error.
+int publish_batch(const char* userName, int count, const char* items, int* results) {
+    User* user;
+    MutexMap* contentMutex;
+    int resultado = lock_user_contents(userName, &user, &contentMutex);
+    if (resultado != 0) {
+        return resultado;
+    }
+    // Campos del registro del log: userName y los contenidos que se lleguen a publicar
+    const char** fields = malloc(sizeof(char*) * (1 + 2 * count));
+    if (!fields) {
+        perror("Error al asignar memoria para el lote");
+        unlock_mutex_for_file(contentMutex);
+        return 4;
     }
+    int nfields = 0;
+    fields[nfields++] = userName;
 
-    // Bloquear el mutex para acceder al fichero de contenidos
-    pthread_mutex_lock(contentMutex);
+    // Añadir a la lista de contenidos y al índice de búsqueda
+    unsigned long long seq = registry_seq(user);
+    const char* p = items;
+    for (int i = 0; i < count; i++) {
+        const char* fileName = p;
+        p += strlen(p) + 1;
+        const char* description = p;
+        p += strlen(p) + 1;
+        if (registry_find_content(user, fileName) != -1) {
+            results[i] = 3;     // El fichero ya está publicado (también si se repite en el lote)
+            continue;
+        }
+        if (registry_add_content(user, fileName, description, NULL) != 0) {
+            results[i] = 4;     // Error al redimensionar memoria
+            continue;
+        }
+        if (search_add(seq, userName, fileName, description, NULL) != 0) {
+            registry_remove_content(user, user->contentsUsed - 1);
+            results[i] = 4;     // Error al redimensionar memoria
+            continue;
+        }
+        results[i] = 0;
+        fields[nfields++] = fileName;
+        fields[nfields++] = description;
+    }
 
-    // Cargar la lista de contenidos
-    int contentsCount;
-    Content* contents = load_contents(contentsFilePath, &contentsCount);
-    if (!contents) {
-        perror("Error al cargar el fichero de contenidos");
-        pthread_mutex_unlock(contentMutex);
-        return 4;   // Error: no se pudo cargar el fichero de datos
+    // Añadir todas las mutaciones al log en un solo registro
+    long long lsn = 0;
+    if (nfields > 1) {
+        lsn = wal_append(WAL_PUBLISH_BATCH, nfields, fields);
     }
-    // Buscar el content (fileName) en la lista de contenidos
-    int contentIndex = find_content(contents, contentsCount, fileName);
-    // Comprobar si el fichero ha sido publicado
-    if (contentIndex == -1) {
-        free(contents);
-        pthread_mutex_unlock(contentMutex);
-        return 3; // El fichero no ha sido publicado
+    if (lsn < 0) {
+        // Deshacer: los contenidos publicados son los últimos de la lista
+        for (int i = 1; i < nfields; i += 2) {
+            search_remove(userName, fields[i]);
+        }
+        for (int i = 1; i < nfields; i += 2) {
+            registry_remove_content(user, user->contentsUsed - 1);
+        }
+        for (int i = 0; i < count; i++) {
+            if (results[i] == 0) results[i] = 4;    // Error al guardar los datos
+        }
+    }
+    unlock_mutex_for_file(contentMutex);  // Desbloquear al terminar con la lista
+    free(fields);
+
+    if (lsn > 0 && wal_wait(lsn) != 0) {
+        return 4;   // Error al guardar los datos
+    }
+    return 0;   // Lote procesado
+}
+
+/** Servicio DELETE_BATCH */
+// Elimina los contenidos del lote (nombres seguidos en items) con una sola toma del mutex de
+// contenidos y un solo registro en el log. Deja en results el resultado de cada contenido:
+// 0 eliminado, 3 no estaba publicado, 4 error.
+int delete_batch(const char* userName, int count, const char* items, int* results) {
+    User* user;
+    MutexMap* contentMutex;
+    int resultado = lock_user_contents(userName, &user, &contentMutex);
+    if (resultado != 0) {
+        return resultado;
+    }
+    const char** fields = malloc(sizeof(char*) * (1 + count));
+    char* marked = calloc(user->contentsUsed + 1, 1);     // contenidos a eliminar
+    if (!fields || !marked) {
+        perror("Error al asignar memoria para el lote");
+        free(fields);
+        free(marked);
+        unlock_mutex_for_file(contentMutex);
+        return 4;
+    }
+    int nfields = 0;
+    fields[nfields++] = userName;
+
+    // Comprobar qué ficheros han sido publicados
+    const char* p = items;
+    for (int i = 0; i < count; i++) {
+        const char* fileName = p;
+        p += strlen(p) + 1;
+        int contentIndex = registry_find_content(user, fileName);
+        if (contentIndex == -1 || marked[contentIndex]) {
+            results[i] = 3;     // El fichero no ha sido publicado (o se repite en el lote)
+            continue;
+        }
+        marked[contentIndex] = 1;
+        results[i] = 0;
+        fields[nfields++] = fileName;
     }
 
-    // Eliminar el contenido de la lista
-    memmove(&contents[contentIndex], &contents[contentIndex + 1], (contentsCount - contentIndex - 1) * sizeof(Content));
-    contentsCount--;
+    // Añadir las mutaciones al log en un solo registro y eliminar los contenidos de la lista
+    long long lsn = 0;
+    if (nfields > 1) {
+        lsn = wal_append(WAL_DELETE_BATCH, nfields, fields);
+    }
+    if (lsn < 0) {
+        for (int i = 0; i < count; i++) {
+            if (results[i] == 0) results[i] = 4;    // Error al guardar los datos
+        }
+    } else if (nfields > 1) {
+        registry_remove_contents(user, marked);
+        for (int i = 1; i < nfields; i++) {
+            search_remove(userName, fields[i]);
+        }
+    }
+    unlock_mutex_for_file(contentMutex);  // Desbloquear al terminar con la lista
+    free(fields);
+    free(marked);
 
-    // Guardar los cambios en el fichero
-    if (save_contents(contentsFilePath, contents, contentsCount) != 0) {
-        free(contents);
-        pthread_mutex_unlock(contentMutex);
+    if (lsn > 0 && wal_wait(lsn) != 0) {
         return 4;   // Error al guardar los datos
     }
-    free(contents);
-    pthread_mutex_unlock(contentMutex);  // Desbloquear al terminar con el fichero
-    return 0;   // Éxito
+    return 0;   // Lote procesado
 }
 
-/** Servicio LIST_USERS */
-int list_users(const char* userName, int sc_local, char * buffer) {
+/** Función para atender PUBLISH_BATCH y DELETE_BATCH y enviar el resultado de cada contenido */
+int batch_service(const Conn* conn, int publish, int sc_local) {
+    const char* userName = conn->fields[2];
+    int count = atoi(conn->fields[3]);
+    int* results = NULL;
     int resultado;
-    int usersCount;
-    // Bloqueamos el mutex para el acceso a los datos del fichero
-    pthread_mutex_lock(&users_file_mutex);
-    // Obtener los usuarios del fichero
-    User* users = load_users(usersFilePath, &usersCount);
-    if (!users) {
-        perror("Error al cargar el fichero de usuarios");
-        pthread_mutex_unlock(&users_file_mutex); // Desbloquear al terminar con el fichero
-        resultado = 3; // Error: no se pudo cargar el fichero de datos
-        // Devolver el resultado al cliente por su socket
-        sprintf(buffer, "%d", resultado);
-        if (sendMessage(sc_local, buffer, strlen(buffer) + 1) == -1) {
-            perror("Error al enviar el resultado al cliente (servicio)");
-            return 3;
-        }
-        return resultado;
+    if (count <= 0 || count > MAX_BATCH || conn->batchFields != count * (publish ? 2 : 1)) {
+        resultado = 3;  // Petición incorrecta
+    } else if ((results = malloc(sizeof(int) * count)) == NULL) {
+        perror("Error al asignar memoria para el lote");
+        resultado = 4;
+    } else if (publish) {
+        resultado = publish_batch(userName, count, conn->batch.data, results);
+    } else {
+        resultado = delete_batch(userName, count, conn->batch.data, results);
+    }
+
+    // Resultado del lote y, si se ha procesado, el número de contenidos y el resultado de cada uno
+    MsgBuffer msg;
+    initMsgBuffer(&msg);
+    int error = 0;
+    for (int i = 0; resultado == 0 && i <= count && !error; i++) {
+        error = i == 0 ? reply_int(&msg, TLV_COUNT, count) : reply_int(&msg, TLV_RESULT, results[i - 1]);
+    }
+    free(results);
+    if (error) {
+        freeMsgBuffer(&msg);
+        resultado = 4;
+    }
+    if (send_response(sc_local, resultado, resultado == 0 ? &msg : NULL) == -1) {
+        freeMsgBuffer(&msg);
+        perror("Error al enviar el resultado del lote (servicio)");
+        return 4;
     }
+    freeMsgBuffer(&msg);
+    return resultado;
+}
+
+/** Servicio LIST_USERS */
+int list_users(const char* userName, int sc_local) {
+    int resultado;
+    // Bloqueamos en lectura la partición de la tabla donde está el usuario
+    registry_rdlock(userName);
 
-    // Buscar al usuario en la lista
-    int userIndex = find_user(users, usersCount, userName);
     // Comprobar si el usuario está registrado
-    if (userIndex == -1) {
-        free(users);
-        pthread_mutex_unlock(&users_file_mutex);
+    User* user = registry_find(userName);
+    if (user == NULL) {
+        registry_unlock(userName);
         resultado = 1;  // Usuario no registrado
         // Devolver el resultado al cliente por su socket
-        sprintf(buffer, "%d", resultado);
-        if (sendMessage(sc_local, buffer, strlen(buffer) + 1) == -1) {
+        if (send_result(sc_local, resultado) == -1) {
             perror("Error al enviar el resultado al cliente (servicio)");
             return 3;
         }
         return resultado;
     }
     // Comprobar si el usuario está conectado
-    if (strcmp(users[userIndex].status, "DISCONNECTED") == 0) {
-        free(users);
-        pthread_mutex_unlock(&users_file_mutex);
+    if (user->status == USER_DISCONNECTED) {
+        registry_unlock(userName);
         resultado = 2; // Usuario está desconectado
         // Devolver el resultado al cliente por su socket
-        sprintf(buffer, "%d", resultado);
-        if (sendMessage(sc_local, buffer, strlen(buffer) + 1) == -1) {
+        if (send_result(sc_local, resultado) == -1) {
             perror("Error al enviar el resultado al cliente (servicio)");
             return 3;
         }
         return resultado;
     }
 
+    registry_unlock(userName);
+
     // Usuario está registrado y conectado
     resultado = 0;
-    // Devolver el resultado al cliente por su socket
-    sprintf(buffer, "%d", resultado);
-    if (sendMessage(sc_local, buffer, strlen(buffer) + 1) == -1) {
-        free(users);
-        pthread_mutex_unlock(&users_file_mutex);
-        perror("Error al enviar el resultado al cliente (servicio)");
-        return 3;
-    }
-
-    // Contar cuántos usuarios están conectados
-    int connectedUsersCount = 0;
-    for (int i = 0; i < usersCount; i++) {
-        if (strcmp(users[i].status, "CONNECTED") == 0) {
-            connectedUsersCount++;
+    // Leer la versión actual de la lista de conectados sin bloquear a CONNECT/DISCONNECT
+    const ConnectedSet* connectedSet = connected_acquire();
+    // Respuesta ya serializada de la versión: número de usuarios y sus datos
+    const ConnectedPayload* payload = connected_payload(connectedSet, replyConn->protocol);
+    if (payload == NULL) {
+        connected_release();
+        if (send_result(sc_local, 3) == -1) {   // Error general
+            perror("Error al enviar el resultado al cliente (servicio)");
         }
-    }
-
-    // Enviar el número de usuarios conectados al cliente
-    sprintf(buffer, "%d", connectedUsersCount);
-    if (sendMessage(sc_local, buffer, strlen(buffer) + 1) == -1) {
-        free(users);
-        pthread_mutex_unlock(&users_file_mutex);
-        perror("Error al enviar el numero de usuarios conectados (servicio)");
         return 3;
     }
 
-    // Enviar datos de cada usuario conectado
-    for (int i = 0; i < usersCount; i++) {
-        if (strcmp(users[i].status, "CONNECTED") == 0) {
-            // Enviar userName
-            if (sendMessage(sc_local, users[i].userName, strlen(users[i].userName) + 1) == -1) {
-                free(users);
-                pthread_mutex_unlock(&users_file_mutex);
-                perror("Error al enviar el nombre del usuario conectado (servicio)");
-                return 3;
-            }
-            // Enviar ip
-            if (sendMessage(sc_local, users[i].ip, strlen(users[i].ip) + 1) == -1) {
-                free(users);
-                pthread_mutex_unlock(&users_file_mutex);
-                perror("Error al enviar la ip del usuariolist_users conectado (servicio)");
-                return 3;
-            }
-            // Enviar puerto
-            if (sendMessage(sc_local, users[i].port, strlen(users[i].port) + 1) == -1) {
-                free(users);
-                pthread_mutex_unlock(&users_file_mutex);
-                perror("Error al enviar el puerto del usuario conectado (servicio)");
-                return 3;
-            }
-        }
+    // Enviar la respuesta con una sola escritura; la versión no se libera hasta soltarla
+    MsgBuffer data = { .data = (char*) payload->data, .len = payload->len, .capacity = payload->len };
+    if (send_response(sc_local, resultado, &data) == -1) {
+        connected_release();
+        perror("Error al enviar la lista de usuarios conectados (servicio)");
+        return 3;
     }
-
-    // Liberar memoria y desbloquear el mutex de usuarios
-    free(users);
-    pthread_mutex_unlock(&users_file_mutex);
+    connected_release();
     return resultado;   // Éxito
 }
 
 /** Servicio LIST_CONTENT */
-int list_user_contents(const char* userName, const char* remoteUserName, int sc_local, char * buffer) {
+int list_user_contents(const char* userName, const char* remoteUserName, int sc_local) {
     int resultado;
-    int usersCount;
-    // Bloqueamos el mutex para el acceso a los datos del fichero
-    pthread_mutex_lock(&users_file_mutex);
-    // Obtener los usuarios del fichero
-    User* users = load_users(usersFilePath, &usersCount);
-    if (!users) {
-        perror("Error al cargar el fichero de usuarios");
-        pthread_mutex_unlock(&users_file_mutex); // Desbloquear al terminar con el fichero
-        resultado = 4; // Error: no se pudo cargar el fichero de datos
-        // Devolver el resultado al cliente por su socket
-        sprintf(buffer, "%d", resultado);
-        if (sendMessage(sc_local, buffer, strlen(buffer) + 1) == -1) {
-            perror("Error al enviar el resultado al cliente (servicio)");
-            return 4;
-        }
-        return resultado;
-    }
+    // Bloqueamos en lectura la partición de la tabla donde está el usuario
+    registry_rdlock(userName);
 
-    // Buscar al usuario en la lista
-    int userIndex = find_user(users, usersCount, userName);
     // Comprobar si el usuario está registrado
-    if (userIndex == -1) {
-        free(users);
-        pthread_mutex_unlock(&users_file_mutex);
+    User* user = registry_find(userName);
+    if (user == NULL) {
+        registry_unlock(userName);
         resultado = 1;  // Usuario no registrado
         // Devolver el resultado al cliente por su socket
-        sprintf(buffer, "%d", resultado);
-        if (sendMessage(sc_local, buffer, strlen(buffer) + 1) == -1) {
+        if (send_result(sc_local, resultado) == -1) {
             perror("Error al enviar el resultado al cliente (servicio)");
             return 4;
         }
         return resultado;
     }
     // Comprobar si el usuario está conectado
-    if (strcmp(users[userIndex].status, "DISCONNECTED") == 0) {
-        free(users);
-        pthread_mutex_unlock(&users_file_mutex);
+    if (user->status == USER_DISCONNECTED) {
+        registry_unlock(userName);
         resultado = 2; // Usuario está desconectado
         // Devolver el resultado al cliente por su socket
-        sprintf(buffer, "%d", resultado);
-        if (sendMessage(sc_local, buffer, strlen(buffer) + 1) == -1) {
+        if (send_result(sc_local, resultado) == -1) {
             perror("Error al enviar el resultado al cliente (servicio)");
             return 4;
         }
         return resultado;
     }
 
-    // Buscar al usuario cuyo contenido se quiere conocer en la lista
-    userIndex = find_user(users, usersCount, remoteUserName);
-    // Comprobar si el usuario está registrado
-    if (userIndex == -1) {
-        free(users);
-        pthread_mutex_unlock(&users_file_mutex);
+    registry_unlock(userName);
+
+    // Comprobar si el usuario cuyo contenido se quiere conocer está registrado (en su partición)
+    registry_rdlock(remoteUserName);
+    User* remoteUser = registry_find(remoteUserName);
+    if (remoteUser == NULL) {
+        registry_unlock(remoteUserName);
         resultado = 3;  // Usuario cuyo contenido se quiere conocer no registrado
         // Devolver el resultado al cliente por su socket
-        sprintf(buffer, "%d", resultado);
-        if (sendMessage(sc_local, buffer, strlen(buffer) + 1) == -1) {
+        if (send_result(sc_local, resultado) == -1) {
+            perror("Error al enviar el resultado al cliente (servicio)");
+            return 4;
+        }
+        return resultado;
+    }
+
+    // Bloquear el mutex de contenidos antes de soltar la partición y construir la respuesta
+    // completa, para no mantener ningún mutex mientras se escribe en el socket
+    MutexMap* contentMutex = lock_mutex_for_file(remoteUserName);
+    if (!contentMutex) {
+        registry_unlock(remoteUserName);
+        resultado = 4;  // Error general
+        if (send_result(sc_local, resultado) == -1) {
             perror("Error al enviar el resultado al cliente (servicio)");
             return 4;
         }
         return resultado;
     }
 
+    registry_unlock(remoteUserName);
     // Usuario registrado y conectado, y el usuario cuyo contenido quiere conocer está registrado
     resultado = 0;
-    // Liberar memoria y desbloquear el mutex de usuarios
-    free(users);
-    pthread_mutex_unlock(&users_file_mutex);
-    // Devolver el resultado al cliente por su socket
-    sprintf(buffer, "%d", resultado);
-    if (sendMessage(sc_local, buffer, strlen(buffer) + 1) == -1) {
-        perror("Error al enviar el resultado al cliente (servicio)");
-        return 4;
+    MsgBuffer msg;
+    initMsgBuffer(&msg);
+    // Número de contenidos y fileName y description de cada uno
+    int error = reply_int(&msg, TLV_COUNT, remoteUser->contentsCount) == -1;
+    for (int i = 0; i < remoteUser->contentsUsed && !error; i++) {
+        const Content* content = &remoteUser->contents[i];
+        if (content->fileName == NULL) {
+            continue;   // contenido eliminado
+        }
+        error = reply_string(&msg, TLV_FILE, content->fileName) == -1 ||
+                reply_string(&msg, TLV_DESCRIPTION, content->description) == -1;
     }
-
-    // Obtener el nombre del fichero de contenidos del usuario
-    char contentsFilePath[512];
-    snprintf(contentsFilePath, sizeof(contentsFilePath), "%s/%s.txt", STORAGE_DIR, remoteUserName);
-
-    // Obtener el mutex asociado al fichero de contenidos del usuario
-    pthread_mutex_t* contentMutex = get_mutex_for_file(contentsFilePath);
-    if (!contentMutex) {
-        perror("Error al obtener el mutex para el fichero de contenidos");
+    unlock_mutex_for_file(contentMutex);
+    if (error) {
+        freeMsgBuffer(&msg);
         resultado = 4;  // Error general
-        sprintf(buffer, "%d", resultado);
-        sendMessage(sc_local, buffer, strlen(buffer) + 1);
-        if (sendMessage(sc_local, buffer, strlen(buffer) + 1) == -1) {
+        if (send_result(sc_local, resultado) == -1) {
             perror("Error al enviar el resultado al cliente (servicio)");
-            return 4;
         }
         return resultado;
     }
 
-    // Bloquear el mutex para acceder al fichero de contenidos
-    pthread_mutex_lock(contentMutex);
+    // Enviar la lista de contenidos con una sola escritura
+    if (send_response(sc_local, resultado, &msg) == -1) {
+        freeMsgBuffer(&msg);
+        perror("Error al enviar la lista de contenidos (servicio)");
+        return 4;
+    }
+    freeMsgBuffer(&msg);
+    return resultado;   // Éxito
+}
+
 
-    // Cargar la lista de contenidos
-    int contentsCount;
-    Content* contents = load_contents(contentsFilePath, &contentsCount);
-    if (!contents) {
-        perror("Error al cargar el fichero de contenidos");
-        pthread_mutex_unlock(contentMutex);
-        resultado = 4; // Error: no se pudo cargar el fichero de datos
+/** Función para añadir a una respuesta de búsqueda el usuario que publica un fichero y su nombre */
+int append_publisher(MsgBuffer* msg, const ConnectedUser* publisher, const char* fileName) {
+    // userName, ip y puerto del usuario y fileName del contenido
+    return reply_string(msg, TLV_USER, publisher->userName) == -1 || reply_string(msg, TLV_IP, publisher->ip) == -1 ||
+           reply_int(msg, TLV_PORT, atoi(publisher->port)) == -1 || reply_string(msg, TLV_FILE, fileName) == -1;
+}
+
+/** Servicio SEARCH */
+int search_contents(const char* userName, const char* query, int sc_local) {
+    int resultado;
+    // Bloqueamos en lectura la partición de la tabla donde está el usuario
+    registry_rdlock(userName);
+
+    // Comprobar si el usuario está registrado y conectado
+    User* user = registry_find(userName);
+    if (user == NULL || user->status == USER_DISCONNECTED) {
+        registry_unlock(userName);
+        resultado = (user == NULL) ? 1 : 2;   // Usuario no registrado o desconectado
         // Devolver el resultado al cliente por su socket
-        sprintf(buffer, "%d", resultado);
-        if (sendMessage(sc_local, buffer, strlen(buffer) + 1) == -1) {
+        if (send_result(sc_local, resultado) == -1) {
             perror("Error al enviar el resultado al cliente (servicio)");
-            return 4;
+            return 3;
         }
         return resultado;
     }
+    registry_unlock(userName);
 
-    // Devolver al cliente el número de contenidos
-    sprintf(buffer, "%d", contentsCount);
-    if (sendMessage(sc_local, buffer, strlen(buffer) + 1) == -1) {
-        free(contents);
-        pthread_mutex_unlock(contentMutex);
-        perror("Error al enviar el numero de contenidos (servicio)");
-        return 4;
+    // Buscar en el índice y quedarse con los contenidos de usuarios conectados
+    resultado = 0;
+    MsgBuffer msg;
+    initMsgBuffer(&msg);
+    search_rdlock();
+    SearchEntry** results;
+    int count = search_query(query, &results);
+    const ConnectedSet* connectedSet = connected_acquire();
+    // Quedarse con los contenidos de usuarios conectados
+    int matches = 0;
+    for (int i = 0; i < count; i++) {
+        if (connected_find(connectedSet, results[i]->seq) != NULL) {
+            results[matches++] = results[i];
+        }
+    }
+    // Número de coincidencias y, de cada una, userName, ip y puerto del usuario y fileName
+    int error = count < 0 || reply_int(&msg, TLV_COUNT, matches) == -1;
+    for (int i = 0; i < matches && !error; i++) {
+        const ConnectedUser* publisher = connected_find(connectedSet, results[i]->seq);
+        error = append_publisher(&msg, publisher, results[i]->fileName);
+    }
+    connected_release();
+    search_unlock();
+    free(results);
+    if (error) {
+        freeMsgBuffer(&msg);
+        resultado = 3;  // Error general
+        if (send_result(sc_local, resultado) == -1) {
+            perror("Error al enviar el resultado al cliente (servicio)");
+        }
+        return resultado;
+    }
+
+    // Enviar el resultado, el número de coincidencias y sus datos con una sola escritura
+    if (send_response(sc_local, resultado, &msg) == -1) {
+        freeMsgBuffer(&msg);
+        perror("Error al enviar los resultados de la búsqueda (servicio)");
+        return 3;
     }
+    freeMsgBuffer(&msg);
+    return resultado;   // Éxito
+}
+
+
+/** Función para ordenar contenidos por fileName y userName */
+int compare_results(const void* a, const void* b) {
+    const SearchEntry* ea = *(SearchEntry* const*) a;
+    const SearchEntry* eb = *(SearchEntry* const*) b;
+    int cmp = strcmp(ea->fileName, eb->fileName);
+    return cmp != 0 ? cmp : strcmp(ea->userName, eb->userName);
+}
+
+/** Función para quedarse en SEARCH_NAME con los contenidos de usuarios conectados */
+static int publisher_connected(const SearchEntry* entry, const void* arg) {
+    return connected_find(arg, entry->seq) != NULL;
+}
 
-    // Enviar datos de cada contenido del usuario
-    for (int i = 0; i < contentsCount; i++) {
-        // Enviar fileName
-        if (sendMessage(sc_local, contents[i].fileName, strlen(contents[i].fileName) + 1) == -1) {
-            free(contents);
-            pthread_mutex_unlock(contentMutex);
-            perror("Error al enviar el fileName (servicio)");
+/** Servicio SEARCH_NAME */
+// Busca los ficheros cuyo nombre empieza por (PREFIX) o contiene (SUBSTRING) un patrón y
+// devuelve la página [offset, offset + limit) de los publicados por usuarios conectados,
+// ordenados por nombre (sin distinguir mayúsculas) y userName para que las páginas sean estables.
+int search_names_service(const char* userName, const char* mode, const char* pattern,
+                         const char* offsetStr, const char* limitStr, int sc_local) {
+    int resultado;
+    int prefix = strcmp(mode, "PREFIX") == 0;
+    int offset = atoi(offsetStr);
+    int limit = atoi(limitStr);
+    if (limit <= 0) limit = SEARCH_LIMIT;
+    if (limit > SEARCH_MAX_LIMIT) limit = SEARCH_MAX_LIMIT;
+
+    // Bloqueamos en lectura la partición de la tabla donde está el usuario
+    registry_rdlock(userName);
+
+    // Comprobar si el usuario está registrado y conectado
+    User* user = registry_find(userName);
+    if (user == NULL || user->status == USER_DISCONNECTED) {
+        registry_unlock(userName);
+        resultado = (user == NULL) ? 1 : 2;   // Usuario no registrado o desconectado
+    } else if ((!prefix && strcmp(mode, "SUBSTRING") != 0) || offset < 0 || pattern[0] == '\0') {
+        registry_unlock(userName);
+        resultado = 3;  // Petición incorrecta
+    } else {
+        registry_unlock(userName);
+        resultado = 0;
+    }
+    if (resultado != 0) {
+        // Devolver el resultado al cliente por su socket
+        if (send_result(sc_local, resultado) == -1) {
+            perror("Error al enviar el resultado al cliente (servicio)");
             return 4;
         }
-        // Enviar description
-        if (sendMessage(sc_local, contents[i].description, strlen(contents[i].description) + 1) == -1) {
-            free(contents);
-            pthread_mutex_unlock(contentMutex);
-            perror("Error al enviar description (servicio)");
-            return 4;
+        return resultado;
+    }
+
+    MsgBuffer msg;
+    initMsgBuffer(&msg);
+    SearchEntry* page[SEARCH_MAX_LIMIT];
+    int total;
+    search_rdlock();
+    const ConnectedSet* connectedSet = connected_acquire();
+    int returned = search_names(pattern, prefix, publisher_connected, connectedSet, offset, limit, page, &total);
+    // Total de coincidencias, cuántas van en esta página y los datos de cada una
+    int error = returned < 0 || reply_int(&msg, TLV_TOTAL, total) == -1 || reply_int(&msg, TLV_COUNT, returned) == -1;
+    for (int i = 0; i < returned && !error; i++) {
+        const ConnectedUser* publisher = connected_find(connectedSet, page[i]->seq);
+        error = append_publisher(&msg, publisher, page[i]->fileName);
+    }
+    connected_release();
+    search_unlock();
+    if (error) {
+        freeMsgBuffer(&msg);
+        resultado = 4;  // Error general
+        if (send_result(sc_local, resultado) == -1) {
+            perror("Error al enviar el resultado al cliente (servicio)");
         }
+        return resultado;
     }
 
-    // Liberar memoria y desbloquear el mutex del fichero de contenidos
-    free(contents);
-    pthread_mutex_unlock(contentMutex);
+    // Enviar el resultado, el total de coincidencias, cuántas van en esta página y sus datos
+    if (send_response(sc_local, resultado, &msg) == -1) {
+        freeMsgBuffer(&msg);
+        perror("Error al enviar los resultados de la búsqueda (servicio)");
+        return 4;
+    }
+    freeMsgBuffer(&msg);
     return resultado;   // Éxito
 }
 
 
-/** Función ejecutada por los threads del pool */
-void servicio(void) {
-    int sc_local;   // descriptor del socket del cliente
+/** Función para ordenar los resultados de SEARCH_DIGEST por resumen, fileName y userName */
+int compare_manifests(const void* a, const void* b) {
+    const SearchEntry* ea = *(SearchEntry* const*) a;
+    const SearchEntry* eb = *(SearchEntry* const*) b;
+    // Los manifest iguales son la misma cadena del pool: basta con comparar las direcciones
+    if (ea->manifest != eb->manifest) {
+        return (uintptr_t) ea->manifest < (uintptr_t) eb->manifest ? -1 : 1;
+    }
+    return compare_results(a, b);
+}
 
-    for(;;) {
-        pthread_mutex_lock(&mutex);
-        while (n_elementos == 0) {
-            if (fin==true) {
-                fprintf(stderr,"Finalizando servicio thread\n");
-                pthread_mutex_unlock(&mutex);
-                pthread_exit(0);
-            }
-            pthread_cond_wait(&no_vacio, &mutex);
+/** Servicio SEARCH_DIGEST */
+// Busca los contenidos con ese SHA-256 publicados por usuarios conectados, con cualquier
+// nombre. Si no todos declaran los mismos trozos, se queda con la versión que publican más
+// usuarios. Responde con el tamaño, el tamaño de trozo, el número de trozos y el resumen de
+// cada uno, y el número de usuarios seguido de userName, ip, puerto y fileName de cada uno.
+// Resultado 3 si ningún usuario conectado publica el fichero.
+int search_digest_service(const char* userName, const char* digest, int sc_local) {
+    int resultado;
+    // Bloqueamos en lectura la partición de la tabla donde está el usuario
+    registry_rdlock(userName);
+
+    // Comprobar si el usuario está registrado y conectado
+    User* user = registry_find(userName);
+    if (user == NULL || user->status == USER_DISCONNECTED) {
+        registry_unlock(userName);
+        resultado = (user == NULL) ? 1 : 2;   // Usuario no registrado o desconectado
+        if (send_result(sc_local, resultado) == -1) {
+            perror("Error al enviar el resultado al cliente (servicio)");
+            return 4;
         }
-        // Obtener el socket de un cliente del buffer
-        sc_local = *buffer_sockets[pos_servicio];
-        free(buffer_sockets[pos_servicio]); // liberar la memoria de la copia del descriptor
-        buffer_sockets[pos_servicio] = NULL; // precaución adicional
-        pos_servicio = (pos_servicio + 1) % MAX_SOCKETS;
-        n_elementos --;
-        pthread_cond_signal(&no_lleno);
-        pthread_mutex_unlock(&mutex);
+        return resultado;
+    }
+    registry_unlock(userName);
 
-        // Recibir el código de operación (op) del cliente
-        char buffer[256];
-        char op[256];
-        if (readLine(sc_local, op, sizeof(op)) == -1) {
-            perror("Error al recibir el código de operación en readLine (servicio)");
-            close(sc_local);
-            continue;
+    MsgBuffer msg;
+    initMsgBuffer(&msg);
+    search_rdlock();
+    SearchEntry** results;
+    int count = search_digest(digest, &results);
+    const ConnectedSet* connectedSet = connected_acquire();
+    // Quedarse con los contenidos de usuarios conectados, agrupados por versión del resumen
+    int total = 0;
+    for (int i = 0; i < count; i++) {
+        if (connected_find(connectedSet, results[i]->seq) != NULL) {
+            results[total++] = results[i];
         }
-        // Recibir el dateTime del servicio web
-        char dateTime[256];
-        if (readLine(sc_local, dateTime, sizeof(dateTime)) == -1) {
-            perror("Error al recibir el dateTime en readLine (servicio)");
-            close(sc_local);
-            continue;
+    }
+    qsort(results, total, sizeof(SearchEntry*), compare_manifests);
+    int first = 0, matches = 0;
+    for (int i = 0, run = 1; i < total; i++, run++) {
+        if (i > 0 && results[i]->manifest != results[i - 1]->manifest) run = 1;
+        if (run > matches) {
+            matches = run;
+            first = i - run + 1;
+        }
+    }
+
+    ContentManifest parsed;
+    int error = count < 0;
+    resultado = 0;
+    if (!error && (matches == 0 || registry_parse_manifest(results[first]->manifest, &parsed) != 0)) {
+        resultado = 3;  // Ningún usuario conectado publica el fichero
+    } else if (!error) {
+        char size[24], chunk[CONTENT_DIGEST_LEN + 1];
+        snprintf(size, sizeof(size), "%lld", parsed.size);
+        error = reply_string(&msg, TLV_SIZE, size) == -1 || reply_int(&msg, TLV_CHUNK_SIZE, parsed.chunkSize) == -1 ||
+                reply_int(&msg, TLV_COUNT, parsed.chunkCount) == -1;
+        for (int i = 0; i < parsed.chunkCount && !error; i++) {
+            snprintf(chunk, sizeof(chunk), "%.*s", CONTENT_DIGEST_LEN, parsed.chunks + i * CONTENT_DIGEST_LEN);
+            error = reply_string(&msg, TLV_CHUNK, chunk) == -1;
         }
-        // Recibir el userName del cliente
-        char userName[256];
-        if (readLine(sc_local, userName, sizeof(userName)) == -1) {
-            perror("Error al recibir el nombre de usuario en readLine (servicio)");
-            close(sc_local);
+        error = error || reply_int(&msg, TLV_COUNT, matches) == -1;
+        for (int i = first; i < first + matches && !error; i++) {
+            const ConnectedUser* publisher = connected_find(connectedSet, results[i]->seq);
+            error = append_publisher(&msg, publisher, results[i]->fileName);
+        }
+    }
+    connected_release();
+    search_unlock();
+    free(results);
+    if (error) {
+        freeMsgBuffer(&msg);
+        resultado = 4;  // Error general
+    }
+
+    // Enviar el resultado, el resumen del fichero y los usuarios que lo publican
+    if (send_response(sc_local, resultado, resultado == 0 ? &msg : NULL) == -1) {
+        freeMsgBuffer(&msg);
+        perror("Error al enviar los resultados de la búsqueda (servicio)");
+        return 4;
+    }
+    freeMsgBuffer(&msg);
+    return resultado;
+}
+
+
+/** Servicio STATS */
+// Envía el informe de métricas, una línea por campo: en texto o, si format es PROMETHEUS,
+// en el formato de exposición de Prometheus. No necesita usuario registrado.
+int stats_service(const char* format, int sc_local) {
+    int resultado = 0;
+    char* report = metrics_report(strcasecmp(format, "PROMETHEUS") == 0);
+    MsgBuffer msg;
+    initMsgBuffer(&msg);
+    if (report == NULL) {
+        resultado = 4;  // Error general
+    } else {
+        // Número de líneas y cada línea
+        int lines = 0;
+        for (char* p = report; *p; p++) {
+            if (*p == '\n') lines++;
+        }
+        int error = reply_int(&msg, TLV_COUNT, lines) == -1;
+        char* saveptr;
+        for (char* line = strtok_r(report, "\n", &saveptr); line != NULL && !error; line = strtok_r(NULL, "\n", &saveptr)) {
+            error = reply_string(&msg, TLV_LINE, line) == -1;
+        }
+        free(report);
+        if (error) {
+            resultado = 4;
+        }
+    }
+    if (send_response(sc_local, resultado, resultado == 0 ? &msg : NULL) == -1) {
+        freeMsgBuffer(&msg);
+        perror("Error al enviar las métricas (servicio)");
+        return 4;
+    }
+    freeMsgBuffer(&msg);
+    return resultado;
+}
+
+/** Función ejecutada por el thread del puerto local de métricas (-m) */
+// Responde a cada conexión con el informe en formato de Prometheus como respuesta HTTP, para
+// que se pueda consultar con curl o con el propio Prometheus.
+void* stats_listener(void* arg) {
+    for (;;) {
+        int sc = accept(statsSd, NULL, NULL);
+        if (sc == -1) {
+            if (errno == EINTR) continue;
+            break;  // socket cerrado al terminar el servidor
+        }
+        // Leer la petición HTTP sin interpretarla
+        char request[1024];
+        struct timeval timeout = { .tv_sec = 1, .tv_usec = 0 };
+        setsockopt(sc, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(sc, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        if (read(sc, request, sizeof(request)) < 0) {
+            close(sc);
             continue;
         }
+        char* report = metrics_report(1);
+        if (report != NULL) {
+            char header[128];
+            int len = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                               "Content-Length: %zu\r\n\r\n", strlen(report));
+            struct iovec iov[2] = { { header, len }, { report, strlen(report) } };
+            sendMessageV(sc, iov, 2);
+            free(report);
+        }
+        close(sc);
+    }
+    return NULL;
+}
 
-        // Procesar la petición basada en op
-        if (strcmp(op, "REGISTER") == 0) {
-            printf("Servicio: Procesando petición REGISTER\n");
-            printf("s> OPERATION FROM %s\n", userName);
-            // Registrar usuario
-            int resultado = register_user(userName);
-            sprintf(buffer, "%d", resultado);
-            // Devolver el resultado al cliente por su socket
-            if (sendMessage(sc_local, buffer, strlen(buffer) + 1) == -1) {
-                perror("Error al enviar el resultado al cliente (servicio)");
-                close(sc_local);
-                continue;
-            }
-            // Cerrar la conexión
-            close(sc_local);
-        }
-        else if (strcmp(op, "UNREGISTER") == 0) {
-            printf("Servicio: Procesando petición UNREGISTER\n");
-            printf("s> OPERATION FROM %s\n", userName);
-            // Registrar usuario
-            int resultado = unregister_user(userName);
-            sprintf(buffer, "%d", resultado);
-            // Devolver el resultado al cliente por su socket
-            if (sendMessage(sc_local, buffer, strlen(buffer) + 1) == -1) {
-                perror("Error al enviar el resultado al cliente (servicio)");
-                close(sc_local);
-                continue;
-            }
-            // Cerrar la conexión
-            close(sc_local);
-        }
-        else if (strcmp(op, "CONNECT") == 0) {
-            printf("Servicio: Procesando petición CONNECT\n");
-            // Recibir la dirección IP del cliente
-            char ip[256];
-            if (readLine(sc_local, ip, sizeof(ip)) == -1) {
-                perror("Error al recibir la IP en readLine (servicio)");
-                close(sc_local);
-                continue;
-            }
-            // Recibir el puerto del cliente
-            char port[256];
-            if (readLine(sc_local, port, sizeof(port)) == -1) {
-                perror("Error al recibir el puerto en readLine (servicio)");
-                close(sc_local);
-                continue;
-            }
 
-            printf("s> OPERATION FROM %s\n", userName);
+/** Función para saber cuántos campos tiene una petición según su código de operación */
+int request_fields(const char* op) {
+    if (strcmp(op, "CONNECT") == 0 || strcmp(op, "PUBLISH") == 0) {
+        return 5;   // op, dateTime, userName y dos campos más
+    }
+    if (strcmp(op, "SEARCH_NAME") == 0) {
+        return 7;   // op, dateTime, userName, modo, patrón, offset y límite
+    }
+    if (strcmp(op, "PUBLISH_HASHED") == 0) {
+        return 9;   // op, dateTime, userName, fileName, description, tamaño, resumen, tamaño de trozo y
+                    // número de trozos (siguen sus resúmenes)
+    }
+    if (strcmp(op, "DELETE") == 0 || strcmp(op, "LIST_CONTENT") == 0 || strcmp(op, "SEARCH") == 0 ||
+        strcmp(op, "STATS") == 0 || strcmp(op, "SEARCH_DIGEST") == 0) {
+        return 4;   // op, dateTime, userName y un campo más
+    }
+    if (strcmp(op, "PUBLISH_BATCH") == 0 || strcmp(op, "DELETE_BATCH") == 0) {
+        return 4;   // op, dateTime, userName y número de contenidos (siguen sus campos)
+    }
+    if (strcmp(op, "SESSION") == 0) {
+        return 1;   // solo op
+    }
+    return 3;       // op, dateTime, userName
+}
 
-            // Conectar usuario
-            int resultado = connect_user(userName, ip, port);
-            sprintf(buffer, "%d", resultado);
-            // Devolver el resultado al cliente por su socket
-            if (sendMessage(sc_local, buffer, strlen(buffer) + 1) == -1) {
-                perror("Error al enviar el resultado al cliente (servicio)");
-                close(sc_local);
-                continue;
-            }
-            // Cerrar la conexión
-            close(sc_local);
-        }
-        else if (strcmp(op, "DISCONNECT") == 0) {
-            printf("Servicio: Procesando petición DISCONNECT\n");
-            printf("s> OPERATION FROM %s\n", userName);
-
-            // Desconectar usuario
-            int resultado = disconnect_user(userName);
-            sprintf(buffer, "%d", resultado);
-            // Devolver el resultado al cliente por su socket
-            if (sendMessage(sc_local, buffer, strlen(buffer) + 1) == -1) {
-                perror("Error al enviar el resultado al cliente (servicio)");
-                close(sc_local);
-                continue;
+/** Función para saber cuántos campos lleva cada contenido de un lote, 0 si no es un lote */
+// El número de contenidos es el último campo fijo de la petición.
+int batch_item_fields(const char* op) {
+    if (strcmp(op, "PUBLISH_BATCH") == 0) {
+        return 2;   // fileName y description
+    }
+    if (strcmp(op, "DELETE_BATCH") == 0 || strcmp(op, "PUBLISH_HASHED") == 0) {
+        return 1;   // fileName o resumen del trozo
+    }
+    return 0;
+}
+
+// Operaciones del protocolo binario: nombre y tipos TLV de sus campos tras dateTime y userName,
+// en el orden en que los recibe el servicio, y de los campos que se repiten por cada contenido
+// de un lote
+static const struct {
+    const char* name;
+    int fields[MAX_FIELDS - 3];
+    int items[2];
+} operaciones[OP_COUNT] = {
+    [OP_REGISTER]     = { "REGISTER",     { 0 } },
+    [OP_UNREGISTER]   = { "UNREGISTER",   { 0 } },
+    [OP_CONNECT]      = { "CONNECT",      { TLV_IP, TLV_PORT } },
+    [OP_DISCONNECT]   = { "DISCONNECT",   { 0 } },
+    [OP_PUBLISH]      = { "PUBLISH",      { TLV_FILE, TLV_DESCRIPTION } },
+    [OP_DELETE]       = { "DELETE",       { TLV_FILE } },
+    [OP_LIST_USERS]   = { "LIST_USERS",   { 0 } },
+    [OP_LIST_CONTENT] = { "LIST_CONTENT", { TLV_REMOTE_USER } },
+    [OP_SEARCH]       = { "SEARCH",       { TLV_QUERY } },
+    [OP_SEARCH_NAME]  = { "SEARCH_NAME",  { TLV_MODE, TLV_PATTERN, TLV_OFFSET, TLV_LIMIT } },
+    [OP_PUBLISH_BATCH] = { "PUBLISH_BATCH", { TLV_COUNT }, { TLV_FILE, TLV_DESCRIPTION } },
+    [OP_DELETE_BATCH]  = { "DELETE_BATCH",  { TLV_COUNT }, { TLV_FILE } },
+    [OP_STATS]        = { "STATS",        { TLV_FORMAT } },
+    [OP_PUBLISH_HASHED] = { "PUBLISH_HASHED",
+                            { TLV_FILE, TLV_DESCRIPTION, TLV_SIZE, TLV_DIGEST, TLV_CHUNK_SIZE, TLV_COUNT }, { TLV_CHUNK } },
+    [OP_SEARCH_DIGEST] = { "SEARCH_DIGEST", { TLV_DIGEST } },
+};
+
+/** Función para obtener el código de operación de una petición, 0 si no es ninguna */
+int op_code(const char* op) {
+    for (int i = 1; i < OP_COUNT; i++) {
+        if (operaciones[i].name != NULL && strcmp(operaciones[i].name, op) == 0) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+/** Función para copiar un campo recibido en la conexión, truncado a 255 caracteres */
+void set_field(Conn* conn, int index, const char* value, size_t len) {
+    if (len > sizeof(conn->fields[0]) - 1) {
+        len = sizeof(conn->fields[0]) - 1;
+    }
+    memcpy(conn->fields[index], value, len);
+    conn->fields[index][len] = '\0';
+}
+
+/** Función para añadir un campo de un contenido del lote, truncado a 255 caracteres */
+int add_batch_field(Conn* conn, const char* value, size_t len) {
+    if (len > sizeof(conn->item) - 1) {
+        len = sizeof(conn->item) - 1;
+    }
+    memcpy(conn->item, value, len);
+    conn->item[len] = '\0';
+    if (appendString(&conn->batch, conn->item) == -1) {
+        return -1;
+    }
+    conn->batchFields++;
+    return 0;
+}
+
+/** Función para separar los campos de una trama de texto (terminados en '\0') */
+// Devuelve -1 si no hay memoria para los contenidos de un lote.
+int split_text_fields(Conn* conn) {
+    const char* p = conn->frame;
+    const char* end = conn->frame + conn->frameLen;
+    conn->nfields = 0;
+    while (p < end) {
+        const char* stop = memchr(p, '\0', end - p);
+        size_t len = (stop ? stop : end) - p;
+        if (conn->nfields == 0 || conn->nfields < request_fields(conn->fields[0])) {
+            set_field(conn, conn->nfields++, p, len);
+        } else if (batch_item_fields(conn->fields[0]) > 0) {
+            if (add_batch_field(conn, p, len) == -1) {
+                return -1;
             }
-            // Cerrar la conexión
-            close(sc_local);
-        }
-        else if (strcmp(op, "PUBLISH") == 0) {
-            printf("Servicio: Procesando petición PUBLISH\n");
-            // Recibir fileName del cliente
-            char fileName[256];
-            if (readLine(sc_local, fileName, sizeof(fileName)) == -1) {
-                perror("Error al recibir fileName en readLine (servicio)");
-                close(sc_local);
-                continue;
+        } else if (conn->nfields < MAX_FIELDS) {
+            set_field(conn, conn->nfields++, p, len);
+        }
+        p = stop ? stop + 1 : end;
+    }
+    return 0;
+}
+
+/** Función para colocar los campos TLV de una trama binaria donde los espera el servicio */
+// Los enteros pasan a texto como en el protocolo de texto y los campos desconocidos se
+// ignoran. Devuelve -1 si algún campo se sale de la trama.
+int split_tlv_fields(Conn* conn) {
+    const int* opFields = NULL;
+    const int* opItems = NULL;
+    if (conn->opcode > 0 && conn->opcode < OP_COUNT && operaciones[conn->opcode].name != NULL) {
+        strcpy(conn->fields[0], operaciones[conn->opcode].name);
+        opFields = operaciones[conn->opcode].fields;
+        opItems = operaciones[conn->opcode].items;
+    }
+    conn->nfields = MAX_FIELDS;
+
+    size_t pos = 0;
+    int type;
+    const char* value;
+    size_t valueLen;
+    int r;
+    while ((r = nextTLV(conn->frame, conn->frameLen, &pos, &type, &value, &valueLen)) == 1) {
+        int index = -1;
+        if (type == TLV_DATETIME) index = 1;
+        else if (type == TLV_USER) index = 2;
+        for (int i = 0; opFields != NULL && i < MAX_FIELDS - 3 && index < 0; i++) {
+            if (opFields[i] == type) index = 3 + i;
+        }
+        if (index < 0 && opItems != NULL && (opItems[0] == type || opItems[1] == type)) {
+            // Campo de un contenido del lote, en el orden en que llegan
+            if (add_batch_field(conn, value, valueLen) == -1) {
+                return -1;
             }
-            // Recibir description del cliente
-            char description[256];
-            if (readLine(sc_local, description, sizeof(description)) == -1) {
-                perror("Error al recibir description en readLine (servicio)");
-                close(sc_local);
-                continue;
+            continue;
+        }
+        if (index < 0) {
+            continue;
+        }
+        if ((type == TLV_PORT || type == TLV_OFFSET || type == TLV_LIMIT || type == TLV_COUNT ||
+             type == TLV_CHUNK_SIZE) &&
+            valueLen == sizeof(uint32_t)) {
+            uint32_t num;
+            memcpy(&num, value, sizeof(num));
+            snprintf(conn->fields[index], sizeof(conn->fields[0]), "%d", (int) ntohl(num));
+        } else {
+            set_field(conn, index, value, valueLen);
+        }
+    }
+    return r;
+}
+
+/** Función para leer el saludo del protocolo binario: PROTOCOL_MAGIC y versión del cliente */
+// Devuelve 1 si está completo (queda como petición HELLO), 0 si faltan datos y -1 si no es válido.
+int conn_read_hello(Conn* conn) {
+    ssize_t len = readBytesBuffered(&conn->reader, conn->frameHeader, PROTOCOL_MAGIC_LEN + sizeof(uint32_t));
+    if (len == -1) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    if (len < PROTOCOL_MAGIC_LEN + (ssize_t) sizeof(uint32_t) ||
+        memcmp(conn->frameHeader, PROTOCOL_MAGIC, PROTOCOL_MAGIC_LEN) != 0) {
+        return -1;
+    }
+    strcpy(conn->fields[0], "HELLO");
+    conn->nfields = 1;
+    return 1;
+}
+
+/** Función para leer una petición en forma de trama (modo sesión o protocolo binario) */
+// Devuelve 1 si la petición está completa, 0 si faltan datos y -1 si la conexión se cerró
+// o la trama no es válida.
+int conn_read_frame(Conn* conn) {
+    if (conn->frameLen < 0) {
+        // Cabecera: longitud (texto) o cabecera completa FrameHeader (binario)
+        size_t headerLen = conn->protocol == 2 ? FRAME_HEADER_SIZE : sizeof(uint32_t);
+        ssize_t len = readBytesBuffered(&conn->reader, conn->frameHeader, headerLen);
+        if (len == -1) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        if (len < (ssize_t) headerLen) {
+            return -1;
+        }
+        if (conn->protocol == 2) {
+            FrameHeader header;
+            unpackFrameHeader(conn->frameHeader, &header);
+            conn->frameLen = header.length;
+            conn->requestId = header.requestId;
+            conn->opcode = header.opcode;
+        } else {
+            uint32_t frameLen;
+            memcpy(&frameLen, conn->frameHeader, sizeof(frameLen));
+            conn->frameLen = ntohl(frameLen);
+        }
+        if (conn->frameLen > MAX_FRAME) {
+            fprintf(stderr, "Petición de %ld bytes demasiado larga (servidor)\n", conn->frameLen);
+            return -1;
+        }
+        if ((size_t) conn->frameLen > conn->frameCapacity) {
+            // Solo los lotes necesitan más que una petición normal
+            size_t capacity = conn->frameLen > MAX_FIELDS * 256 ? (size_t) conn->frameLen : MAX_FIELDS * 256;
+            char* frame = realloc(conn->frame, capacity);
+            if (!frame) {
+                perror("Error al asignar memoria para la petición (servidor)");
+                return -1;
             }
+            conn->frame = frame;
+            conn->frameCapacity = capacity;
+        }
+    }
+    ssize_t len = readBytesBuffered(&conn->reader, conn->frame, conn->frameLen);
+    if (len == -1) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    if (len < conn->frameLen) {
+        return -1;
+    }
 
-            printf("s> OPERATION FROM %s\n", userName);
+    // Los campos que no lleguen quedan vacíos
+    for (int i = 0; i < MAX_FIELDS; i++) {
+        conn->fields[i][0] = '\0';
+    }
+    conn->batch.len = 0;
+    conn->batchFields = 0;
+    int r;
+    if (conn->protocol == 2) {
+        r = split_tlv_fields(conn) == 0 ? 1 : -1;
+    } else {
+        r = split_text_fields(conn) == 0 ? 1 : -1;
+    }
+    conn->frameLen = -1;
+    return r;
+}
 
-            // Publicar contenido
-            int resultado = publish_content(userName, fileName, description);
-            sprintf(buffer, "%d", resultado);
-            // Devolver el resultado al cliente por su socket
-            if (sendMessage(sc_local, buffer, strlen(buffer) + 1) == -1) {
-                perror("Error al enviar el resultado al cliente (servicio)");
-                close(sc_local);
-                continue;
+/** Función para leer todo lo disponible en el socket de un cliente (no bloqueante) */
+// Devuelve 1 si la petición está completa, 0 si faltan datos y -1 si la conexión se cerró.
+int conn_read(Conn* conn) {
+    if (conn->protocol == 0) {
+        // El primer byte decide el protocolo de la conexión
+        char first;
+        ssize_t len = peekBuffered(&conn->reader, &first);
+        if (len == -1) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        if (len == 0) {
+            return -1;
+        }
+        conn->protocol = first == PROTOCOL_MAGIC[0] ? 2 : 1;
+        conn->frameLen = -1;
+    }
+    if (conn->protocol == 2 && !conn->session) {
+        return conn_read_hello(conn);
+    }
+    if (conn->session) {
+        return conn_read_frame(conn);
+    }
+    for (;;) {
+        // Cada campo termina en '\n' o '\0' y se trunca a 255 caracteres, como en readLine.
+        // Tras el número de contenidos de un lote llegan los campos de cada contenido
+        int batch = conn->nfields > 0 && conn->nfields >= request_fields(conn->fields[0]);
+        char* field = batch ? conn->item : conn->fields[conn->nfields];
+        ssize_t len = readLineBuffered(&conn->reader, field, sizeof(conn->fields[0]));
+        if (len == -1) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        if (len == 0 && conn->reader.eof) {
+            return -1;
+        }
+        if (batch) {
+            if (add_batch_field(conn, conn->item, strlen(conn->item)) == -1) {
+                return -1;
             }
-            // Cerrar la conexión
-            close(sc_local);
-        }
-        else if (strcmp(op, "DELETE") == 0) {
-            printf("Servicio: Procesando petición DELETE\n");
-            // Recibir fileName del cliente
-            char fileName[256];
-            if (readLine(sc_local, fileName, sizeof(fileName)) == -1) {
-                perror("Error al recibir fileName en readLine (servicio)");
-                close(sc_local);
-                continue;
+        } else {
+            conn->nfields++;
+        }
+        if (conn->nfields >= request_fields(conn->fields[0])) {
+            // Un lote está completo cuando llegan todos sus contenidos (o el número no es válido)
+            int count = atoi(conn->fields[request_fields(conn->fields[0]) - 1]);
+            int itemFields = batch_item_fields(conn->fields[0]);
+            if (itemFields == 0 || count <= 0 || count > MAX_BATCH || conn->batchFields >= count * itemFields) {
+                return 1;
             }
+        }
+    }
+}
 
-            printf("s> OPERATION FROM %s\n", userName);
+/** Función para cerrar la conexión con un cliente */
+void conn_close(Conn* conn) {
+    close(conn->sc);
+    free(conn->frame);
+    freeMsgBuffer(&conn->batch);
+    free(conn);
+}
 
-            // Eliminar contenido
-            int resultado = delete_content(userName, fileName);
-            sprintf(buffer, "%d", resultado);
-            // Devolver el resultado al cliente por su socket
-            if (sendMessage(sc_local, buffer, strlen(buffer) + 1) == -1) {
-                perror("Error al enviar el resultado al cliente (servicio)");
-                close(sc_local);
-                continue;
-            }
-            // Cerrar la conexión
-            close(sc_local);
+/** Función para añadir la conexión al buffer de peticiones (con el mutex y sitio libre) */
+static void meter_peticion(Conn* conn) {
+    conn->queuedAt = metrics_now();
+    buffer_sockets[pos_peticion] = conn;
+    pos_peticion = (pos_peticion + 1) % MAX_SOCKETS;
+    n_elementos++;
+    pthread_cond_signal(&no_vacio);
+}
+
+/** Función para entregar una petición completa al pool de threads */
+void encolar_peticion(Conn* conn) {
+    pthread_mutex_lock(&mutex);
+    while (n_elementos == MAX_SOCKETS) {
+        pthread_cond_wait(&no_lleno, &mutex);
+    }
+    meter_peticion(conn);
+    pthread_mutex_unlock(&mutex);
+}
+
+/** Función para devolver al pool una sesión con otra petición completa, sin esperar */
+// Devuelve -1 si el buffer está lleno: un thread del pool no puede esperar a que se vacíe,
+// porque son los threads del pool los que lo vacían.
+int reencolar_peticion(Conn* conn) {
+    pthread_mutex_lock(&mutex);
+    if (n_elementos == MAX_SOCKETS) {
+        pthread_mutex_unlock(&mutex);
+        return -1;
+    }
+    meter_peticion(conn);
+    pthread_mutex_unlock(&mutex);
+    return 0;
+}
+
+/** Función para atender una petición completa de un cliente y enviarle la respuesta */
+void atender_peticion(Conn* conn) {
+    int sc_local = conn->sc;   // descriptor del socket del cliente
+    // Código de operación (op), dateTime del servicio web y userName del cliente
+    const char* op = conn->fields[0];
+    const char* userName = conn->fields[2];
+    int resultado = -1;     // resultado de las operaciones que solo devuelven un código
+
+    // Procesar la petición basada en op
+    if (conn->protocol == 2 && !conn->session) {
+        log_debug("Servicio: Procesando saludo del protocolo binario");
+        // Responder con PROTOCOL_MAGIC y la versión aceptada; la conexión queda abierta
+        char hello[PROTOCOL_MAGIC_LEN + sizeof(uint32_t)];
+        uint32_t version = htonl(PROTOCOL_VERSION);
+        memcpy(hello, PROTOCOL_MAGIC, PROTOCOL_MAGIC_LEN);
+        memcpy(hello + PROTOCOL_MAGIC_LEN, &version, sizeof(version));
+        replySent = 1;
+        if (sendMessage(sc_local, hello, sizeof(hello)) == -1) {
+            perror("Error al enviar el saludo al cliente (servicio)");
+            replyFailed = 1;
         }
-        else if (strcmp(op, "LIST_USERS") == 0) {
-            printf("Servicio: Procesando petición LIST_USERS\n");
+        conn->session = 1;
+    }
+    else if (strcmp(op, "SESSION") == 0 && conn->protocol == 1 && !conn->session) {
+        log_debug("Servicio: Procesando petición SESSION");
+        // A partir de la respuesta, las peticiones y respuestas van en tramas
+        if (send_result(sc_local, 0) == -1) {
+            perror("Error al enviar el resultado al cliente (servicio)");
+        }
+        conn->session = 1;
+        conn->frameLen = -1;
+    }
+    else if (strcmp(op, "REGISTER") == 0) {
+        log_debug("Servicio: Procesando petición REGISTER");
+        log_info("s> OPERATION FROM %s", userName);
+        // Registrar usuario
+        resultado = register_user(userName);
+    }
+    else if (strcmp(op, "UNREGISTER") == 0) {
+        log_debug("Servicio: Procesando petición UNREGISTER");
+        log_info("s> OPERATION FROM %s", userName);
+        // Dar de baja al usuario
+        resultado = unregister_user(userName);
+    }
+    else if (strcmp(op, "CONNECT") == 0) {
+        log_debug("Servicio: Procesando petición CONNECT");
+        // Dirección IP y puerto de escucha del cliente
+        const char* ip = conn->fields[3];
+        const char* port = conn->fields[4];
 
-            printf("s> OPERATION FROM %s\n", userName);
+        log_info("s> OPERATION FROM %s", userName);
 
-            // Enviar usuarios conectados
-            list_users(userName, sc_local, buffer);
+        // Conectar usuario
+        resultado = connect_user(userName, ip, port);
+    }
+    else if (strcmp(op, "DISCONNECT") == 0) {
+        log_debug("Servicio: Procesando petición DISCONNECT");
+        log_info("s> OPERATION FROM %s", userName);
 
-            // Cerrar la conexión
-            close(sc_local);
-        }
-        else if (strcmp(op, "LIST_CONTENT") == 0) {
-            printf("Servicio: Procesando petición LIST_CONTENT\n");
-            // Recibir el nombre del usuario cuyo contenido quiere conocer
-            char remoteUserName[256];
-            if (readLine(sc_local, remoteUserName, sizeof(remoteUserName)) == -1) {
-                perror("Error al recibir el nombre de usuario en readLine (servicio)");
-                close(sc_local);
-                continue;
-            }
+        // Desconectar usuario
+        resultado = disconnect_user(userName);
+    }
+    else if (strcmp(op, "PUBLISH") == 0) {
+        log_debug("Servicio: Procesando petición PUBLISH");
+        // fileName y description del contenido
+        const char* fileName = conn->fields[3];
+        const char* description = conn->fields[4];
 
-            printf("s> OPERATION FROM %s\n", userName);
+        log_info("s> OPERATION FROM %s", userName);
 
-            // Enviar contenidos publicados por el usuario
-            list_user_contents(userName, remoteUserName, sc_local, buffer);
+        // Publicar contenido
+        resultado = publish_content(userName, fileName, description, NULL);
+    }
+    else if (strcmp(op, "PUBLISH_HASHED") == 0) {
+        log_debug("Servicio: Procesando petición PUBLISH_HASHED");
+        log_info("s> OPERATION FROM %s", userName);
 
-            // Cerrar la conexión
-            close(sc_local);
+        // Publicar contenido con el resumen del fichero
+        resultado = publish_hashed(conn);
+    }
+    else if (strcmp(op, "DELETE") == 0) {
+        log_debug("Servicio: Procesando petición DELETE");
+        // fileName del contenido
+        const char* fileName = conn->fields[3];
+
+        log_info("s> OPERATION FROM %s", userName);
+
+        // Eliminar contenido
+        resultado = delete_content(userName, fileName);
+    }
+    else if (strcmp(op, "PUBLISH_BATCH") == 0 || strcmp(op, "DELETE_BATCH") == 0) {
+        log_debug("Servicio: Procesando petición %s", op);
+        log_info("s> OPERATION FROM %s", userName);
+
+        // Aplicar el lote y enviar el resultado de cada contenido
+        batch_service(conn, strcmp(op, "PUBLISH_BATCH") == 0, sc_local);
+    }
+    else if (strcmp(op, "STATS") == 0) {
+        log_debug("Servicio: Procesando petición STATS");
+        // Formato del informe: TEXT o PROMETHEUS
+        const char* format = conn->fields[3];
+
+        // Enviar las métricas del servidor
+        stats_service(format, sc_local);
+    }
+    else if (strcmp(op, "LIST_USERS") == 0) {
+        log_debug("Servicio: Procesando petición LIST_USERS");
+
+        log_info("s> OPERATION FROM %s", userName);
+
+        // Enviar usuarios conectados
+        list_users(userName, sc_local);
+    }
+    else if (strcmp(op, "LIST_CONTENT") == 0) {
+        log_debug("Servicio: Procesando petición LIST_CONTENT");
+        // Nombre del usuario cuyo contenido quiere conocer
+        const char* remoteUserName = conn->fields[3];
+
+        log_info("s> OPERATION FROM %s", userName);
+
+        // Enviar contenidos publicados por el usuario
+        list_user_contents(userName, remoteUserName, sc_local);
+    }
+    else if (strcmp(op, "SEARCH") == 0) {
+        log_debug("Servicio: Procesando petición SEARCH");
+        // Nombre de fichero o palabras a buscar
+        const char* query = conn->fields[3];
+
+        log_info("s> OPERATION FROM %s", userName);
+
+        // Enviar los usuarios conectados que publican contenidos que coinciden
+        search_contents(userName, query, sc_local);
+    }
+    else if (strcmp(op, "SEARCH_NAME") == 0) {
+        log_debug("Servicio: Procesando petición SEARCH_NAME");
+        // Modo (PREFIX o SUBSTRING), patrón y página de resultados
+        const char* mode = conn->fields[3];
+        const char* pattern = conn->fields[4];
+        const char* offset = conn->fields[5];
+        const char* limit = conn->fields[6];
+
+        log_info("s> OPERATION FROM %s", userName);
+
+        // Enviar la página de ficheros cuyo nombre coincide con el patrón
+        search_names_service(userName, mode, pattern, offset, limit, sc_local);
+    }
+    else if (strcmp(op, "SEARCH_DIGEST") == 0) {
+        log_debug("Servicio: Procesando petición SEARCH_DIGEST");
+        // SHA-256 del fichero en hexadecimal
+        const char* digest = conn->fields[3];
+
+        log_info("s> OPERATION FROM %s", userName);
+
+        // Enviar el resumen del fichero y los usuarios conectados que lo publican
+        search_digest_service(userName, digest, sc_local);
+    }
+
+    else {
+        // Código de operación no reconocido
+        log_debug("Servicio: Código de operación incorrecto");
+    }
+
+    if (resultado != -1) {
+        // Devolver el resultado al cliente por su socket
+        if (send_result(sc_local, resultado) == -1) {
+            perror("Error al enviar el resultado al cliente (servicio)");
+        }
+    }
+}
+
+/** Función ejecutada por los threads del pool */
+void servicio(void) {
+    Conn* conn;     // conexión del cliente con la petición ya recibida
+    int sc_local;   // descriptor del socket del cliente
+    metrics_thread_init();
+
+    for(;;) {
+        pthread_mutex_lock(&mutex);
+        while (n_elementos == 0) {
+            if (fin==true) {
+                fprintf(stderr,"Finalizando servicio thread\n");
+                pthread_mutex_unlock(&mutex);
+                pthread_exit(0);
+            }
+            pthread_cond_wait(&no_vacio, &mutex);
+        }
+        // Obtener la petición de un cliente del buffer
+        conn = buffer_sockets[pos_servicio];
+        buffer_sockets[pos_servicio] = NULL; // precaución adicional
+        pos_servicio = (pos_servicio + 1) % MAX_SOCKETS;
+        n_elementos --;
+        pthread_cond_signal(&no_lleno);
+        pthread_mutex_unlock(&mutex);
+
+        sc_local = conn->sc;
+        // Las respuestas se escriben con send_reply: el socket vuelve a ser bloqueante
+        int flags = fcntl(sc_local, F_GETFL);
+        fcntl(sc_local, F_SETFL, flags & ~O_NONBLOCK);
+        // Un cliente que no lee la respuesta no puede retener al thread indefinidamente
+        struct timeval sendTimeout = { .tv_sec = SEND_TIMEOUT, .tv_usec = 0 };
+        setsockopt(sc_local, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+        // Atender las peticiones de la conexión. En modo sesión se siguen atendiendo, en
+        // orden, las que ya hayan llegado; cuando no queda ninguna completa, la conexión
+        // vuelve al reactor. Tras SESSION_BURST peticiones seguidas, la siguiente vuelve al
+        // final del buffer, para que una sesión que no para de enviar no acapare el thread
+        int estado = 1;
+        uint64_t dequeuedAt = metrics_now();
+        int queued = 1;     // solo la primera petición ha esperado en el buffer
+        int served = 0;
+        while (estado == 1) {
+            replyConn = conn;
+            replySent = 0;
+            replyFailed = 0;
+            replyCode = 0;
+            contentWaitNs = 0;
+            registry_lock_wait();
+            wal_thread_time();
+            int op = op_code(conn->fields[0]);
+            uint64_t start = queued ? dequeuedAt : metrics_now();
+            atender_peticion(conn);
+            // Métricas de la petición: tiempo de servicio, esperas y escritura en el log
+            metrics_count(op, replyCode != 0);
+            metrics_record(op, METRIC_SERVICE, metrics_now() - start);
+            if (queued) {
+                metrics_record(op, METRIC_QUEUE, dequeuedAt - conn->queuedAt);
+                queued = 0;
+            }
+            metrics_record(op, METRIC_LOCK, registry_lock_wait() + contentWaitNs);
+            unsigned long long persistNs = wal_thread_time();
+            if (persistNs > 0) {
+                metrics_record(op, METRIC_PERSIST, persistNs);
+            }
+            if (!conn->session || replyFailed) {
+                estado = -1;
+                break;
+            }
+            if (!replySent) {
+                // Operación desconocida: se responde igualmente para no desemparejar las
+                // siguientes (trama vacía en texto, STATUS_UNKNOWN_OP en binario)
+                if (conn->protocol == 2) {
+                    send_result(sc_local, STATUS_UNKNOWN_OP);
+                } else {
+                    send_replyv(sc_local, NULL, 0);
+                }
+                if (replyFailed) {
+                    estado = -1;
+                    break;
+                }
+            }
+            // Leer sin bloquear la siguiente petición de la sesión
+            fcntl(sc_local, F_SETFL, flags | O_NONBLOCK);
+            estado = conn_read(conn);
+            if (estado == 1 && ++served >= SESSION_BURST && reencolar_peticion(conn) == 0) {
+                // Ya la puede atender otro thread: no se vuelve a tocar
+                estado = 2;
+                break;
+            }
+            if (estado == 1) {
+                fcntl(sc_local, F_SETFL, flags & ~O_NONBLOCK);
+            }
         }
 
-        else {
-            // Código de operación no reconocido
-            printf("Servicio: Código de operación incorrecto\n");
+        // Con estado 2 la conexión ya está otra vez en el buffer con su siguiente petición
+        if (estado == 0) {
+            // Sesión sin petición completa pendiente: esperar más datos en el reactor
+            struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP | EPOLLET, .data.ptr = conn };
+            if (epoll_ctl(epfd, EPOLL_CTL_ADD, sc_local, &ev) == -1) {
+                perror("Error en epoll_ctl (servicio)");
+                conn_close(conn);
+            }
+        } else if (estado == -1) {
+            // Cerrar la conexión
+            conn_close(conn);
         }
 
     } // FOR
@@ -1176,14 +1969,29 @@ void servicio(void) {
 int main(int argc, char *argv[]) {
     // Comprobar que se pasa el puerto en la línea de mandatos
     int port = 0;
+    int statsPort = 0;      // puerto local de métricas, 0 si no se abre
+    LogLevel level = LOG_LEVEL_INFO;
+    int syncLog = 0;        // escribir la traza en el momento en vez de en segundo plano
     int opt;
-    while ((opt = getopt(argc, argv, "p:")) != -1) {
+    while ((opt = getopt(argc, argv, "p:m:l:s")) != -1) {
         switch (opt) {
             case 'p':
                 port = atoi(optarg);
                 break;
+            case 'm':
+                statsPort = atoi(optarg);
+                break;
+            case 'l':
+                if (log_parse_level(optarg, &level) != 0) {
+                    fprintf(stderr, "Error: Log level must be OFF, ERROR, WARN, INFO or DEBUG\n");
+                    return -1;
+                }
+                break;
+            case 's':
+                syncLog = 1;
+                break;
             default:
-                fprintf(stderr, "Usage: %s -p <port>\n", argv[0]);
+                fprintf(stderr, "Usage: %s -p <port> [-m <stats_port>] [-l <log_level>] [-s]\n", argv[0]);
                 return -1;
         }
     }
@@ -1192,7 +2000,7 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Error: Must specify a port with -p <port>\n");
         return -1;
     }
-    else if (port < 1024 || port > 65535) {
+    else if (port < 1024 || port > 65535 || (statsPort != 0 && (statsPort < 1024 || statsPort > 65535))) {
         fprintf(stderr, "Error: Port must be in the range 1024 <= port <= 65535\n");
         return -1;
     }
@@ -1201,27 +2009,37 @@ int main(int argc, char *argv[]) {
     char ip_local[INET_ADDRSTRLEN];
     obtener_ip_local(ip_local, sizeof(ip_local));
 
+    // Arrancar la traza antes de escribir en ella
+    log_init(level, syncLog);
+
     // Mostrar mensaje inicial
-    printf("s> init server %s:%d\n", ip_local, port);
+    log_info("s> init server %s:%d", ip_local, port);
 
     // Registrar el manejador de señales para SIGINT (Ctrl+C)
     if (signal(SIGINT, signal_ctrlc) == SIG_ERR) {
         perror("Error al registrar el manejador de señales (servidor)\n");
         return -1;
     }
+    // Un cliente que cierra la conexión no debe terminar el servidor al escribirle
+    signal(SIGPIPE, SIG_IGN);
+    // Admitir tantas conexiones abiertas como permita el sistema
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max) {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
 
     pthread_attr_t t_attr;	// atributos de los threads
     pthread_t thid[MAX_THREADS];
     int err;
-    int pos = 0;
 
     struct sockaddr_in server_addr,  client_addr;
     socklen_t size;
     int sc;
     int val;
 
-    // Crear descriptor del socket del servidor
-    if ((sd = socket(AF_INET, SOCK_STREAM, 0)) < 0){
+    // Crear descriptor del socket del servidor (no bloqueante para el reactor)
+    if ((sd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0){
         perror("Error al crear el socket del servidor (servidor)\n");
         return -1;
     }
@@ -1236,7 +2054,7 @@ int main(int argc, char *argv[]) {
     server_addr.sin_addr.s_addr = INADDR_ANY;
     server_addr.sin_port        = htons(port);
 
-    // Asignar una dirección local a un socket
+    // Asignar una dirección local a un socket
     err = bind(sd, (const struct sockaddr *)&server_addr,sizeof(server_addr));
     if (err == -1) {
         perror("Error en bind (servidor)\n");
@@ -1252,15 +2070,102 @@ int main(int argc, char *argv[]) {
         return -1;
     }
 
-    size = sizeof(client_addr);
+    // Crear el reactor (epoll) y registrar el socket del servidor
+    epfd = epoll_create1(0);
+    if (epfd == -1) {
+        perror("Error en epoll_create1 (servidor)\n");
+        close (sd);
+        return -1;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL;     // NULL identifica al socket del servidor
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sd, &ev) == -1) {
+        perror("Error en epoll_ctl (servidor)\n");
+        close (epfd);
+        close (sd);
+        return -1;
+    }
 
     // Inicializar los mutex
     pthread_mutex_init(&mutex,NULL);
     pthread_cond_init(&no_lleno,NULL);
     pthread_cond_init(&no_vacio,NULL);
     pthread_mutex_init(&mfin,NULL);
-    pthread_mutex_init(&users_file_mutex, NULL);
+    pthread_cond_init(&cfin,NULL);
     init_mutex_list();
+    // Inicializar la tabla de usuarios en memoria
+    if (registry_init() != 0) {
+        close (sd);
+        return -1;
+    }
+
+    // SIGINT solo se atiende en el thread principal, para que interrumpa epoll_wait
+    sigset_t sigint_set;
+    sigemptyset(&sigint_set);
+    sigaddset(&sigint_set, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &sigint_set, NULL);
+
+    // Inicializar storage y recuperar el estado: snapshot más el log posterior
+    long recovered = -1;
+    if (storage_init(STORAGE_DIR) == 0) {
+        recovered = storage_recover();
+    }
+    if (recovered < 0) {
+        fprintf(stderr, "Error al recuperar el estado de %s (servidor)\n", STORAGE_DIR);
+        close (sd);
+        return -1;
+    }
+    if (recovered > 0) {
+        log_info("s> %ld operaciones recuperadas del log", recovered);
+    }
+    // Primera versión de la lista de conectados a partir del estado recuperado
+    if (connected_init(registry_first()) != 0) {
+        close (sd);
+        return -1;
+    }
+    // Índice de búsqueda con los contenidos recuperados
+    if (search_init() != 0) {
+        close (sd);
+        return -1;
+    }
+    for (UserNode* node = registry_first(); node != NULL; node = node->next) {
+        for (int i = 0; i < node->user.contentsUsed; i++) {
+            Content* content = &node->user.contents[i];
+            if (content->fileName != NULL && search_add(node->seq, node->user.userName, content->fileName,
+                                                        content->description, content->manifest) != 0) {
+                close (sd);
+                return -1;
+            }
+        }
+    }
+
+    // Métricas por operación (la 0 agrupa las peticiones no reconocidas); el thread principal
+    // cuenta las conexiones aceptadas
+    const char* opNames[OP_COUNT];
+    for (int i = 0; i < OP_COUNT; i++) {
+        opNames[i] = operaciones[i].name;
+    }
+    if (metrics_init(opNames, OP_COUNT) != 0) {
+        close (sd);
+        return -1;
+    }
+    metrics_thread_init();
+    // Puerto local de métricas en formato de Prometheus, solo accesible desde la máquina
+    pthread_t thstats;
+    if (statsPort != 0) {
+        struct sockaddr_in stats_addr = { .sin_family = AF_INET, .sin_port = htons(statsPort) };
+        stats_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        statsSd = socket(AF_INET, SOCK_STREAM, 0);
+        if (statsSd == -1 || setsockopt(statsSd, SOL_SOCKET, SO_REUSEADDR, (char *) &val, sizeof(int)) == -1 ||
+            bind(statsSd, (const struct sockaddr *) &stats_addr, sizeof(stats_addr)) == -1 ||
+            listen(statsSd, SOMAXCONN) == -1 || pthread_create(&thstats, NULL, stats_listener, NULL) != 0) {
+            perror("Error al abrir el puerto de métricas (servidor)\n");
+            close (sd);
+            return -1;
+        }
+        log_info("s> métricas en http://127.0.0.1:%d/metrics", statsPort);
+    }
 
     // Creación del pool de threads
     pthread_attr_init(&t_attr);
@@ -1270,64 +2175,95 @@ int main(int argc, char *argv[]) {
             close (sd);
             return -1;
         }
+    // Thread de snapshots periódicos del storage
+    pthread_t thsnap;
+    if (pthread_create(&thsnap, NULL, snapshotter, NULL) != 0) {
+        perror("Error creando el thread de snapshots (servidor)\n");
+        close (sd);
+        return -1;
+    }
+    pthread_sigmask(SIG_UNBLOCK, &sigint_set, NULL);
 
-    // Inicializar storage y eliminar archivos .txt existentes
-    init_storage();
-    // Inicializar fichero de usuarios (estructura de almacenamiento)
-    init_file(usersFilePath);
-
-    // Bucle para aceptar conexiones de clientes
+    // Reactor: acepta conexiones y lee las peticiones sin bloquearse; solo las peticiones
+    // completas pasan al pool de threads
+    struct epoll_event events[MAX_EVENTS];
     while (terminar_servidor == 0) {
-        //printf("\nEsperando conexión...\n");
-        sc = accept(sd, (struct sockaddr *) &client_addr, (socklen_t *) &size);
-        if (sc == -1) {
-            if (terminar_servidor == 1) {
-                // accept fue interrumpido por una señal
-                break;
+        int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;   // epoll_wait interrumpido por una señal
             }
-            perror("Error en accept (servidor)\n");
-            continue;   // Intentar aceptar una nueva conexión
-            //return -1;
+            perror("Error en epoll_wait (servidor)\n");
+            break;
         }
 
-        printf("Conexión aceptada de IP: %s   Puerto: %d\n", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+        for (int i = 0; i < n; i++) {
+            Conn* conn = events[i].data.ptr;
+            if (conn == NULL) {
+                // Aceptar todas las conexiones pendientes
+                for (;;) {
+                    size = sizeof(client_addr);
+                    sc = accept4(sd, (struct sockaddr *) &client_addr, &size, SOCK_NONBLOCK);
+                    if (sc == -1) {
+                        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && terminar_servidor == 0) {
+                            perror("Error en accept (servidor)\n");
+                        }
+                        break;
+                    }
+
+                    log_debug("Conexión aceptada de IP: %s   Puerto: %d", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+                    metrics_connection();
+
+                    conn = calloc(1, sizeof(Conn));
+                    if (conn == NULL) {
+                        perror("Error al asignar memoria para la conexión (servidor)");
+                        close(sc);
+                        continue;
+                    }
+                    conn->sc = sc;
+                    initLineReader(&conn->reader, sc);
+                    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+                    ev.data.ptr = conn;
+                    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sc, &ev) == -1) {
+                        perror("Error en epoll_ctl (servidor)\n");
+                        conn_close(conn);
+                    }
+                }
+                continue;
+            }
 
-        // Si no hay errores al aceptar la conexión, añadir el descriptor del socket al buffer
-        int* sc_local = malloc(sizeof(int));
-        if (sc_local == NULL) {
-            perror("Error al asignar memoria sc_local (servidor)");
-            close(sc);
-            close (sd);
-            return -1;
+            // Leer lo que haya llegado de la petición del cliente
+            int estado = conn_read(conn);
+            if (estado == 0) {
+                continue;   // Petición incompleta: esperar más datos
+            }
+            // La conexión sale del reactor: o pasa al pool o se cierra
+            epoll_ctl(epfd, EPOLL_CTL_DEL, conn->sc, NULL);
+            if (estado == 1) {
+                encolar_peticion(conn);
+            } else {
+                conn_close(conn);
+            }
         }
-        *sc_local = sc;
-        pthread_mutex_lock(&mutex);
-        while (n_elementos == MAX_SOCKETS) {
-            pthread_cond_wait(&no_lleno, &mutex);
-        }
-        // Añadir la copia del descriptor (sc_local) al buffer de sockets
-        buffer_sockets[pos] = sc_local;
-        pos = (pos + 1) % MAX_SOCKETS;
-        n_elementos++;
-        pthread_cond_signal(&no_vacio);
-        pthread_mutex_unlock(&mutex);
     } // WHILE
 
     // Si se termina el servidor
-    // Cerrar sockets que puedan quedar abiertos en el buffer
+    // Cerrar las conexiones que puedan quedar en el buffer
     pthread_mutex_lock(&mutex);
     for (int i = 0; i < MAX_SOCKETS; i++) {
         if (buffer_sockets[i] != NULL) {
-            close(*buffer_sockets[i]); // Cerrar el socket
-            free(buffer_sockets[i]);  // Liberar la memoria asignada
+            conn_close(buffer_sockets[i]); // Cerrar el socket y liberar la conexión
             buffer_sockets[i] = NULL; // Marcar como nulo por precaución
         }
     }
+    n_elementos = 0;
     pthread_mutex_unlock(&mutex);
+    close(epfd);
 
     // Notificar a los threads que deben terminar
     pthread_mutex_lock(&mfin);
     fin=true;
+    pthread_cond_broadcast(&cfin);
     pthread_mutex_unlock(&mfin);
 
     pthread_mutex_lock(&mutex);
@@ -1337,19 +2273,34 @@ int main(int argc, char *argv[]) {
     // Esperar a los threads
     for (int i=0;i<MAX_THREADS;i++)
         pthread_join(thid[i],NULL);
+    pthread_join(thsnap,NULL);
+    if (statsSd != -1) {
+        // Despertar al thread de métricas, bloqueado en accept
+        shutdown(statsSd, SHUT_RDWR);
+        pthread_join(thstats, NULL);
+        close(statsSd);
+    }
+
+    // Snapshot final para que el siguiente arranque no tenga que aplicar el log
+    if (storage_log_records() > 0 && take_snapshot() != 0) {
+        fprintf(stderr, "Error al tomar el snapshot final (servidor)\n");
+    }
+    // Escribir en disco las mutaciones pendientes y cerrar el log
+    storage_close();
 
     // Destruir mutexes y variables condicionales
     pthread_mutex_destroy(&mutex);
     pthread_cond_destroy(&no_lleno);
     pthread_cond_destroy(&no_vacio);
     pthread_mutex_destroy(&mfin);
-    pthread_mutex_destroy(&users_file_mutex);
-    if (mutexList != NULL) {
-        for (int i = 0; i < mutexCount; i++) {
-            pthread_mutex_destroy(&mutexList[i].mutex);
-        }
-        free(mutexList); // Liberar el arreglo de estructuras MutexMap
-    }
+    pthread_cond_destroy(&cfin);
+    search_destroy();
+    connected_destroy();
+    registry_destroy();
+    strpool_destroy();
+    destroy_mutex_list();
+    metrics_destroy();
+    log_destroy();
 
     // Cerrar el socket del servidor
     close (sd);
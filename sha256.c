@@ -0,0 +1,189 @@
+// sha256.c
+// SHA-256 (FIPS 180-4) para comprobar la integridad de los ficheros que se descargan entre
+// pares. Es el mismo resumen que hashlib.sha256 en client.py.
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sha256.h"
+
+#define SHA256_READ_SIZE    (1 << 20)   // bloque de lectura de sha256_file
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n)  (((x) >> (n)) | ((x) << (32 - (n))))
+
+/** Función para procesar un bloque de 64 bytes */
+static void transform(uint32_t state[8], const unsigned char* block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t) block[4 * i] << 24 | (uint32_t) block[4 * i + 1] << 16
+             | (uint32_t) block[4 * i + 2] << 8 | block[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+/** Función para empezar un resumen */
+void sha256_init(Sha256* ctx) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(ctx->state, initial, sizeof(initial));
+    ctx->length = 0;
+    ctx->used = 0;
+}
+
+/** Función para añadir datos al resumen */
+void sha256_update(Sha256* ctx, const void* data, size_t len) {
+    const unsigned char* p = data;
+    ctx->length += len;
+    if (ctx->used > 0) {
+        size_t copy = len < 64 - ctx->used ? len : 64 - ctx->used;
+        memcpy(ctx->block + ctx->used, p, copy);
+        ctx->used += copy;
+        p += copy;
+        len -= copy;
+        if (ctx->used < 64) {
+            return;
+        }
+        transform(ctx->state, ctx->block);
+        ctx->used = 0;
+    }
+    // Los bloques completos se procesan sin copiarlos
+    for (; len >= 64; p += 64, len -= 64) {
+        transform(ctx->state, p);
+    }
+    memcpy(ctx->block, p, len);
+    ctx->used = len;
+}
+
+/** Función para terminar el resumen */
+void sha256_final(Sha256* ctx, unsigned char digest[SHA256_SIZE]) {
+    uint64_t bits = ctx->length * 8;
+    unsigned char pad[72] = { 0x80 };
+    size_t padLen = (ctx->used < 56 ? 56 : 120) - ctx->used;
+    for (int i = 0; i < 8; i++) {
+        pad[padLen + i] = (unsigned char) (bits >> (56 - 8 * i));
+    }
+    sha256_update(ctx, pad, padLen + 8);
+    for (int i = 0; i < 8; i++) {
+        digest[4 * i] = ctx->state[i] >> 24;
+        digest[4 * i + 1] = ctx->state[i] >> 16;
+        digest[4 * i + 2] = ctx->state[i] >> 8;
+        digest[4 * i + 3] = ctx->state[i];
+    }
+}
+
+/** Función para escribir un resumen en hexadecimal */
+void sha256_hex(const unsigned char digest[SHA256_SIZE], char hex[SHA256_HEX_SIZE]) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < SHA256_SIZE; i++) {
+        hex[2 * i] = digits[digest[i] >> 4];
+        hex[2 * i + 1] = digits[digest[i] & 0xf];
+    }
+    hex[2 * SHA256_SIZE] = '\0';
+}
+
+/** Función para calcular el resumen de un fichero completo (en hexadecimal) */
+// Si chunkSize no es 0, calcula también el resumen de cada trozo de chunkSize bytes (el último
+// puede ser más corto) en *chunks, reservado con malloc, con *chunkCount resúmenes seguidos.
+// Lee desde el principio con pread, sin mover la posición del descriptor.
+int sha256_file(int fd, off_t chunkSize, char hex[SHA256_HEX_SIZE], unsigned char** chunks, size_t* chunkCount) {
+    unsigned char* buf = malloc(SHA256_READ_SIZE);
+    unsigned char* list = NULL;
+    size_t count = 0, capacity = 0;
+    if (!buf) {
+        perror("Error al asignar memoria para el resumen");
+        return -1;
+    }
+    Sha256 ctx, chunk;
+    sha256_init(&ctx);
+    sha256_init(&chunk);
+    off_t offset = 0;
+    off_t chunkFill = 0;        // bytes del trozo en curso
+    for (;;) {
+        ssize_t n = pread(fd, buf, SHA256_READ_SIZE, offset);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            free(buf);
+            free(list);
+            return -1;
+        }
+        if (n == 0) break;
+        sha256_update(&ctx, buf, n);
+        // Repartir el bloque entre los trozos que toca
+        for (ssize_t pos = 0; chunkSize > 0 && pos < n; ) {
+            off_t room = chunkSize - chunkFill;
+            size_t part = n - pos < room ? (size_t) (n - pos) : (size_t) room;
+            sha256_update(&chunk, buf + pos, part);
+            pos += part;
+            chunkFill += part;
+            if (chunkFill == chunkSize) {
+                if (count == capacity) {
+                    capacity = capacity ? capacity * 2 : 16;
+                    unsigned char* grown = realloc(list, capacity * SHA256_SIZE);
+                    if (!grown) {
+                        perror("Error al asignar memoria para el resumen");
+                        free(buf);
+                        free(list);
+                        return -1;
+                    }
+                    list = grown;
+                }
+                sha256_final(&chunk, list + count++ * SHA256_SIZE);
+                sha256_init(&chunk);
+                chunkFill = 0;
+            }
+        }
+        offset += n;
+    }
+    free(buf);
+    unsigned char digest[SHA256_SIZE];
+    sha256_final(&ctx, digest);
+    sha256_hex(digest, hex);
+    if (chunkSize > 0) {
+        // Trozo final incompleto
+        if (chunkFill > 0) {
+            unsigned char* grown = realloc(list, (count + 1) * SHA256_SIZE);
+            if (!grown) {
+                free(list);
+                return -1;
+            }
+            list = grown;
+            sha256_final(&chunk, list + count++ * SHA256_SIZE);
+        }
+        *chunks = list;
+        *chunkCount = count;
+    }
+    return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define SHA256_SIZE     32                      // bytes del resumen
+#define SHA256_HEX_SIZE (2 * SHA256_SIZE + 1)   // resumen en hexadecimal con '\0'
+
+// Estado de un resumen en curso
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;            // bytes procesados
+    unsigned char block[64];    // bloque incompleto
+    size_t used;
+} Sha256;
+
+void sha256_init(Sha256* ctx);
+void sha256_update(Sha256* ctx, const void* data, size_t len);
+void sha256_final(Sha256* ctx, unsigned char digest[SHA256_SIZE]);
+void sha256_hex(const unsigned char digest[SHA256_SIZE], char hex[SHA256_HEX_SIZE]);
+int sha256_file(int fd, off_t chunkSize, char hex[SHA256_HEX_SIZE], unsigned char** chunks, size_t* chunkCount);
+
+#endif
@@ -0,0 +1,427 @@
+// storage.c
+// Persistencia de la tabla de usuarios en el directorio de storage:
+//   registry.snap          imagen binaria (snapshot) con checksum
+//   registry.<N>.log       ficheros del log de mutaciones (wal.c) posteriores al snapshot
+// La recuperación carga el snapshot y aplica solo los ficheros del log que lo siguen.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "storage.h"
+#include "wal.h"
+
+#define SNAPSHOT_FILE       "registry.snap"
+#define SNAPSHOT_MAGIC      "P2PSNAP"
+#define SNAPSHOT_VERSION    2       // la 2 añade el resumen de cada contenido; la 1 se sigue leyendo
+// magic (8) | versión (4) | fichero del log siguiente (8) | usuarios (4)
+#define SNAPSHOT_HEADER     24
+
+static char storageDir[256];
+static unsigned long long firstSeq = 1;     // fichero del log más antiguo en disco
+static unsigned long long currentSeq = 1;   // fichero del log en el que se añade
+
+static void put_u16(char* p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+static void put_u32(char* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (v >> (8 * i)) & 0xFF;
+}
+
+static void put_u64(char* p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (v >> (8 * i)) & 0xFF;
+}
+
+static uint16_t get_u16(const unsigned char* p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_u32(const unsigned char* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint64_t get_u64(const unsigned char* p) {
+    return get_u32(p) | ((uint64_t) get_u32(p + 4) << 32);
+}
+
+/** Función para construir la ruta de un fichero del log */
+static void log_path(char* buffer, size_t len, unsigned long long seq) {
+    snprintf(buffer, len, "%s/registry.%llu.log", storageDir, seq);
+}
+
+/** Función para sincronizar el directorio tras crear, renombrar o borrar ficheros */
+static void sync_dir(void) {
+    int fd = open(storageDir, O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+/** Función para aplicar a la tabla de usuarios un registro del log (recuperación) */
+// Los registros se aplican tal cual: las comprobaciones se hicieron al escribirlos.
+// Todos son idempotentes, por lo que aplicar uno ya reflejado en el snapshot no cambia nada.
+static int apply_log_record(int type, int nfields, char** fields) {
+    if (nfields < 1) {
+        return -1;
+    }
+    User* user = registry_find(fields[0]);
+    switch (type) {
+        case WAL_REGISTER:
+            if (user == NULL && registry_insert(fields[0]) == NULL) return -1;
+            break;
+        case WAL_UNREGISTER:
+            registry_remove(fields[0]);
+            break;
+        case WAL_CONNECT:
+            if (user == NULL || nfields < 3) return -1;
+            return registry_set_connected(user, fields[1], fields[2]);
+        case WAL_DISCONNECT:
+            if (user == NULL) return -1;
+            registry_set_disconnected(user);
+            break;
+        case WAL_PUBLISH:
+            if (user == NULL || nfields < 3) return -1;
+            if (registry_find_content(user, fields[1]) == -1) {
+                return registry_add_content(user, fields[1], fields[2], NULL);
+            }
+            break;
+        case WAL_PUBLISH_HASHED: {
+            if (user == NULL || nfields < 6) return -1;
+            if (registry_find_content(user, fields[1]) != -1) break;
+            char* manifest;
+            if (registry_make_manifest(fields[3], fields[4], fields[5], nfields - 6, (const char* const*) fields + 6,
+                                       &manifest) != 0) {
+                return -1;
+            }
+            int err = registry_add_content(user, fields[1], fields[2], manifest);
+            free(manifest);
+            return err;
+        }
+        case WAL_DELETE: {
+            if (user == NULL || nfields < 2) return -1;
+            int index = registry_find_content(user, fields[1]);
+            if (index != -1) registry_remove_content(user, index);
+            break;
+        }
+        case WAL_PUBLISH_BATCH:
+            // Solo se registran los contenidos que se llegaron a publicar
+            if (user == NULL || nfields % 2 == 0) return -1;
+            for (int i = 1; i < nfields; i += 2) {
+                if (registry_find_content(user, fields[i]) == -1 &&
+                    registry_add_content(user, fields[i], fields[i + 1], NULL) != 0) {
+                    return -1;
+                }
+            }
+            break;
+        case WAL_DELETE_BATCH:
+            if (user == NULL) return -1;
+            for (int i = 1; i < nfields; i++) {
+                int index = registry_find_content(user, fields[i]);
+                if (index != -1) registry_remove_content(user, index);
+            }
+            break;
+        default:
+            return -1;
+    }
+    return 0;
+}
+
+/** Función para inicializar el directorio de storage */
+int storage_init(const char* dir) {
+    // Comprobar si el directorio existe, si no crearlo
+    struct stat st = {0};
+    if (stat(dir, &st) == -1 && mkdir(dir, 0700) == -1) {
+        perror("Error al crear el directorio de storage");
+        return -1;
+    }
+    snprintf(storageDir, sizeof(storageDir), "%s", dir);
+    return 0;
+}
+
+/** Función para reservar espacio en la imagen */
+static int image_reserve(SnapshotImage* image, size_t extra) {
+    if (image->len + extra <= image->capacity) {
+        return 0;
+    }
+    size_t capacity = image->capacity ? image->capacity : 65536;
+    while (capacity < image->len + extra) capacity *= 2;
+    char* data = realloc(image->data, capacity);
+    if (!data) {
+        perror("Error al redimensionar la imagen del snapshot");
+        return -1;
+    }
+    image->data = data;
+    image->capacity = capacity;
+    return 0;
+}
+
+/** Función para añadir una cadena (longitud + bytes) a la imagen */
+static void image_put_string(SnapshotImage* image, const char* s) {
+    size_t len = strlen(s);
+    put_u16(image->data + image->len, (uint16_t) len);
+    memcpy(image->data + image->len + 2, s, len);
+    image->len += 2 + len;
+}
+
+/** Función para añadir una cadena larga (longitud de 4 bytes + bytes) a la imagen */
+static void image_put_text(SnapshotImage* image, const char* s) {
+    size_t len = s ? strlen(s) : 0;
+    put_u32(image->data + image->len, (uint32_t) len);
+    memcpy(image->data + image->len + 4, s ? s : "", len);
+    image->len += 4 + len;
+}
+
+/** Función para inicializar una imagen vacía */
+void snapshot_init(SnapshotImage* image) {
+    memset(image, 0, sizeof(*image));
+}
+
+/** Función para añadir un usuario y sus contenidos a la imagen */
+// Formato:  userName | conectado (1) | ip | port | nº contenidos (4) | [fileName | description | manifest]...
+// El manifest lleva una longitud de 4 bytes (puede pasar de 64 KiB) y está vacío si no hay resumen.
+int snapshot_add_user(SnapshotImage* image, const User* user) {
+    char ip[REGISTRY_IP_LEN], port[REGISTRY_PORT_LEN];
+    registry_format_addr(&user->addr, ip, port);
+    size_t size = 2 + strlen(user->userName) + 1 + 2 + strlen(ip) + 2 + strlen(port) + 4;
+    for (int i = 0; i < user->contentsUsed; i++) {
+        if (user->contents[i].fileName == NULL) continue;   // contenido eliminado
+        size += 8 + strlen(user->contents[i].fileName) + strlen(user->contents[i].description);
+        if (user->contents[i].manifest != NULL) size += strlen(user->contents[i].manifest);
+    }
+    if (image_reserve(image, size) != 0) {
+        return -1;
+    }
+    image_put_string(image, user->userName);
+    image->data[image->len++] = user->status == USER_CONNECTED;
+    image_put_string(image, ip);
+    image_put_string(image, port);
+    put_u32(image->data + image->len, (uint32_t) user->contentsCount);
+    image->len += 4;
+    for (int i = 0; i < user->contentsUsed; i++) {
+        if (user->contents[i].fileName == NULL) continue;
+        image_put_string(image, user->contents[i].fileName);
+        image_put_string(image, user->contents[i].description);
+        image_put_text(image, user->contents[i].manifest);
+    }
+    image->users++;
+    return 0;
+}
+
+/** Función para liberar una imagen */
+void snapshot_free(SnapshotImage* image) {
+    free(image->data);
+    memset(image, 0, sizeof(*image));
+}
+
+/** Función para leer una cadena de la imagen, -1 si se sale de los límites */
+static int image_get_string(const unsigned char* data, size_t len, size_t* pos, char* out, size_t outLen) {
+    if (*pos + 2 > len) return -1;
+    size_t slen = get_u16(data + *pos);
+    if (*pos + 2 + slen > len || slen >= outLen) return -1;
+    memcpy(out, data + *pos + 2, slen);
+    out[slen] = '\0';
+    *pos += 2 + slen;
+    return 0;
+}
+
+/** Función para leer una cadena larga de la imagen, NULL si está vacía */
+// La cadena se reserva con malloc. Devuelve -1 si se sale de los límites o no hay memoria.
+static int image_get_text(const unsigned char* data, size_t len, size_t* pos, char** out) {
+    *out = NULL;
+    if (*pos + 4 > len) return -1;
+    size_t slen = get_u32(data + *pos);
+    if (slen > len - *pos - 4) return -1;
+    if (slen > 0) {
+        if ((*out = malloc(slen + 1)) == NULL) return -1;
+        memcpy(*out, data + *pos + 4, slen);
+        (*out)[slen] = '\0';
+    }
+    *pos += 4 + slen;
+    return 0;
+}
+
+/** Función para cargar el snapshot en la tabla de usuarios */
+// Devuelve 1 si se ha cargado, 0 si no existe y -1 si está corrupto.
+static int snapshot_load(const char* path, unsigned long long* seq) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) return 0;
+        perror("Error abriendo el snapshot");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < SNAPSHOT_HEADER + 4) {
+        fprintf(stderr, "Snapshot %s incompleto\n", path);
+        close(fd);
+        return -1;
+    }
+    size_t len = st.st_size;
+    unsigned char* data = malloc(len);
+    if (!data) {
+        perror("Error al asignar memoria para el snapshot");
+        close(fd);
+        return -1;
+    }
+    size_t readBytes = 0;
+    while (readBytes < len) {
+        ssize_t r = read(fd, data + readBytes, len - readBytes);
+        if (r <= 0) {
+            if (r < 0 && errno == EINTR) continue;
+            break;
+        }
+        readBytes += r;
+    }
+    close(fd);
+
+    // Comprobar la cabecera y el checksum antes de tocar la tabla
+    len -= 4;
+    uint32_t version = get_u32(data + 8);
+    if (readBytes != st.st_size || memcmp(data, SNAPSHOT_MAGIC, 8) != 0 ||
+        version < 1 || version > SNAPSHOT_VERSION || wal_crc32(0, data, len) != get_u32(data + len)) {
+        fprintf(stderr, "Snapshot %s corrupto\n", path);
+        free(data);
+        return -1;
+    }
+    *seq = get_u64(data + 12);
+    uint32_t users = get_u32(data + 20);
+
+    size_t pos = SNAPSHOT_HEADER;
+    char userName[256], ip[256], port[256], fileName[256], description[256];
+    for (uint32_t u = 0; u < users; u++) {
+        if (image_get_string(data, len, &pos, userName, sizeof(userName)) != 0 || pos + 1 > len) goto corrupt;
+        int connected = data[pos++];
+        if (image_get_string(data, len, &pos, ip, sizeof(ip)) != 0 ||
+            image_get_string(data, len, &pos, port, sizeof(port)) != 0 || pos + 4 > len) goto corrupt;
+        uint32_t contents = get_u32(data + pos);
+        pos += 4;
+
+        User* user = registry_insert(userName);
+        if (user == NULL) goto corrupt;
+        if (connected && registry_set_connected(user, ip, port) != 0) goto corrupt;
+        for (uint32_t c = 0; c < contents; c++) {
+            if (image_get_string(data, len, &pos, fileName, sizeof(fileName)) != 0 ||
+                image_get_string(data, len, &pos, description, sizeof(description)) != 0) goto corrupt;
+            char* manifest = NULL;
+            if (version >= 2 && image_get_text(data, len, &pos, &manifest) != 0) goto corrupt;
+            int err = registry_add_content(user, fileName, description, manifest);
+            free(manifest);
+            if (err != 0) goto corrupt;
+        }
+    }
+    free(data);
+    return 1;
+
+corrupt:
+    fprintf(stderr, "Snapshot %s corrupto\n", path);
+    free(data);
+    return -1;
+}
+
+/** Función para recuperar el estado: snapshot más los ficheros del log que lo siguen */
+// Deja el log abierto para añadir registros. Devuelve el nº de registros aplicados o -1.
+long storage_recover(void) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", storageDir, SNAPSHOT_FILE);
+    unsigned long long seq = 1;
+    if (snapshot_load(path, &seq) < 0) {
+        return -1;
+    }
+    firstSeq = seq;
+
+    // Aplicar los ficheros del log en orden; solo el último puede tener una cola incompleta
+    long recovered = 0;
+    long validLength = 0;
+    currentSeq = seq;
+    for (;;) {
+        log_path(path, sizeof(path), seq);
+        if (access(path, F_OK) != 0) {
+            break;
+        }
+        long applied = wal_replay(path, apply_log_record, &validLength);
+        if (applied < 0) {
+            return -1;
+        }
+        recovered += applied;
+        currentSeq = seq++;
+    }
+
+    log_path(path, sizeof(path), currentSeq);
+    if (wal_open(path, validLength) != 0) {
+        return -1;
+    }
+    sync_dir();
+    return recovered;
+}
+
+/** Función para empezar un nuevo fichero del log */
+// Todo lo añadido antes queda en el fichero anterior, que el siguiente snapshot hará innecesario.
+int storage_rotate(void) {
+    char path[512];
+    log_path(path, sizeof(path), currentSeq + 1);
+    if (wal_rotate(path) != 0) {
+        return -1;
+    }
+    currentSeq++;
+    sync_dir();
+    return 0;
+}
+
+/** Función para obtener el número de registros del fichero actual del log */
+long long storage_log_records(void) {
+    return wal_records();
+}
+
+/** Función para escribir un snapshot y borrar los ficheros del log anteriores */
+// La imagen debe haberse tomado después de storage_rotate: los registros del fichero actual
+// del log que ya estén reflejados en ella se vuelven a aplicar sin efecto en la recuperación.
+int storage_checkpoint(SnapshotImage* image) {
+    char header[SNAPSHOT_HEADER];
+    memcpy(header, SNAPSHOT_MAGIC, 8);
+    put_u32(header + 8, SNAPSHOT_VERSION);
+    put_u64(header + 12, currentSeq);
+    put_u32(header + 20, image->users);
+    char trailer[4];
+    put_u32(trailer, wal_crc32(wal_crc32(0, header, SNAPSHOT_HEADER), image->data, image->len));
+
+    char path[512], tmpPath[512];
+    snprintf(path, sizeof(path), "%s/%s", storageDir, SNAPSHOT_FILE);
+    snprintf(tmpPath, sizeof(tmpPath), "%s/%s.tmp", storageDir, SNAPSHOT_FILE);
+
+    // Escribir en un fichero temporal y renombrarlo: el snapshot anterior sigue siendo válido
+    // hasta que el nuevo está completo en disco
+    FILE* file = fopen(tmpPath, "wb");
+    if (!file) {
+        perror("Error abriendo el snapshot para escritura");
+        return -1;
+    }
+    int err = fwrite(header, 1, SNAPSHOT_HEADER, file) != SNAPSHOT_HEADER ||
+              fwrite(image->data, 1, image->len, file) != image->len ||
+              fwrite(trailer, 1, 4, file) != 4 ||
+              fflush(file) != 0 || fsync(fileno(file)) != 0;
+    if (fclose(file) != 0) err = 1;
+    if (err || rename(tmpPath, path) != 0) {
+        perror("Error escribiendo el snapshot");
+        unlink(tmpPath);
+        return -1;
+    }
+    sync_dir();
+
+    // Compactación: los ficheros del log anteriores ya están reflejados en el snapshot
+    for (; firstSeq < currentSeq; firstSeq++) {
+        log_path(path, sizeof(path), firstSeq);
+        unlink(path);
+    }
+    sync_dir();
+    return 0;
+}
+
+/** Función para cerrar el log */
+void storage_close(void) {
+    wal_close();
+}
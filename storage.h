@@ -0,0 +1,27 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "registry.h"
+
+// Imagen binaria de la tabla de usuarios y sus contenidos
+typedef struct {
+    char* data;
+    size_t len;
+    size_t capacity;
+    uint32_t users;
+} SnapshotImage;
+
+int storage_init(const char* dir);
+long storage_recover(void);
+int storage_rotate(void);
+long long storage_log_records(void);
+int storage_checkpoint(SnapshotImage* image);
+void storage_close(void);
+
+void snapshot_init(SnapshotImage* image);
+int snapshot_add_user(SnapshotImage* image, const User* user);
+void snapshot_free(SnapshotImage* image);
+
+#endif
@@ -0,0 +1,230 @@
+// strpool.c
+// Pool de cadenas compartidas (interning) para los nombres y descripciones de la tabla.
+// Cada cadena distinta se guarda una sola vez con un contador de referencias: los
+// usuarios y contenidos guardan punteros a ella. Las cadenas pequeñas se reservan en
+// bloques grandes (arena) por clases de tamaño de 16 bytes, y las que se liberan quedan
+// en una lista por clase para reutilizarse, sin llegar a malloc/free en cada operación.
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "strpool.h"
+
+#define INITIAL_BUCKETS     64
+#define CLASS_SIZE          16      // granularidad de las clases de tamaño
+#define MAX_SMALL           512     // nodos mayores se reservan con malloc
+#define CLASSES             (MAX_SMALL / CLASS_SIZE)
+
+// Cadena del pool; data es lo que se entrega a los llamantes
+typedef struct PoolString {
+    struct PoolString* next;    // siguiente en el bucket, o en la lista de libres
+    unsigned int hash;
+    unsigned int refs;
+    char data[];
+} PoolString;
+
+// Bloque de la arena; las cadenas empiezan tras la cabecera
+typedef struct PoolChunk {
+    struct PoolChunk* next;
+    char pad[CLASS_SIZE - sizeof(struct PoolChunk*)];   // mantener la alineación de 16
+} PoolChunk;
+
+// Partición del pool: tabla hash, arena y listas de libres propias
+typedef struct {
+    pthread_mutex_t mutex;
+    PoolString** buckets;
+    unsigned int bucketCount;
+    size_t count;
+    size_t bytes;
+    PoolChunk* chunks;
+    size_t chunkUsed;
+    PoolString* freeList[CLASSES];
+} __attribute__((aligned(64))) Stripe;
+
+static Stripe stripes[STRPOOL_STRIPES] = {
+    [0 ... STRPOOL_STRIPES - 1] = { .mutex = PTHREAD_MUTEX_INITIALIZER }
+};
+
+/** Función hash FNV-1a de una cadena */
+static unsigned int hash_string(const char* s) {
+    unsigned int h = 2166136261u;
+    while (*s) {
+        h ^= (unsigned char) *s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/** Función para obtener la partición de un hash (bits altos; los bajos eligen el bucket) */
+static Stripe* stripe_of(unsigned int hash) {
+    return &stripes[(hash >> 24) % STRPOOL_STRIPES];
+}
+
+/** Función para obtener la clase de tamaño de un nodo, -1 si no va en la arena */
+static int size_class(size_t size) {
+    return size <= MAX_SMALL ? (int) ((size - 1) / CLASS_SIZE) : -1;
+}
+
+/** Función para duplicar el número de buckets de una partición */
+static int grow_buckets(Stripe* stripe) {
+    unsigned int newCount = stripe->bucketCount ? stripe->bucketCount * 2 : INITIAL_BUCKETS;
+    PoolString** newBuckets = calloc(newCount, sizeof(PoolString*));
+    if (!newBuckets) {
+        perror("Error al redimensionar el pool de cadenas");
+        return -1;
+    }
+    for (unsigned int i = 0; i < stripe->bucketCount; i++) {
+        PoolString* node = stripe->buckets[i];
+        while (node != NULL) {
+            PoolString* next = node->next;
+            unsigned int b = node->hash & (newCount - 1);
+            node->next = newBuckets[b];
+            newBuckets[b] = node;
+            node = next;
+        }
+    }
+    free(stripe->buckets);
+    stripe->buckets = newBuckets;
+    stripe->bucketCount = newCount;
+    return 0;
+}
+
+/** Función para reservar un nodo de la clase indicada en la arena de la partición */
+static PoolString* arena_alloc(Stripe* stripe, int cls) {
+    size_t rounded = (size_t) (cls + 1) * CLASS_SIZE;
+    PoolString* node = stripe->freeList[cls];
+    if (node != NULL) {
+        stripe->freeList[cls] = node->next;
+        return node;
+    }
+    if (stripe->chunks == NULL || stripe->chunkUsed + rounded > STRPOOL_CHUNK) {
+        // El resto del bloque anterior (menos de MAX_SMALL bytes) se pierde
+        PoolChunk* chunk = malloc(STRPOOL_CHUNK);
+        if (!chunk) {
+            return NULL;
+        }
+        chunk->next = stripe->chunks;
+        stripe->chunks = chunk;
+        stripe->chunkUsed = sizeof(PoolChunk);
+    }
+    node = (PoolString*) ((char*) stripe->chunks + stripe->chunkUsed);
+    stripe->chunkUsed += rounded;
+    return node;
+}
+
+/** Función para obtener la copia compartida de una cadena, NULL si no hay memoria */
+// Cada llamada suma una referencia que se devuelve con strpool_release.
+const char* strpool_intern(const char* s) {
+    unsigned int hash = hash_string(s);
+    Stripe* stripe = stripe_of(hash);
+    pthread_mutex_lock(&stripe->mutex);
+    if (stripe->buckets != NULL) {
+        for (PoolString* node = stripe->buckets[hash & (stripe->bucketCount - 1)]; node != NULL; node = node->next) {
+            if (node->hash == hash && strcmp(node->data, s) == 0) {
+                node->refs++;
+                pthread_mutex_unlock(&stripe->mutex);
+                return node->data;
+            }
+        }
+    }
+    if (stripe->count >= stripe->bucketCount && grow_buckets(stripe) != 0) {
+        pthread_mutex_unlock(&stripe->mutex);
+        return NULL;
+    }
+
+    size_t len = strlen(s) + 1;
+    size_t size = sizeof(PoolString) + len;
+    int cls = size_class(size);
+    PoolString* node = cls >= 0 ? arena_alloc(stripe, cls) : malloc(size);
+    if (!node) {
+        perror("Error al asignar memoria para el pool de cadenas");
+        pthread_mutex_unlock(&stripe->mutex);
+        return NULL;
+    }
+    node->hash = hash;
+    node->refs = 1;
+    memcpy(node->data, s, len);
+    unsigned int b = hash & (stripe->bucketCount - 1);
+    node->next = stripe->buckets[b];
+    stripe->buckets[b] = node;
+    stripe->count++;
+    stripe->bytes += cls >= 0 ? (size_t) (cls + 1) * CLASS_SIZE : size;
+    pthread_mutex_unlock(&stripe->mutex);
+    return node->data;
+}
+
+/** Función para soltar una referencia obtenida con strpool_intern */
+void strpool_release(const char* s) {
+    if (s == NULL) {
+        return;
+    }
+    PoolString* node = (PoolString*) (s - offsetof(PoolString, data));
+    Stripe* stripe = stripe_of(node->hash);
+    pthread_mutex_lock(&stripe->mutex);
+    if (--node->refs > 0) {
+        pthread_mutex_unlock(&stripe->mutex);
+        return;
+    }
+    PoolString** link = &stripe->buckets[node->hash & (stripe->bucketCount - 1)];
+    while (*link != node) {
+        link = &(*link)->next;
+    }
+    *link = node->next;
+    stripe->count--;
+
+    size_t size = sizeof(PoolString) + strlen(node->data) + 1;
+    int cls = size_class(size);
+    if (cls >= 0) {
+        // Queda libre para la próxima cadena de la misma clase
+        node->next = stripe->freeList[cls];
+        stripe->freeList[cls] = node;
+        stripe->bytes -= (size_t) (cls + 1) * CLASS_SIZE;
+    } else {
+        free(node);
+        stripe->bytes -= size;
+    }
+    pthread_mutex_unlock(&stripe->mutex);
+}
+
+/** Función para obtener el número de cadenas distintas y los bytes que ocupan */
+void strpool_stats(size_t* strings, size_t* bytes) {
+    *strings = 0;
+    *bytes = 0;
+    for (int i = 0; i < STRPOOL_STRIPES; i++) {
+        pthread_mutex_lock(&stripes[i].mutex);
+        *strings += stripes[i].count;
+        *bytes += stripes[i].bytes;
+        pthread_mutex_unlock(&stripes[i].mutex);
+    }
+}
+
+/** Función para liberar todas las cadenas del pool (sin usuarios activos) */
+void strpool_destroy(void) {
+    for (int i = 0; i < STRPOOL_STRIPES; i++) {
+        Stripe* stripe = &stripes[i];
+        pthread_mutex_lock(&stripe->mutex);
+        // Las cadenas grandes no están en la arena
+        for (unsigned int b = 0; b < stripe->bucketCount; b++) {
+            PoolString* node = stripe->buckets[b];
+            while (node != NULL) {
+                PoolString* next = node->next;
+                if (size_class(sizeof(PoolString) + strlen(node->data) + 1) < 0) free(node);
+                node = next;
+            }
+        }
+        while (stripe->chunks != NULL) {
+            PoolChunk* next = stripe->chunks->next;
+            free(stripe->chunks);
+            stripe->chunks = next;
+        }
+        free(stripe->buckets);
+        stripe->buckets = NULL;
+        stripe->bucketCount = 0;
+        stripe->count = 0;
+        stripe->bytes = 0;
+        stripe->chunkUsed = 0;
+        memset(stripe->freeList, 0, sizeof(stripe->freeList));
+        pthread_mutex_unlock(&stripe->mutex);
+    }
+}
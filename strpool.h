@@ -0,0 +1,14 @@
+#ifndef STRPOOL_H
+#define STRPOOL_H
+
+#include <stddef.h>
+
+#define STRPOOL_STRIPES     64          // particiones del pool, cada una con su mutex
+#define STRPOOL_CHUNK       (64 * 1024) // tamaño de cada bloque de la arena
+
+const char* strpool_intern(const char* s);
+void strpool_release(const char* s);
+void strpool_stats(size_t* strings, size_t* bytes);
+void strpool_destroy(void);
+
+#endif
@@ -0,0 +1,358 @@
+// wal.c
+// Log de mutaciones de solo añadir (write-ahead log) con group commit.
+// Formato de cada registro (enteros little-endian):
+//      longitud (4) | crc32 (4) | tipo (1) | [longitud campo (2) | campo]...
+// La longitud y el crc cubren el tipo y los campos.
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include "wal.h"
+
+#define WAL_HEADER_SIZE     8
+#define WAL_MAX_RECORD      (4 << 20)  // cabe un lote de WAL_MAX_BATCH contenidos
+
+// Buffer de registros pendientes de escribir en el fichero
+typedef struct {
+    char* data;
+    size_t len;
+    size_t capacity;
+} WalBuffer;
+
+static int walFd = -1;
+static pthread_t flusherThread;
+static pthread_mutex_t walMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pendingCond = PTHREAD_COND_INITIALIZER;   // hay registros pendientes
+static pthread_cond_t durableCond = PTHREAD_COND_INITIALIZER;   // avanza durableLsn
+static WalBuffer pending = {0};     // registros añadidos desde el último flush
+static WalBuffer writing = {0};     // registros que está escribiendo el flusher
+static long long appendLsn = 0;     // último LSN asignado
+static long long durableLsn = 0;    // último LSN escrito y sincronizado en disco
+static long long segmentRecords = 0;    // registros añadidos al fichero actual del log
+static int walError = 0;
+static int walClosing = 0;
+static __thread unsigned long long threadNs;    // tiempo del thread en wal_append/wal_wait (métricas)
+
+static uint32_t crcTable[256];
+static pthread_once_t crcOnce = PTHREAD_ONCE_INIT;
+
+/** Función para inicializar la tabla del CRC-32 (polinomio IEEE) */
+static void crc_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crcTable[i] = c;
+    }
+}
+
+/** Función para calcular el CRC-32 de un bloque (encadenable empezando en 0) */
+uint32_t wal_crc32(uint32_t crc, const void* data, size_t len) {
+    pthread_once(&crcOnce, crc_init);
+    const unsigned char* p = data;
+    crc = ~crc;
+    while (len--) {
+        crc = crcTable[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+/** Función para obtener el instante actual en ns (reloj monótono) */
+static unsigned long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void put_u16(char* p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+static void put_u32(char* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (v >> (8 * i)) & 0xFF;
+}
+
+static uint16_t get_u16(const unsigned char* p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_u32(const unsigned char* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/** Función para reservar espacio en un WalBuffer */
+static int buffer_reserve(WalBuffer* b, size_t extra) {
+    if (b->len + extra <= b->capacity) {
+        return 0;
+    }
+    size_t capacity = b->capacity ? b->capacity : 4096;
+    while (capacity < b->len + extra) capacity *= 2;
+    char* data = realloc(b->data, capacity);
+    if (!data) {
+        perror("Error al redimensionar el buffer del log");
+        return -1;
+    }
+    b->data = data;
+    b->capacity = capacity;
+    return 0;
+}
+
+/** Función para leer el log y aplicar cada registro válido */
+// Devuelve el número de registros aplicados y, en validLength, el tamaño de la parte válida
+// del fichero (un registro final incompleto o corrupto se descarta).
+long wal_replay(const char* path, wal_apply_fn apply, long* validLength) {
+    *validLength = 0;
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        if (errno == ENOENT) {
+            return 0;   // No hay log todavía
+        }
+        perror("Error abriendo el log para la recuperación");
+        return -1;
+    }
+
+    unsigned char* record = malloc(WAL_MAX_RECORD);
+    char** fields = malloc(sizeof(char*) * WAL_MAX_FIELDS);
+    if (!record || !fields) {
+        perror("Error al asignar memoria para la recuperación");
+        free(record);
+        free(fields);
+        fclose(file);
+        return -1;
+    }
+
+    long applied = 0;
+    long offset = 0;
+    unsigned char header[WAL_HEADER_SIZE];
+    while (fread(header, 1, WAL_HEADER_SIZE, file) == WAL_HEADER_SIZE) {
+        uint32_t len = get_u32(header);
+        uint32_t crc = get_u32(header + 4);
+        if (len == 0 || len > WAL_MAX_RECORD) break;
+        if (fread(record, 1, len, file) != len) break;
+        if (wal_crc32(0, record, len) != crc) break;
+
+        // Decodificar los campos (se terminan en nulo en su sitio desplazándolos un byte)
+        int nfields = 0;
+        size_t pos = 1;
+        int ok = 1;
+        while (pos < len) {
+            if (pos + 2 > len || nfields == WAL_MAX_FIELDS) { ok = 0; break; }
+            uint16_t flen = get_u16(record + pos);
+            if (pos + 2 + flen > len) { ok = 0; break; }
+            memmove(record + pos + 1, record + pos + 2, flen);
+            record[pos + 1 + flen] = '\0';
+            fields[nfields++] = (char*) record + pos + 1;
+            pos += 2 + flen;
+        }
+        if (!ok) break;
+
+        apply(record[0], nfields, fields);
+        applied++;
+        offset += WAL_HEADER_SIZE + len;
+    }
+
+    free(record);
+    free(fields);
+    fclose(file);
+    *validLength = offset;
+    return applied;
+}
+
+/** Función ejecutada por el thread que escribe el log en disco (group commit) */
+static void* wal_flusher(void* arg) {
+    pthread_mutex_lock(&walMutex);
+    for (;;) {
+        while (pending.len == 0 && !walClosing) {
+            pthread_cond_wait(&pendingCond, &walMutex);
+        }
+        if (pending.len == 0 && walClosing) {
+            break;
+        }
+        // Intercambiar buffers: los nuevos registros se acumulan mientras se escribe el lote
+        WalBuffer batch = pending;
+        pending = writing;
+        pending.len = 0;
+        writing = batch;
+        long long batchLsn = appendLsn;
+        int fd = walFd;
+        pthread_mutex_unlock(&walMutex);
+
+        int err = 0;
+        size_t written = 0;
+        while (written < batch.len) {
+            ssize_t r = write(fd, batch.data + written, batch.len - written);
+            if (r < 0) {
+                if (errno == EINTR) continue;
+                perror("Error escribiendo el log");
+                err = 1;
+                break;
+            }
+            written += r;
+        }
+        if (!err && fdatasync(fd) != 0) {
+            perror("Error sincronizando el log");
+            err = 1;
+        }
+
+        pthread_mutex_lock(&walMutex);
+        if (err) walError = 1;
+        else durableLsn = batchLsn;
+        pthread_cond_broadcast(&durableCond);
+    }
+    pthread_mutex_unlock(&walMutex);
+    return NULL;
+}
+
+/** Función para abrir el log para añadir registros y arrancar el flusher */
+int wal_open(const char* path, long validLength) {
+    walFd = open(path, O_WRONLY | O_CREAT, 0600);
+    if (walFd < 0) {
+        perror("Error abriendo el log");
+        return -1;
+    }
+    // Descartar una posible cola corrupta y escribir a partir de la parte válida
+    if (ftruncate(walFd, validLength) != 0 || lseek(walFd, validLength, SEEK_SET) < 0) {
+        perror("Error truncando el log");
+        close(walFd);
+        walFd = -1;
+        return -1;
+    }
+    walClosing = 0;
+    walError = 0;
+    segmentRecords = 0;
+    if (pthread_create(&flusherThread, NULL, wal_flusher, NULL) != 0) {
+        perror("Error creando el thread del log");
+        close(walFd);
+        walFd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/** Función para añadir un registro al buffer pendiente de escribir */
+static long long append_record(int type, int nfields, const char** fields) {
+    size_t len = 1;
+    for (int i = 0; i < nfields; i++) {
+        size_t flen = strlen(fields[i]);
+        if (flen > 0xFFFF) return -1;
+        len += 2 + flen;
+    }
+    if (len > WAL_MAX_RECORD) return -1;
+
+    pthread_mutex_lock(&walMutex);
+    if (walError || buffer_reserve(&pending, WAL_HEADER_SIZE + len) != 0) {
+        pthread_mutex_unlock(&walMutex);
+        return -1;
+    }
+    char* record = pending.data + pending.len;
+    char* p = record + WAL_HEADER_SIZE;
+    *p++ = (char) type;
+    for (int i = 0; i < nfields; i++) {
+        size_t flen = strlen(fields[i]);
+        put_u16(p, (uint16_t) flen);
+        memcpy(p + 2, fields[i], flen);
+        p += 2 + flen;
+    }
+    put_u32(record, (uint32_t) len);
+    put_u32(record + 4, wal_crc32(0, record + WAL_HEADER_SIZE, len));
+    pending.len += WAL_HEADER_SIZE + len;
+    long long lsn = ++appendLsn;
+    segmentRecords++;
+    pthread_cond_signal(&pendingCond);
+    pthread_mutex_unlock(&walMutex);
+    return lsn;
+}
+
+/** Función para esperar a que el flusher deje un registro en disco */
+static int wait_durable(long long lsn) {
+    if (lsn < 0) return -1;
+    pthread_mutex_lock(&walMutex);
+    while (durableLsn < lsn && !walError) {
+        pthread_cond_wait(&durableCond, &walMutex);
+    }
+    int result = (durableLsn >= lsn) ? 0 : -1;
+    pthread_mutex_unlock(&walMutex);
+    return result;
+}
+
+/** Función para añadir un registro al log, devuelve su LSN o -1 */
+// No espera a que el registro llegue a disco: para ello se usa wal_wait.
+long long wal_append(int type, int nfields, const char** fields) {
+    unsigned long long start = now_ns();
+    long long lsn = append_record(type, nfields, fields);
+    threadNs += now_ns() - start;
+    return lsn;
+}
+
+/** Función para esperar a que un registro (y todos los anteriores) esté en disco */
+int wal_wait(long long lsn) {
+    unsigned long long start = now_ns();
+    int result = wait_durable(lsn);
+    threadNs += now_ns() - start;
+    return result;
+}
+
+/** Función para obtener (y poner a 0) el tiempo que el thread ha pasado en el log, en ns */
+unsigned long long wal_thread_time(void) {
+    unsigned long long ns = threadNs;
+    threadNs = 0;
+    return ns;
+}
+
+/** Función para continuar el log en un fichero nuevo (los anteriores quedan completos) */
+int wal_rotate(const char* path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        perror("Error creando el nuevo fichero del log");
+        return -1;
+    }
+    pthread_mutex_lock(&walMutex);
+    // Esperar a que todos los registros del fichero actual estén en disco. pthread_cond_wait
+    // suelta el mutex, así que mientras se espera se siguen añadiendo registros: van al fichero
+    // actual y el bucle espera también a que el flusher los escriba. Lo que los separa del
+    // fichero nuevo es que, desde la última comprobación hasta cambiar walFd, el mutex no se
+    // suelta: ningún registro puede quedar pendiente para el fichero anterior
+    while (durableLsn < appendLsn && !walError) {
+        pthread_cond_wait(&durableCond, &walMutex);
+    }
+    if (walError) {
+        pthread_mutex_unlock(&walMutex);
+        close(fd);
+        return -1;
+    }
+    close(walFd);
+    walFd = fd;
+    segmentRecords = 0;
+    pthread_mutex_unlock(&walMutex);
+    return 0;
+}
+
+/** Función para obtener el número de registros añadidos al fichero actual del log */
+long long wal_records(void) {
+    pthread_mutex_lock(&walMutex);
+    long long records = segmentRecords;
+    pthread_mutex_unlock(&walMutex);
+    return records;
+}
+
+/** Función para escribir los registros pendientes, parar el flusher y cerrar el log */
+void wal_close(void) {
+    if (walFd < 0) return;
+    pthread_mutex_lock(&walMutex);
+    walClosing = 1;
+    pthread_cond_signal(&pendingCond);
+    pthread_mutex_unlock(&walMutex);
+    pthread_join(flusherThread, NULL);
+    close(walFd);
+    walFd = -1;
+    free(pending.data);
+    free(writing.data);
+    memset(&pending, 0, sizeof(pending));
+    memset(&writing, 0, sizeof(writing));
+}
@@ -0,0 +1,34 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Tipos de registro del log de mutaciones
+#define WAL_REGISTER        1   // userName
+#define WAL_UNREGISTER      2   // userName
+#define WAL_CONNECT         3   // userName, ip, port
+#define WAL_DISCONNECT      4   // userName
+#define WAL_PUBLISH         5   // userName, fileName, description
+#define WAL_DELETE          6   // userName, fileName
+#define WAL_PUBLISH_BATCH   7   // userName, [fileName, description]...
+#define WAL_DELETE_BATCH    8   // userName, [fileName]...
+#define WAL_PUBLISH_HASHED  9   // userName, fileName, description, size, digest, chunkSize, [chunk]...
+
+#define WAL_MAX_BATCH       4096    // contenidos por registro de lote como máximo
+#define WAL_MAX_FIELDS      (1 + 2 * WAL_MAX_BATCH)   // también cabe un PUBLISH_HASHED completo
+
+// Función que aplica un registro leído del log durante la recuperación
+typedef int (*wal_apply_fn)(int type, int nfields, char** fields);
+
+uint32_t wal_crc32(uint32_t crc, const void* data, size_t len);
+long wal_replay(const char* path, wal_apply_fn apply, long* validLength);
+int wal_open(const char* path, long validLength);
+long long wal_append(int type, int nfields, const char** fields);
+int wal_wait(long long lsn);
+unsigned long long wal_thread_time(void);
+int wal_rotate(const char* path);
+long long wal_records(void);
+void wal_close(void);
+
+#endif
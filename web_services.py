@@ -2,6 +2,8 @@ from spyne import Application, rpc, ServiceBase, String
 from spyne.protocol.soap import Soap11
 from spyne.server.wsgi import WsgiApplication
 from datetime import datetime
+from socketserver import ThreadingMixIn
+from wsgiref.simple_server import ServerHandler, WSGIRequestHandler, WSGIServer, make_server
 
 
 class DateTimeService(ServiceBase):
@@ -15,8 +17,53 @@ application = Application([DateTimeService],
                           in_protocol=Soap11(validator='lxml'),
                           out_protocol=Soap11())
 
+
+
+class KeepAliveServerHandler(ServerHandler):
+    # Responder en HTTP/1.1 para que el cliente pueda reutilizar la conexión
+    http_version = '1.1'
+
+    def cleanup_headers(self):
+        super().cleanup_headers()
+        # Sin longitud, el final de la respuesta es el cierre de la conexión
+        if 'Content-Length' not in self.headers:
+            self.request_handler.close_connection = True
+        if self.request_handler.close_connection:
+            self.headers['Connection'] = 'close'
+
+
+class KeepAliveRequestHandler(WSGIRequestHandler):
+    # Atiende todas las peticiones de una conexión (WSGIRequestHandler solo atiende una)
+    protocol_version = 'HTTP/1.1'
+    timeout = 60        # segundos que se mantiene abierta una conexión sin peticiones
+
+    def handle(self):
+        try:
+            while True:
+                self.raw_requestline = self.rfile.readline(65537)
+                if not self.raw_requestline or len(self.raw_requestline) > 65536:
+                    return
+                if not self.parse_request():
+                    return
+                handler = KeepAliveServerHandler(
+                    self.rfile, self.wfile, self.get_stderr(), self.get_environ(),
+                    multithread=True,
+                )
+                handler.request_handler = self
+                handler.run(self.server.get_app())
+                if self.close_connection:
+                    return
+        except (TimeoutError, ConnectionError):
+            return
+
+
+class ThreadingWSGIServer(ThreadingMixIn, WSGIServer):
+    # Un hilo por conexión: una conexión abierta no bloquea a los demás clientes
+    daemon_threads = True
+
+
 if __name__ == '__main__':
-    from wsgiref.simple_server import make_server
     # Crea un servicio SOAP simple que utiliza WSGI para escuchar solicitudes en localhost en el puerto 8000
-    server = make_server('127.0.0.1', 8000, WsgiApplication(application))
+    server = make_server('127.0.0.1', 8000, WsgiApplication(application),
+                         server_class=ThreadingWSGIServer, handler_class=KeepAliveRequestHandler)
     server.serve_forever()